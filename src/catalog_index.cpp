@@ -0,0 +1,332 @@
+#include "catalog_index.h"
+#include <QDate>
+#include <QDateTime>
+#include <QRegularExpression>
+#include <algorithm>
+#include <climits>
+#include <iterator>
+
+// Same 1024-based units as MainWindow::humanFileSize
+qint64 parseByteSize(const QString &text) {
+    static const QRegularExpression pattern("^(\\d+(?:\\.\\d+)?)\\s*(b|kb|mb|gb|tb)?$");
+    QRegularExpressionMatch match = pattern.match(text.toLower());
+    if (!match.hasMatch()) {
+        return -1;
+    }
+    double value = match.captured(1).toDouble();
+    const QString unit = match.captured(2);
+    if (unit == "kb") value *= 1024.0;
+    else if (unit == "mb") value *= 1024.0 * 1024.0;
+    else if (unit == "gb") value *= 1024.0 * 1024.0 * 1024.0;
+    else if (unit == "tb") value *= 1024.0 * 1024.0 * 1024.0 * 1024.0;
+    return qint64(value);
+}
+
+bool parseDateRange(const QString &text, qint64 *start, qint64 *end) {
+    QDate first;
+    QDate next;
+    if ((first = QDate::fromString(text, "yyyy-MM-dd")).isValid()) {
+        next = first.addDays(1);
+    } else if ((first = QDate::fromString(text, "yyyy-MM")).isValid()) {
+        next = first.addMonths(1);
+    } else if ((first = QDate::fromString(text, "yyyy")).isValid()) {
+        next = first.addYears(1);
+    } else {
+        return false;
+    }
+    *start = first.startOfDay().toMSecsSinceEpoch();
+    *end = next.startOfDay().toMSecsSinceEpoch() - 1;
+    return true;
+}
+
+namespace {
+
+void insertSorted(QVector<int> &list, int id) {
+    if (list.isEmpty() || list.last() < id) {
+        list.append(id);
+        return;
+    }
+    auto it = std::lower_bound(list.begin(), list.end(), id);
+    if (it == list.end() || *it != id) {
+        list.insert(it, id);
+    }
+}
+
+void insertColumn(std::vector<std::pair<qint64, int>> &column, qint64 value, int id) {
+    if (value < 0) {
+        return;
+    }
+    const std::pair<qint64, int> entry(value, id);
+    column.insert(std::lower_bound(column.begin(), column.end(), entry), entry);
+}
+
+void eraseColumn(std::vector<std::pair<qint64, int>> &column, qint64 value, int id) {
+    if (value < 0) {
+        return;
+    }
+    const std::pair<qint64, int> entry(value, id);
+    auto it = std::lower_bound(column.begin(), column.end(), entry);
+    if (it != column.end() && *it == entry) {
+        column.erase(it);
+    }
+}
+
+} // namespace
+
+bool CatalogQuery::isEmpty() const {
+    return terms.isEmpty() && type.isEmpty() && group.isEmpty() && minSize < 0 && maxSize < 0 && from < 0 && to < 0;
+}
+
+CatalogQuery CatalogQuery::parse(const QString &text) {
+    CatalogQuery query;
+    const QStringList tokens = text.split(' ', Qt::SkipEmptyParts);
+
+    for (const QString &token : tokens) {
+        const QString lower = token.toLower();
+        qint64 start = -1;
+        qint64 end = -1;
+
+        if (lower.startsWith("type:")) {
+            query.type = lower.mid(5);
+        } else if (lower.startsWith("group:") && lower.size() > 6) {
+            query.group = lower.mid(6);
+        } else if (lower.startsWith("size>") || lower.startsWith("size<")) {
+            const bool greater = lower.at(4) == '>';
+            QString value = lower.mid(5);
+            if (value.startsWith('=')) {
+                value.remove(0, 1);
+            }
+            const qint64 bytes = parseByteSize(value);
+            if (bytes < 0) {
+                query.terms << lower;
+            } else if (greater) {
+                query.minSize = bytes;
+            } else {
+                query.maxSize = bytes;
+            }
+        } else if (lower.startsWith("date:") && parseDateRange(lower.mid(5), &start, &end)) {
+            query.from = start;
+            query.to = end;
+        } else if (lower.startsWith("from:") && parseDateRange(lower.mid(5), &start, &end)) {
+            query.from = start;
+        } else if (lower.startsWith("to:") && parseDateRange(lower.mid(3), &start, &end)) {
+            query.to = end;
+        } else {
+            query.terms << lower;
+        }
+    }
+
+    return query;
+}
+
+int CatalogIndex::add(const CatalogItem &item) {
+    int id;
+    if (!freeIds.isEmpty()) {
+        id = freeIds.takeLast();
+        items[id] = item;
+        alive[id] = true;
+    } else {
+        id = items.size();
+        items.append(item);
+        texts.append(QString());
+        alive.append(true);
+    }
+    ++liveCount;
+    indexItem(id);
+    return id;
+}
+
+void CatalogIndex::remove(int id) {
+    if (!contains(id)) {
+        return;
+    }
+    unindexItem(id);
+    items[id] = CatalogItem();
+    texts[id].clear();
+    alive[id] = false;
+    freeIds.append(id);
+    --liveCount;
+}
+
+void CatalogIndex::update(int id, const CatalogItem &item) {
+    if (!contains(id)) {
+        return;
+    }
+    unindexItem(id);
+    items[id] = item;
+    indexItem(id);
+}
+
+void CatalogIndex::clear() {
+    items.clear();
+    texts.clear();
+    alive.clear();
+    freeIds.clear();
+    liveCount = 0;
+    trigrams.clear();
+    bySize.clear();
+    byDate.clear();
+}
+
+bool CatalogIndex::contains(int id) const {
+    return id >= 0 && id < alive.size() && alive[id];
+}
+
+const CatalogItem &CatalogIndex::item(int id) const {
+    return items[id];
+}
+
+int CatalogIndex::count() const {
+    return liveCount;
+}
+
+QString CatalogIndex::searchText(const CatalogItem &item) {
+    return (item.filename + '\n' + item.type + '\n' + item.metadata).toLower();
+}
+
+QVector<quint64> CatalogIndex::trigramKeys(const QString &text) {
+    QVector<quint64> keys;
+    if (text.size() < 3) {
+        return keys;
+    }
+    keys.reserve(text.size() - 2);
+    for (int i = 0; i + 2 < text.size(); ++i) {
+        keys.append((quint64(text.at(i).unicode()) << 32)
+                    | (quint64(text.at(i + 1).unicode()) << 16)
+                    | quint64(text.at(i + 2).unicode()));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+void CatalogIndex::indexItem(int id) {
+    const CatalogItem &entry = items[id];
+    texts[id] = searchText(entry);
+    for (quint64 key : trigramKeys(texts[id])) {
+        insertSorted(trigrams[key], id);
+    }
+    insertColumn(bySize, entry.size, id);
+    insertColumn(byDate, entry.timestamp, id);
+}
+
+void CatalogIndex::unindexItem(int id) {
+    const CatalogItem &entry = items[id];
+    for (quint64 key : trigramKeys(texts[id])) {
+        auto it = trigrams.find(key);
+        if (it == trigrams.end()) {
+            continue;
+        }
+        QVector<int> &postings = it.value();
+        auto pos = std::lower_bound(postings.begin(), postings.end(), id);
+        if (pos != postings.end() && *pos == id) {
+            postings.erase(pos);
+        }
+        if (postings.isEmpty()) {
+            trigrams.erase(it);
+        }
+    }
+    eraseColumn(bySize, entry.size, id);
+    eraseColumn(byDate, entry.timestamp, id);
+}
+
+bool CatalogIndex::matches(int id, const CatalogQuery &query) const {
+    const CatalogItem &entry = items[id];
+    if (!query.type.isEmpty() && !entry.type.startsWith(query.type, Qt::CaseInsensitive)) {
+        return false;
+    }
+    if (!query.group.isEmpty()
+        && !entry.metadata.split('\n').contains("group:" + query.group, Qt::CaseInsensitive)) {
+        return false;
+    }
+    if (query.minSize >= 0 && (entry.size < 0 || entry.size < query.minSize)) {
+        return false;
+    }
+    if (query.maxSize >= 0 && (entry.size < 0 || entry.size > query.maxSize)) {
+        return false;
+    }
+    if (query.from >= 0 && (entry.timestamp < 0 || entry.timestamp < query.from)) {
+        return false;
+    }
+    if (query.to >= 0 && (entry.timestamp < 0 || entry.timestamp > query.to)) {
+        return false;
+    }
+    if (!query.terms.isEmpty()) {
+        for (const QString &term : query.terms) {
+            if (!texts[id].contains(term)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+QVector<int> CatalogIndex::rangeCandidates(const std::vector<std::pair<qint64, int>> &column,
+                                           qint64 low, qint64 high) const {
+    auto first = std::lower_bound(column.begin(), column.end(), std::make_pair(low, INT_MIN));
+    auto last = std::upper_bound(column.begin(), column.end(), std::make_pair(high, INT_MAX));
+    QVector<int> ids;
+    ids.reserve(int(last - first));
+    for (auto it = first; it != last; ++it) {
+        ids.append(it->second);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+QVector<int> CatalogIndex::search(const CatalogQuery &query) const {
+    QVector<int> candidates;
+
+    // Intersect the postings of every trigram, smallest list first
+    QVector<const QVector<int> *> postings;
+    QStringList indexedTerms = query.terms;
+    if (!query.group.isEmpty()) {
+        indexedTerms << "group:" + query.group;
+    }
+    for (const QString &term : indexedTerms) {
+        for (quint64 key : trigramKeys(term)) {
+            auto it = trigrams.constFind(key);
+            if (it == trigrams.constEnd()) {
+                return QVector<int>();
+            }
+            postings.append(&it.value());
+        }
+    }
+
+    if (!postings.isEmpty()) {
+        std::sort(postings.begin(), postings.end(), [](const QVector<int> *a, const QVector<int> *b) {
+            return a->size() < b->size();
+        });
+        candidates = *postings.first();
+        for (int i = 1; i < postings.size() && !candidates.isEmpty(); ++i) {
+            QVector<int> narrowed;
+            std::set_intersection(candidates.cbegin(), candidates.cend(),
+                                  postings[i]->cbegin(), postings[i]->cend(),
+                                  std::back_inserter(narrowed));
+            candidates.swap(narrowed);
+        }
+    } else if (query.minSize >= 0 || query.maxSize >= 0) {
+        candidates = rangeCandidates(bySize, std::max<qint64>(0, query.minSize),
+                                     query.maxSize >= 0 ? query.maxSize : LLONG_MAX);
+    } else if (query.from >= 0 || query.to >= 0) {
+        candidates = rangeCandidates(byDate, std::max<qint64>(0, query.from),
+                                     query.to >= 0 ? query.to : LLONG_MAX);
+    } else {
+        candidates.reserve(liveCount);
+        for (int id = 0; id < alive.size(); ++id) {
+            if (alive[id]) {
+                candidates.append(id);
+            }
+        }
+    }
+
+    // Trigram hits can be false positives and ranges cover one column only
+    QVector<int> result;
+    result.reserve(candidates.size());
+    for (int id : candidates) {
+        if (matches(id, query)) {
+            result.append(id);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,77 @@
+#ifndef CATALOG_INDEX_H
+#define CATALOG_INDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <utility>
+#include <vector>
+
+struct CatalogItem {
+    QString filename;
+    QString type;
+    qint64 size = -1;       // bytes, -1 when unknown
+    qint64 timestamp = -1;  // ms since epoch, -1 when unknown
+    QString metadata;       // extracted metadata, searched as free text
+};
+
+// "10MB", "2.5gb" or plain bytes; -1 if the text is not a size.
+qint64 parseByteSize(const QString &text);
+// "2024", "2024-07" or "2024-07-03" to an inclusive millisecond range.
+bool parseDateRange(const QString &text, qint64 *start, qint64 *end);
+
+// Parsed search box text. Plain words match filename, type and metadata;
+// "type:video", "size>10MB", "size<2GB", "date:2024-07", "from:2024-01-01"
+// "to:2024-02-01" and "group:<event>" narrow the result.
+struct CatalogQuery {
+    QStringList terms;
+    QString type;
+    QString group;
+    qint64 minSize = -1;
+    qint64 maxSize = -1;
+    qint64 from = -1;
+    qint64 to = -1;
+
+    bool isEmpty() const;
+    static CatalogQuery parse(const QString &text);
+};
+
+// Incrementally maintained search index: trigram postings over the text
+// fields plus sorted size and date columns. Ids are stable for the life of
+// an item and are recycled after removal.
+class CatalogIndex {
+public:
+    int add(const CatalogItem &item);
+    void remove(int id);
+    void update(int id, const CatalogItem &item);
+    void clear();
+
+    bool contains(int id) const;
+    const CatalogItem &item(int id) const;
+    int count() const;
+
+    // Matching ids in ascending order.
+    QVector<int> search(const CatalogQuery &query) const;
+
+private:
+    QVector<CatalogItem> items;
+    QVector<QString> texts;  // lower-cased searchText() per id
+    QVector<bool> alive;
+    QVector<int> freeIds;
+    int liveCount = 0;
+
+    QHash<quint64, QVector<int>> trigrams;
+    std::vector<std::pair<qint64, int>> bySize;
+    std::vector<std::pair<qint64, int>> byDate;
+
+    static QString searchText(const CatalogItem &item);
+    static QVector<quint64> trigramKeys(const QString &text);
+    void indexItem(int id);
+    void unindexItem(int id);
+    bool matches(int id, const CatalogQuery &query) const;
+    QVector<int> rangeCandidates(const std::vector<std::pair<qint64, int>> &column,
+                                 qint64 low, qint64 high) const;
+};
+
+#endif // CATALOG_INDEX_H
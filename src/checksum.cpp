@@ -0,0 +1,469 @@
+#include "checksum.h"
+#include "metrics.h"
+#include "resource_governor.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Slice-by-8 tables for the reflected Castagnoli polynomial
+struct Crc32cTables {
+    quint32 table[8][256];
+
+    Crc32cTables() {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+            }
+            table[0][i] = crc;
+        }
+        for (quint32 i = 0; i < 256; ++i) {
+            for (int t = 1; t < 8; ++t) {
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+quint32 crc32cSoftware(quint32 crc, const uchar *p, qint64 size) {
+    static const Crc32cTables tables;
+    const auto &t = tables.table;
+    while (size >= 8) {
+        quint32 low;
+        quint32 high;
+        std::memcpy(&low, p, 4);
+        std::memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+            ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+quint32 crc32cHardware(quint32 crc, const uchar *p, qint64 size) {
+    while (size >= 8) {
+        quint64 value;
+        std::memcpy(&value, p, 8);
+        crc = __crc32cd(crc, value);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+bool hasHardwareCrc() {
+    return true;
+}
+#elif defined(__x86_64__)
+__attribute__((target("sse4.2")))
+quint32 crc32cHardware(quint32 crc, const uchar *p, qint64 size) {
+    quint64 state = crc;
+    while (size >= 8) {
+        quint64 value;
+        std::memcpy(&value, p, 8);
+        state = _mm_crc32_u64(state, value);
+        p += 8;
+        size -= 8;
+    }
+    crc = quint32(state);
+    while (size-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+bool hasHardwareCrc() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#else
+quint32 crc32cHardware(quint32 crc, const uchar *p, qint64 size) {
+    return crc32cSoftware(crc, p, size);
+}
+
+bool hasHardwareCrc() {
+    return false;
+}
+#endif
+
+QMutex &manifestMutex() {
+    static QMutex mutex;
+    return mutex;
+}
+
+struct ManifestEntry {
+    quint32 crc = 0;
+    qint64 size = -1;
+};
+
+QHash<QString, ManifestEntry> readManifest(const QString &directory) {
+    QHash<QString, ManifestEntry> entries;
+    QFile file(ChecksumManifest::manifestPath(directory));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return entries;
+    }
+
+    // Later lines win, so a retried conversion simply appends a new entry
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine();
+        const int first = line.indexOf(' ');
+        const int second = line.indexOf(' ', first + 1);
+        if (first <= 0 || second <= first) {
+            continue;
+        }
+        bool crcOk = false;
+        bool sizeOk = false;
+        ManifestEntry entry;
+        entry.crc = line.left(first).toUInt(&crcOk, 16);
+        entry.size = line.mid(first + 1, second - first - 1).toLongLong(&sizeOk);
+        if (crcOk && sizeOk) {
+            entries.insert(line.mid(second + 1), entry);
+        }
+    }
+    return entries;
+}
+
+quint32 readBigEndian32(const uchar *p) {
+    return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | quint32(p[3]);
+}
+
+bool isCompleteIsoBmff(QFile &file, qint64 fileSize) {
+    qint64 offset = 0;
+    bool sawIndex = false;
+    uchar header[16];
+
+    while (offset < fileSize) {
+        if (!file.seek(offset) || file.read(reinterpret_cast<char *>(header), 8) != 8) {
+            return false;
+        }
+        qint64 boxSize = readBigEndian32(header);
+        if (std::memcmp(header + 4, "moov", 4) == 0 || std::memcmp(header + 4, "meta", 4) == 0) {
+            sawIndex = true;
+        }
+        if (boxSize == 1) {
+            if (file.read(reinterpret_cast<char *>(header + 8), 8) != 8) {
+                return false;
+            }
+            boxSize = (qint64(readBigEndian32(header + 8)) << 32) | readBigEndian32(header + 12);
+        } else if (boxSize == 0) {
+            boxSize = fileSize - offset;  // runs to end of file
+        }
+        if (boxSize < 8) {
+            return false;
+        }
+        offset += boxSize;
+    }
+
+    // A box running past EOF means the writer was cut off mid-way
+    return offset == fileSize && sawIndex;
+}
+
+// Output writes are timed here so the metrics see every one of them
+bool timedWrite(QFile &file, const char *data, qint64 size) {
+    static Counter *written = MetricsRegistry::instance()->counter(
+        "feeder_written_bytes_total", "Bytes written to output files.");
+    static Histogram *latency = MetricsRegistry::instance()->histogram(
+        "feeder_write_seconds", "Latency of one write to an output file.");
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = file.write(data, size) == size;
+    latency->record(timer.nsecsElapsed() / 1000);
+    if (ok) {
+        written->add(size);
+    }
+    return ok;
+}
+
+} // namespace
+
+quint32 crc32c(const char *data, qint64 size, quint32 crc) {
+    const uchar *p = reinterpret_cast<const uchar *>(data);
+    crc = ~crc;
+    crc = hasHardwareCrc() ? crc32cHardware(crc, p, size) : crc32cSoftware(crc, p, size);
+    return ~crc;
+}
+
+ChecksumWriter::ChecksumWriter(const QString &path, qint64 chunkSize, QObject *parent)
+    : QIODevice(parent), finalPath(path), file(path + ".part"), chunkSize(chunkSize) {
+}
+
+ChecksumWriter::~ChecksumWriter() {
+    if (isOpen()) {
+        abort();
+    }
+}
+
+bool ChecksumWriter::open(OpenMode mode) {
+    if (mode & QIODevice::ReadOnly) {
+        return false;
+    }
+    QDir().mkpath(QFileInfo(finalPath).absolutePath());
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "ChecksumWriter: Cannot open" << file.fileName() << file.errorString();
+        return false;
+    }
+    chunk.reserve(int(chunkSize));
+    crc = 0;
+    total = 0;
+    failed = false;
+    return QIODevice::open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+qint64 ChecksumWriter::readData(char *, qint64) {
+    return -1;
+}
+
+qint64 ChecksumWriter::writeData(const char *data, qint64 size) {
+    if (failed) {
+        return -1;
+    }
+    crc = crc32c(data, size, crc);
+    total += size;
+
+    // Large writes bypass the chunk buffer entirely
+    if (chunk.isEmpty() && size >= chunkSize) {
+        ResourceGovernor::instance()->throttle(size);
+        if (!timedWrite(file, data, size)) {
+            failed = true;
+            return -1;
+        }
+        return size;
+    }
+
+    chunk.append(data, int(size));
+    if (chunk.size() >= chunkSize && !flushChunk()) {
+        return -1;
+    }
+    return size;
+}
+
+bool ChecksumWriter::flushChunk() {
+    ResourceGovernor::instance()->throttle(chunk.size());
+    if (!chunk.isEmpty() && !timedWrite(file, chunk.constData(), chunk.size())) {
+        qDebug() << "ChecksumWriter: Write failed for" << file.fileName() << file.errorString();
+        failed = true;
+    }
+    chunk.clear();
+    return !failed;
+}
+
+bool ChecksumWriter::commit() {
+    if (!isOpen()) {
+        return false;
+    }
+    flushChunk();
+    if (!failed && !file.flush()) {
+        failed = true;
+    }
+#if defined(Q_OS_UNIX)
+    if (!failed && ::fsync(file.handle()) != 0) {
+        failed = true;
+    }
+#endif
+    file.close();
+    QIODevice::close();
+
+    if (failed) {
+        QFile::remove(file.fileName());
+        return false;
+    }
+
+    QFile::remove(finalPath);
+    if (!QFile::rename(file.fileName(), finalPath)) {
+        qDebug() << "ChecksumWriter: Cannot move" << file.fileName() << "into place";
+        QFile::remove(file.fileName());
+        return false;
+    }
+    ChecksumManifest::record(finalPath, crc, total);
+    return true;
+}
+
+void ChecksumWriter::abort() {
+    chunk.clear();
+    file.close();
+    QFile::remove(file.fileName());
+    QIODevice::close();
+}
+
+QString ChecksumManifest::manifestPath(const QString &directory) {
+    return QDir(directory).absoluteFilePath(".feeder-checksums");
+}
+
+void ChecksumManifest::record(const QString &filePath, quint32 crc, qint64 size) {
+    QFileInfo info(filePath);
+    QMutexLocker locker(&manifestMutex());
+    QFile file(manifestPath(info.absolutePath()));
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        QTextStream stream(&file);
+        stream << QString("%1").arg(crc, 8, 16, QChar('0')) << ' ' << size << ' ' << info.fileName() << "\n";
+    }
+}
+
+bool ChecksumManifest::recordFile(const QString &filePath) {
+    quint32 crc = 0;
+    qint64 size = 0;
+    if (!checksumFile(filePath, &crc, &size)) {
+        return false;
+    }
+    record(filePath, crc, size);
+    return true;
+}
+
+bool ChecksumManifest::lookup(const QString &filePath, quint32 *crc, qint64 *size) {
+    QFileInfo info(filePath);
+    QHash<QString, ManifestEntry> entries;
+    {
+        QMutexLocker locker(&manifestMutex());
+        entries = readManifest(info.absolutePath());
+    }
+    auto it = entries.constFind(info.fileName());
+    if (it == entries.constEnd()) {
+        return false;
+    }
+    *crc = it->crc;
+    *size = it->size;
+    return true;
+}
+
+int ChecksumManifest::moveFiles(const QString &directory, const QHash<QString, QString> &targets) {
+    QHash<QString, ManifestEntry> entries;
+    {
+        QMutexLocker locker(&manifestMutex());
+        entries = readManifest(directory);
+    }
+
+    QDir dir(directory);
+    int moved = 0;
+    for (auto it = targets.constBegin(); it != targets.constEnd(); ++it) {
+        if (!dir.mkpath(it.value())) {
+            continue;
+        }
+        const QString target = dir.absoluteFilePath(it.value() + '/' + it.key());
+        QFile::remove(target);
+        if (!QFile::rename(dir.absoluteFilePath(it.key()), target)) {
+            qDebug() << "ChecksumManifest: Cannot move" << it.key() << "into" << it.value();
+            continue;
+        }
+        // The old manifest line is skipped by verify() once the file is gone
+        auto entry = entries.constFind(it.key());
+        if (entry != entries.constEnd()) {
+            record(target, entry->crc, entry->size);
+        }
+        ++moved;
+    }
+    return moved;
+}
+
+QStringList ChecksumManifest::verify(const QString &directory, bool fast) {
+    QHash<QString, ManifestEntry> entries;
+    {
+        QMutexLocker locker(&manifestMutex());
+        entries = readManifest(directory);
+    }
+
+    QStringList bad;
+    QDir dir(directory);
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QString path = dir.absoluteFilePath(it.key());
+        QFileInfo info(path);
+        if (!info.exists()) {
+            continue;  // moved or deleted on purpose
+        }
+        if (info.size() != it->size) {
+            bad << path;
+            continue;
+        }
+        if (fast) {
+            continue;
+        }
+        quint32 crc = 0;
+        qint64 size = 0;
+        if (!checksumFile(path, &crc, &size) || crc != it->crc) {
+            bad << path;
+        }
+    }
+    return bad;
+}
+
+bool ChecksumManifest::checksumFile(const QString &filePath, quint32 *crc, qint64 *size) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray buffer(1 << 20, Qt::Uninitialized);
+    quint32 value = 0;
+    qint64 total = 0;
+    qint64 read;
+    while ((read = file.read(buffer.data(), buffer.size())) > 0) {
+        value = crc32c(buffer.constData(), read, value);
+        total += read;
+    }
+    if (read < 0) {
+        return false;
+    }
+    *crc = value;
+    *size = total;
+    return true;
+}
+
+bool isCompleteMediaFile(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 size = file.size();
+    if (size == 0) {
+        return false;
+    }
+
+    const QByteArray head = file.read(12);
+    const uchar *h = reinterpret_cast<const uchar *>(head.constData());
+
+    if (head.size() >= 3 && h[0] == 0xFF && h[1] == 0xD8 && h[2] == 0xFF) {
+        // JPEG: the end-of-image marker must be present near the end
+        const qint64 tailSize = qMin<qint64>(size, 64);
+        file.seek(size - tailSize);
+        return file.read(tailSize).contains("\xFF\xD9");
+    }
+    if (head.size() >= 8 && head.mid(4, 4) == "ftyp") {
+        return isCompleteIsoBmff(file, size);
+    }
+    if (head.size() >= 12 && head.startsWith("RIFF")) {
+        const quint32 riffSize = quint32(h[4]) | (quint32(h[5]) << 8) | (quint32(h[6]) << 16) | (quint32(h[7]) << 24);
+        return qint64(riffSize) + 8 == size;
+    }
+    if (head.startsWith("\x89PNG")) {
+        file.seek(qMax<qint64>(0, size - 12));
+        return file.read(12).contains("IEND");
+    }
+    return true;
+}
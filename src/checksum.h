@@ -0,0 +1,80 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+#include <QStringList>
+
+// CRC32C (Castagnoli). Uses the ARMv8 CRC instructions or SSE4.2 when the
+// CPU has them and a slice-by-8 table otherwise. Pass the previous result
+// as crc to checksum data incrementally.
+quint32 crc32c(const char *data, qint64 size, quint32 crc = 0);
+
+// Write-only device that checksums bytes as they pass through, collects
+// them into large chunks and only renames "<path>.part" to its final name
+// on commit(). Anything that takes a QIODevice (QImageWriter, copy loops)
+// can write through it, so no output has to be read back to be verified.
+class ChecksumWriter : public QIODevice {
+    Q_OBJECT
+
+public:
+    explicit ChecksumWriter(const QString &path, qint64 chunkSize = 1 << 20, QObject *parent = nullptr);
+    ~ChecksumWriter();
+
+    bool open(OpenMode mode = QIODevice::WriteOnly) override;
+    bool isSequential() const override { return true; }
+
+    // Flushes, fsyncs and renames into place. Returns false (and removes
+    // the partial file) if any write failed.
+    bool commit();
+    void abort();
+
+    quint32 checksum() const { return crc; }
+    qint64 bytesWritten() const { return total; }
+    QString path() const { return finalPath; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    QString finalPath;
+    QFile file;
+    QByteArray chunk;
+    qint64 chunkSize;
+    quint32 crc = 0;
+    qint64 total = 0;
+    bool failed = false;
+
+    bool flushChunk();
+};
+
+// Per-directory sidecar (".feeder-checksums") of "crc32c size name" lines.
+class ChecksumManifest {
+public:
+    static QString manifestPath(const QString &directory);
+
+    static void record(const QString &filePath, quint32 crc, qint64 size);
+    static bool recordFile(const QString &filePath);
+    static bool lookup(const QString &filePath, quint32 *crc, qint64 *size);
+
+    // Moves files of directory into its subdirectories (file name -> subdirectory)
+    // and carries their checksums along. Returns the number of files moved.
+    static int moveFiles(const QString &directory, const QHash<QString, QString> &targets);
+
+    // Returns the files in directory whose size (fast) or contents no longer
+    // match the manifest.
+    static QStringList verify(const QString &directory, bool fast = false);
+
+    static bool checksumFile(const QString &filePath, quint32 *crc, qint64 *size);
+};
+
+// Cheap structural check for outputs written by external tools: the file
+// must be non-empty and, for JPEG / ISO-BMFF (MP4, MOV, HEIC, AVIF) / RIFF
+// (WebP), end exactly where its own framing says it should.
+bool isCompleteMediaFile(const QString &path);
+
+#endif // CHECKSUM_H
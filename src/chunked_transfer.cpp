@@ -0,0 +1,351 @@
+#include "chunked_transfer.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "resource_governor.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+bool preallocate(int fd, qint64 size) {
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size == size) {
+        return true;
+    }
+#if defined(Q_OS_MACOS)
+    // Ask for one contiguous extent first, then for any extents at all
+    fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, size, 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fd, F_PREALLOCATE, &store);
+    }
+#elif defined(Q_OS_LINUX)
+    if (posix_fallocate(fd, 0, size) == 0) {
+        return true;
+    }
+#endif
+    return ftruncate(fd, size) == 0;
+}
+
+} // namespace
+
+LocalFileSource::LocalFileSource(const QString &path) : path(path) {
+}
+
+LocalFileSource::~LocalFileSource() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool LocalFileSource::open() {
+    fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd < 0) {
+        qDebug() << "LocalFileSource: Cannot open" << path;
+        return false;
+    }
+    struct stat info;
+    fileSize = fstat(fd, &info) == 0 ? info.st_size : -1;
+    return fileSize >= 0;
+}
+
+qint64 LocalFileSource::readAt(qint64 offset, char *data, qint64 length) {
+    qint64 total = 0;
+    while (total < length) {
+        const ssize_t read = ::pread(fd, data + total, size_t(length - total), off_t(offset + total));
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            return read < 0 ? -1 : total;
+        }
+        total += read;
+    }
+    return total;
+}
+
+ChunkedTransfer::ChunkedTransfer(RangedSource *source, const QString &outputPath,
+                                 const ChunkedTransferOptions &options)
+    : source(source), outputPath(outputPath), options(options), chunkSize(options.initialChunk) {
+}
+
+QString ChunkedTransfer::partPath(const QString &outputPath) {
+    return outputPath + ".part";
+}
+
+QString ChunkedTransfer::partMapPath(const QString &outputPath) {
+    return outputPath + ".partmap";
+}
+
+bool ChunkedTransfer::loadPartMap() {
+    // "size N" followed by one "offset length" line per checkpointed range
+    QFile file(partMapPath(outputPath));
+    if (!QFileInfo::exists(partPath(outputPath)) || !file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream stream(&file);
+    const QStringList header = stream.readLine().split(' ');
+    if (header.size() != 2 || header[0] != "size" || header[1].toLongLong() != total) {
+        return false;
+    }
+
+    QList<TransferRange> completed;
+    while (!stream.atEnd()) {
+        const QStringList parts = stream.readLine().split(' ');
+        if (parts.size() != 2) {
+            continue;
+        }
+        TransferRange range;
+        range.offset = parts[0].toLongLong();
+        range.length = parts[1].toLongLong();
+        if (range.offset >= 0 && range.length > 0 && range.offset + range.length <= total) {
+            completed << range;
+        }
+    }
+    std::sort(completed.begin(), completed.end(), [](const TransferRange &a, const TransferRange &b) {
+        return a.offset < b.offset;
+    });
+
+    // Whatever the completed ranges do not cover is still pending
+    pending.clear();
+    qint64 position = 0;
+    for (const TransferRange &range : completed) {
+        if (range.offset > position) {
+            pending << TransferRange{position, range.offset - position};
+        }
+        position = std::max(position, range.offset + range.length);
+    }
+    if (position < total) {
+        pending << TransferRange{position, total - position};
+    }
+
+    qint64 remaining = 0;
+    for (const TransferRange &range : pending) {
+        remaining += range.length;
+    }
+    resumed = total - remaining;
+    return true;
+}
+
+bool ChunkedTransfer::run() {
+    total = source->size();
+    if (total < 0) {
+        qDebug() << "ChunkedTransfer: Unknown size for" << source->name();
+        return false;
+    }
+
+    const bool resuming = loadPartMap();
+    if (!resuming) {
+        QFile::remove(partPath(outputPath));
+        pending.clear();
+        if (total > 0) {
+            pending << TransferRange{0, total};
+        }
+        resumed = 0;
+    } else if (resumed > 0) {
+        qDebug() << "ChunkedTransfer: Resuming" << source->name() << "at" << resumed << "of" << total << "bytes";
+    }
+    done = resumed;
+    failed = false;
+
+    fd = ::open(QFile::encodeName(partPath(outputPath)).constData(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || !preallocate(fd, total)) {
+        qDebug() << "ChunkedTransfer: Cannot create" << partPath(outputPath);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    partMap.setFileName(partMapPath(outputPath));
+    if (!partMap.open(resuming ? QIODevice::Append | QIODevice::Text : QIODevice::WriteOnly | QIODevice::Text)) {
+        ::close(fd);
+        return false;
+    }
+    if (!resuming) {
+        partMap.write(QByteArray("size ") + QByteArray::number(total) + "\n");
+        partMap.flush();
+    }
+
+    clock.start();
+    windowStart = 0;
+    QThreadPool pool;
+    pool.setMaxThreadCount(options.inFlight);
+    for (int i = 0; i < options.inFlight; ++i) {
+        pool.start([this]() { worker(); });
+    }
+    pool.waitForDone();
+
+    const bool synced = checkpoint();
+    ::close(fd);
+    fd = -1;
+    partMap.close();
+
+    if (failed || !synced) {
+        qDebug() << "ChunkedTransfer: Stopped" << source->name() << "at" << done << "of" << total
+                 << "bytes; the next run resumes from there";
+        return false;
+    }
+
+    QFile::remove(outputPath);
+    if (!QFile::rename(partPath(outputPath), outputPath)) {
+        qDebug() << "ChunkedTransfer: Cannot rename into" << outputPath;
+        return false;
+    }
+    QFile::remove(partMapPath(outputPath));
+
+    const double seconds = clock.elapsed() / 1000.0;
+    qDebug() << "ChunkedTransfer:" << source->name() << (total - resumed) / 1048576.0 << "MB in"
+             << seconds << "s, final chunk" << chunkSize / 1048576 << "MB";
+    return true;
+}
+
+bool ChunkedTransfer::takeRange(TransferRange *range) {
+    QMutexLocker locker(&mutex);
+    if (failed || pending.isEmpty()) {
+        return false;
+    }
+    TransferRange &front = pending.first();
+    range->offset = front.offset;
+    range->length = std::min(chunkSize, front.length);
+    front.offset += range->length;
+    front.length -= range->length;
+    if (front.length == 0) {
+        pending.removeFirst();
+    }
+    return true;
+}
+
+void ChunkedTransfer::completeRange(const TransferRange &range) {
+    qint64 doneNow;
+    {
+        QMutexLocker locker(&mutex);
+        done += range.length;
+        doneNow = done;
+        unsynced << range;
+        unsyncedBytes += range.length;
+        if (unsyncedBytes >= options.syncInterval && !checkpoint()) {
+            failed = true;
+        }
+
+        // AIMD over windows of one chunk per reader
+        windowBytes += range.length;
+        if (++windowChunks >= options.inFlight) {
+            const qint64 now = clock.nsecsElapsed();
+            const double rate = windowBytes * 1e9 / std::max<qint64>(1, now - windowStart);
+            if (rate >= lastWindowRate * 0.95) {
+                chunkSize = std::min(options.maxChunk, chunkSize + options.minChunk);
+            } else {
+                chunkSize = std::max(options.minChunk, chunkSize / 2);
+            }
+            lastWindowRate = rate;
+            MetricsRegistry::instance()->gauge("feeder_transfer_chunk_bytes", "Current adaptive chunk size.")
+                ->set(chunkSize);
+            windowStart = now;
+            windowBytes = 0;
+            windowChunks = 0;
+        }
+    }
+    if (progress) {
+        progress(doneNow, total);
+    }
+}
+
+void ChunkedTransfer::shrinkChunk() {
+    QMutexLocker locker(&mutex);
+    chunkSize = std::max(options.minChunk, chunkSize / 2);
+}
+
+void ChunkedTransfer::returnRange(const TransferRange &range) {
+    // Back into its place, so pending stays in file order
+    QMutexLocker locker(&mutex);
+    auto it = std::lower_bound(pending.begin(), pending.end(), range.offset,
+                               [](const TransferRange &gap, qint64 offset) { return gap.offset < offset; });
+    pending.insert(it, range);
+}
+
+bool ChunkedTransfer::checkpoint() {
+    // Only record ranges whose data is known to be on disk
+    if (unsynced.isEmpty()) {
+        return true;
+    }
+    if (::fsync(fd) != 0) {
+        return false;
+    }
+    for (const TransferRange &range : unsynced) {
+        partMap.write(QByteArray::number(range.offset) + ' ' + QByteArray::number(range.length) + '\n');
+    }
+    unsynced.clear();
+    unsyncedBytes = 0;
+    return partMap.flush();
+}
+
+bool ChunkedTransfer::writeAt(qint64 offset, const char *data, qint64 length) {
+    ResourceGovernor::instance()->throttle(length);
+    qint64 written = 0;
+    while (written < length) {
+        const ssize_t result = ::pwrite(fd, data + written, size_t(length - written), off_t(offset + written));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        written += result;
+    }
+    return true;
+}
+
+void ChunkedTransfer::worker() {
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    Histogram *chunkSeconds = metrics->histogram("feeder_transfer_chunk_seconds", "Latency of one ranged chunk read.");
+    Counter *transferred = metrics->counter("feeder_transferred_bytes_total", "Bytes transferred from the device.");
+    Counter *retries = metrics->counter("feeder_transfer_chunk_retries_total", "Chunk reads that had to be retried.");
+
+    TransferRange range;
+    while (takeRange(&range)) {
+        // Waits here while other transfers hold the budget
+        PooledBuffer buffer(MemoryStage::Transfer, range.length);
+
+        bool ok = false;
+        for (int attempt = 1; attempt <= options.maxRetries && !ok; ++attempt) {
+            {
+                ScopedTimer timer(chunkSeconds);
+                ok = source->readAt(range.offset, buffer.data(), range.length) == range.length;
+            }
+            ok = ok && writeAt(range.offset, buffer.constData(), range.length);
+            if (!ok) {
+                retries->add();
+                qDebug() << "ChunkedTransfer: Chunk at" << range.offset << "of" << source->name()
+                         << "failed, attempt" << attempt;
+                shrinkChunk();
+                // A read that was too large for the device is retried
+                // smaller; the second half is queued as a range of its own
+                if (range.length >= 2 * options.minChunk) {
+                    const qint64 half = range.length / 2;
+                    returnRange(TransferRange{range.offset + half, range.length - half});
+                    range.length = half;
+                }
+                QThread::msleep(250 * attempt);
+            }
+        }
+
+        if (!ok) {
+            QMutexLocker locker(&mutex);
+            failed = true;
+            return;
+        }
+        transferred->add(range.length);
+        completeRange(range);
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef CHUNKED_TRANSFER_H
+#define CHUNKED_TRANSFER_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <functional>
+
+// Random-access byte source: a file on the device, or a local file standing
+// in for one. readAt() is called from several threads at once.
+class RangedSource {
+public:
+    virtual ~RangedSource() = default;
+
+    virtual QString name() const = 0;
+    virtual qint64 size() const = 0;
+    // Returns the number of bytes read, or -1 on error.
+    virtual qint64 readAt(qint64 offset, char *data, qint64 length) = 0;
+};
+
+class LocalFileSource : public RangedSource {
+public:
+    explicit LocalFileSource(const QString &path);
+    ~LocalFileSource() override;
+
+    bool open();
+    QString name() const override { return path; }
+    qint64 size() const override { return fileSize; }
+    qint64 readAt(qint64 offset, char *data, qint64 length) override;
+
+private:
+    QString path;
+    int fd = -1;
+    qint64 fileSize = -1;
+};
+
+struct ChunkedTransferOptions {
+    int inFlight = 4;                     // concurrent ranged reads
+    qint64 initialChunk = 4ll << 20;
+    qint64 minChunk = 1ll << 20;
+    qint64 maxChunk = 64ll << 20;
+    int maxRetries = 3;                   // per chunk
+    qint64 syncInterval = 64ll << 20;     // bytes between partmap checkpoints
+};
+
+struct TransferRange {
+    qint64 offset = 0;
+    qint64 length = 0;
+};
+
+// Copies a RangedSource into outputPath with several chunk reads in flight,
+// each written with pwrite into a preallocated "<output>.part". Completed
+// ranges are checkpointed to "<output>.partmap" after the data is fsynced,
+// so a failed or interrupted transfer resumes where it left off instead of
+// from zero. The chunk size grows additively while throughput holds and
+// halves when it drops or a read fails; a failed range is split in two
+// and only its first half retried, the rest going back in the queue.
+class ChunkedTransfer {
+public:
+    using ProgressCallback = std::function<void(qint64 done, qint64 total)>;
+
+    ChunkedTransfer(RangedSource *source, const QString &outputPath,
+                    const ChunkedTransferOptions &options = ChunkedTransferOptions());
+
+    void setProgressCallback(const ProgressCallback &callback) { progress = callback; }
+
+    // Blocks until the file is complete or a chunk has failed every retry.
+    bool run();
+
+    qint64 bytesDone() const { return done; }
+    qint64 resumedBytes() const { return resumed; }
+    qint64 currentChunkSize() const { return chunkSize; }
+
+    static QString partPath(const QString &outputPath);
+    static QString partMapPath(const QString &outputPath);
+
+private:
+    RangedSource *source;
+    QString outputPath;
+    ChunkedTransferOptions options;
+    ProgressCallback progress;
+
+    QMutex mutex;
+    QList<TransferRange> pending;     // gaps still to fetch, in file order
+    QList<TransferRange> unsynced;    // written but not yet checkpointed
+    qint64 unsyncedBytes = 0;
+    qint64 total = 0;
+    qint64 done = 0;
+    qint64 resumed = 0;
+    qint64 chunkSize = 0;
+    bool failed = false;
+    int fd = -1;
+    QFile partMap;
+
+    QElapsedTimer clock;
+    qint64 windowStart = 0;
+    qint64 windowBytes = 0;
+    int windowChunks = 0;
+    double lastWindowRate = 0;
+
+    bool loadPartMap();
+    bool checkpoint();
+    bool takeRange(TransferRange *range);
+    void completeRange(const TransferRange &range);
+    void shrinkChunk();
+    void returnRange(const TransferRange &range);
+    bool writeAt(qint64 offset, const char *data, qint64 length);
+    void worker();
+};
+
+#endif // CHUNKED_TRANSFER_H
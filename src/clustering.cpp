@@ -0,0 +1,461 @@
+#include "clustering.h"
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QSet>
+#include <QSettings>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+const qint64 heifScanBytes = 1 << 20;
+const int maxTiffBytes = 64 * 1024;
+// An APP1 segment holds 65535 bytes, less its length and "Exif\0\0"
+const qint64 maxApp1Bytes = 65535 - 2 - 6;
+
+class TiffReader {
+public:
+    explicit TiffReader(const QByteArray &data) : data(data) {
+        littleEndian = data.startsWith("II");
+    }
+
+    bool valid() const {
+        return data.size() >= 8 && (data.startsWith("II") || data.startsWith("MM")) && u16(2) == 42;
+    }
+
+    quint32 u16(qint64 offset) const {
+        if (offset < 0 || offset + 2 > data.size()) {
+            return 0;
+        }
+        const uchar *p = reinterpret_cast<const uchar *>(data.constData()) + offset;
+        return littleEndian ? quint32(p[0] | p[1] << 8) : quint32(p[0] << 8 | p[1]);
+    }
+
+    quint32 u32(qint64 offset) const {
+        if (offset < 0 || offset + 4 > data.size()) {
+            return 0;
+        }
+        const uchar *p = reinterpret_cast<const uchar *>(data.constData()) + offset;
+        return littleEndian ? quint32(p[0]) | quint32(p[1]) << 8 | quint32(p[2]) << 16 | quint32(p[3]) << 24
+                            : quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | quint32(p[3]);
+    }
+
+    // Offset of the value of tag in the IFD at ifdOffset, or -1
+    qint64 find(qint64 ifdOffset, quint32 tag, quint32 *type = nullptr, quint32 *count = nullptr) const {
+        const quint32 entries = u16(ifdOffset);
+        for (quint32 i = 0; i < entries; ++i) {
+            const qint64 entry = ifdOffset + 2 + i * 12;
+            if (entry + 12 > data.size()) {
+                return -1;
+            }
+            if (u16(entry) != tag) {
+                continue;
+            }
+            const quint32 entryType = u16(entry + 2);
+            const quint32 entryCount = u32(entry + 4);
+            static const int typeSizes[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+            const qint64 bytes = entryType < 13 ? qint64(typeSizes[entryType]) * entryCount : 0;
+            if (type) {
+                *type = entryType;
+            }
+            if (count) {
+                *count = entryCount;
+            }
+            return bytes <= 4 ? entry + 8 : qint64(u32(entry + 8));
+        }
+        return -1;
+    }
+
+    QByteArray ascii(qint64 offset, quint32 count) const {
+        if (offset < 0 || offset + count > data.size()) {
+            return QByteArray();
+        }
+        return QByteArray(data.constData() + offset, int(count)).split('\0').first();
+    }
+
+    double rational(qint64 offset) const {
+        const quint32 denominator = u32(offset + 4);
+        return denominator ? double(u32(offset)) / denominator : 0.0;
+    }
+
+private:
+    const QByteArray &data;
+    bool littleEndian = false;
+};
+
+qint64 parseExifDate(const QByteArray &text) {
+    // "YYYY:MM:DD HH:MM:SS"; kept in camera local time, used only for ordering and gaps
+    QDateTime date = QDateTime::fromString(QString::fromLatin1(text.left(19)), "yyyy:MM:dd HH:mm:ss");
+    if (!date.isValid()) {
+        return -1;
+    }
+    date.setTimeSpec(Qt::UTC);
+    return date.toMSecsSinceEpoch();
+}
+
+double readCoordinate(const TiffReader &tiff, qint64 gps, quint32 refTag, quint32 valueTag, char negative) {
+    quint32 count = 0;
+    const qint64 value = tiff.find(gps, valueTag, nullptr, &count);
+    const qint64 ref = tiff.find(gps, refTag);
+    if (value < 0 || count < 3) {
+        return NAN;
+    }
+    double degrees = tiff.rational(value) + tiff.rational(value + 8) / 60.0 + tiff.rational(value + 16) / 3600.0;
+    if (ref >= 0 && tiff.ascii(ref, 2).startsWith(negative)) {
+        degrees = -degrees;
+    }
+    return degrees;
+}
+
+struct UnionFind {
+    QVector<int> parent;
+
+    explicit UnionFind(int size) : parent(size) {
+        std::iota(parent.begin(), parent.end(), 0);
+    }
+
+    int find(int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+
+    void unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+};
+
+quint64 cellKey(qint64 row, qint64 column) {
+    return quint64(row) << 32 | quint32(column);
+}
+
+} // namespace
+
+bool ExifInfo::parseTiff(const QByteArray &tiffData, ExifInfo *info) {
+    TiffReader tiff(tiffData);
+    if (!tiff.valid()) {
+        return false;
+    }
+    const qint64 ifd0 = tiff.u32(4);
+
+    quint32 count = 0;
+    const qint64 exifPointer = tiff.find(ifd0, 0x8769);
+    if (exifPointer >= 0) {
+        const qint64 original = tiff.find(tiff.u32(exifPointer), 0x9003, nullptr, &count);  // DateTimeOriginal
+        if (original >= 0) {
+            info->timestamp = parseExifDate(tiff.ascii(original, count));
+        }
+    }
+    if (info->timestamp < 0) {
+        const qint64 modified = tiff.find(ifd0, 0x0132, nullptr, &count);                    // DateTime
+        if (modified >= 0) {
+            info->timestamp = parseExifDate(tiff.ascii(modified, count));
+        }
+    }
+
+    const qint64 gpsPointer = tiff.find(ifd0, 0x8825);
+    if (gpsPointer >= 0) {
+        const qint64 gps = tiff.u32(gpsPointer);
+        const double latitude = readCoordinate(tiff, gps, 1, 2, 'S');
+        const double longitude = readCoordinate(tiff, gps, 3, 4, 'W');
+        if (!std::isnan(latitude) && !std::isnan(longitude) && (latitude != 0.0 || longitude != 0.0)
+            && std::fabs(latitude) <= 90.0 && std::fabs(longitude) <= 180.0) {
+            info->hasLocation = true;
+            info->latitude = latitude;
+            info->longitude = longitude;
+        }
+    }
+    return info->timestamp >= 0 || info->hasLocation;
+}
+
+bool ExifInfo::read(const QString &path, ExifInfo *info) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray tiff = readTiff(&file);
+    return !tiff.isEmpty() && parseTiff(tiff, info);
+}
+
+QByteArray ExifInfo::readTiff(QIODevice *device) {
+    const QByteArray head = device->read(4);
+    if (head.startsWith("\xFF\xD8")) {
+        // Walk the JPEG segments up to the image data looking for APP1 "Exif"
+        qint64 position = 2;
+        while (device->seek(position)) {
+            const QByteArray marker = device->read(4);
+            if (marker.size() < 4 || uchar(marker[0]) != 0xFF || uchar(marker[1]) == 0xDA) {
+                return QByteArray();
+            }
+            const int length = uchar(marker[2]) << 8 | uchar(marker[3]);
+            if (uchar(marker[1]) == 0xE1) {
+                const QByteArray segment = device->read(qMin(length - 2, maxTiffBytes));
+                if (segment.startsWith(QByteArray("Exif\0\0", 6))) {
+                    return segment.mid(6);
+                }
+            }
+            position += 2 + length;
+        }
+        return QByteArray();
+    }
+
+    // HEIF keeps EXIF as an item that starts with "Exif\0\0"
+    device->seek(0);
+    const QByteArray data = device->read(heifScanBytes);
+    const int exif = data.indexOf(QByteArray("Exif\0\0", 6));
+    if (exif < 0) {
+        return QByteArray();
+    }
+    return data.mid(exif + 6, maxTiffBytes);
+}
+
+QByteArray ExifInfo::forDecodedImage(const QByteArray &tiffData) {
+    TiffReader tiff(tiffData);
+    if (!tiff.valid()) {
+        return QByteArray();
+    }
+
+    // The HEIF scan doesn't know where the item ends, so cut the block
+    // after the last IFD or value it refers to
+    qint64 end = 8;
+    QVector<qint64> pending{qint64(tiff.u32(4))};
+    QSet<qint64> seen;
+    static const int typeSizes[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+    while (!pending.isEmpty()) {
+        const qint64 ifd = pending.takeLast();
+        if (ifd < 8 || ifd + 2 > tiffData.size() || seen.contains(ifd)) {
+            continue;
+        }
+        seen.insert(ifd);
+        const quint32 entries = tiff.u16(ifd);
+        const qint64 next = ifd + 2 + qint64(entries) * 12;
+        if (next + 4 > tiffData.size()) {
+            return QByteArray();
+        }
+        end = std::max(end, next + 4);
+        for (quint32 i = 0; i < entries; ++i) {
+            const qint64 entry = ifd + 2 + i * 12;
+            const quint32 tag = tiff.u16(entry);
+            const quint32 type = tiff.u16(entry + 2);
+            const qint64 bytes = type < 13 ? qint64(typeSizes[type]) * tiff.u32(entry + 4) : 0;
+            if (bytes > 4) {
+                end = std::max(end, qint64(tiff.u32(entry + 8)) + bytes);
+            }
+            if (tag == 0x8769 || tag == 0x8825 || tag == 0xA005) {          // Exif, GPS, Interop IFDs
+                pending << tiff.u32(entry + 8);
+            } else if (tag == 0x0201) {                                      // thumbnail JPEG
+                const qint64 length = tiff.find(ifd, 0x0202);
+                if (length >= 0) {
+                    end = std::max(end, qint64(tiff.u32(entry + 8)) + tiff.u32(length));
+                }
+            }
+        }
+        // IFD1 (the thumbnail) follows IFD0
+        if (ifd == qint64(tiff.u32(4))) {
+            pending << tiff.u32(next);
+        }
+    }
+    if (end > tiffData.size() || end > maxApp1Bytes) {
+        return QByteArray();
+    }
+
+    // The pixels were rotated upright when they were decoded
+    QByteArray block = tiffData.left(int(end));
+    const qint64 orientation = TiffReader(block).find(tiff.u32(4), 0x0112);
+    if (orientation >= 0) {
+        const bool littleEndian = block.startsWith("II");
+        block[int(orientation)] = char(littleEndian ? 1 : 0);
+        block[int(orientation) + 1] = char(littleEndian ? 0 : 1);
+    }
+    return block;
+}
+
+ClusteringOptions ClusteringOptions::load() {
+    QSettings settings;
+    ClusteringOptions options;
+    options.gapMs = qint64(settings.value("clustering/gapMinutes", 120).toInt()) * 60 * 1000;
+    // One degree of latitude is ~111 km
+    options.cellDegrees = settings.value("clustering/cellKm", 1.0).toDouble() / 111.0;
+    return options;
+}
+
+EventClusterer::EventClusterer(const ClusteringOptions &options) : options(options) {
+}
+
+QVector<MediaGroup> EventClusterer::cluster(const QVector<MediaPoint> &points, QVector<int> *assignment) const {
+    QVector<MediaGroup> groups;
+    QVector<int> groupOf(points.size(), -1);
+
+    QVector<int> order;
+    order.reserve(points.size());
+    MediaGroup undated;
+    for (int i = 0; i < points.size(); ++i) {
+        if (points[i].timestamp >= 0) {
+            order << i;
+        } else {
+            undated.members << i;
+        }
+    }
+    std::sort(order.begin(), order.end(), [&points](int a, int b) {
+        return points[a].timestamp < points[b].timestamp;
+    });
+
+    int eventStart = 0;
+    for (int i = 1; i <= order.size(); ++i) {
+        if (i < order.size() && points[order[i]].timestamp - points[order[i - 1]].timestamp <= options.gapMs) {
+            continue;
+        }
+
+        // order[eventStart, i) is one event; split it into places
+        QHash<quint64, int> cells;
+        QVector<int> cellOfMember(i - eventStart, -1);
+        for (int k = eventStart; k < i; ++k) {
+            const MediaPoint &point = points[order[k]];
+            if (!point.hasLocation) {
+                continue;
+            }
+            const quint64 key = cellKey(qint64(std::floor((point.latitude + 90.0) / options.cellDegrees)),
+                                        qint64(std::floor((point.longitude + 180.0) / options.cellDegrees)));
+            auto cell = cells.find(key);
+            if (cell == cells.end()) {
+                cell = cells.insert(key, cells.size());
+            }
+            cellOfMember[k - eventStart] = cell.value();
+        }
+
+        UnionFind places(cells.size());
+        for (auto cell = cells.cbegin(); cell != cells.cend(); ++cell) {
+            const qint64 row = qint64(cell.key() >> 32);
+            const qint64 column = qint64(quint32(cell.key()));
+            for (int dr = -1; dr <= 1; ++dr) {
+                for (int dc = -1; dc <= 1; ++dc) {
+                    const auto neighbour = cells.constFind(cellKey(row + dr, column + dc));
+                    if (neighbour != cells.cend()) {
+                        places.unite(cell.value(), neighbour.value());
+                    }
+                }
+            }
+        }
+
+        // One group per place, in order of first appearance
+        const int size = i - eventStart;
+        QHash<int, int> groupOfPlace;
+        QVector<int> groupOfMember(size, -1);
+        for (int k = 0; k < size; ++k) {
+            if (cellOfMember[k] < 0) {
+                continue;
+            }
+            const int place = places.find(cellOfMember[k]);
+            int group = groupOfPlace.value(place, -1);
+            if (group < 0) {
+                group = groups.size();
+                groups.append(MediaGroup());
+                groupOfPlace.insert(place, group);
+            }
+            groupOfMember[k] = group;
+        }
+
+        if (groupOfPlace.isEmpty()) {
+            // Nothing located: the event is a single group
+            std::fill(groupOfMember.begin(), groupOfMember.end(), int(groups.size()));
+            groups.append(MediaGroup());
+        } else {
+            // Unlocated members join the located member nearest in time,
+            // the earlier one on a tie
+            QVector<int> previous(size, -1);
+            for (int k = 0, last = -1; k < size; ++k) {
+                last = cellOfMember[k] >= 0 ? k : last;
+                previous[k] = last;
+            }
+            for (int k = size - 1, next = -1; k >= 0; --k) {
+                if (cellOfMember[k] >= 0) {
+                    next = k;
+                    continue;
+                }
+                const qint64 time = points[order[eventStart + k]].timestamp;
+                int nearest = previous[k];
+                if (next >= 0 && (nearest < 0 || points[order[eventStart + next]].timestamp - time
+                                                     < time - points[order[eventStart + nearest]].timestamp)) {
+                    nearest = next;
+                }
+                groupOfMember[k] = groupOfMember[nearest];
+            }
+        }
+
+        for (int k = 0; k < size; ++k) {
+            const int member = order[eventStart + k];
+            groups[groupOfMember[k]].members << member;
+            groupOf[member] = groupOfMember[k];
+        }
+        eventStart = i;
+    }
+
+    if (!undated.members.isEmpty()) {
+        for (int member : undated.members) {
+            groupOf[member] = groups.size();
+        }
+        undated.name = "undated";
+        groups.append(undated);
+    }
+
+    // Time span, centroid and a unique name per group
+    QSet<QString> names;
+    for (MediaGroup &group : groups) {
+        int located = 0;
+        for (int member : group.members) {
+            const MediaPoint &point = points[member];
+            if (point.timestamp >= 0) {
+                group.start = group.start < 0 ? point.timestamp : std::min(group.start, point.timestamp);
+                group.end = std::max(group.end, point.timestamp);
+            }
+            if (point.hasLocation) {
+                group.latitude += point.latitude;
+                group.longitude += point.longitude;
+                ++located;
+            }
+        }
+        if (located > 0) {
+            group.hasLocation = true;
+            group.latitude /= located;
+            group.longitude /= located;
+        }
+
+        const QString base = group.name.isEmpty() ? groupName(group) : group.name;
+        QString name = base;
+        for (int suffix = 2; names.contains(name); ++suffix) {
+            name = QString("%1_%2").arg(base).arg(suffix);
+        }
+        names.insert(name);
+        group.name = name;
+    }
+
+    if (assignment) {
+        *assignment = groupOf;
+    }
+    return groups;
+}
+
+QString EventClusterer::groupName(const MediaGroup &group) {
+    // e.g. "2024-07-14", "2024-07-14_to_07-16_48.86N_2.35E"
+    const QDateTime start = QDateTime::fromMSecsSinceEpoch(group.start, Qt::UTC);
+    const QDateTime end = QDateTime::fromMSecsSinceEpoch(group.end, Qt::UTC);
+    QString name = start.toString("yyyy-MM-dd");
+    if (end.date() != start.date()) {
+        name += "_to_" + end.toString(end.date().year() == start.date().year() ? "MM-dd" : "yyyy-MM-dd");
+    }
+    if (group.hasLocation) {
+        name += QString("_%1%2_%3%4")
+                    .arg(std::fabs(group.latitude), 0, 'f', 2).arg(group.latitude < 0 ? 'S' : 'N')
+                    .arg(std::fabs(group.longitude), 0, 'f', 2).arg(group.longitude < 0 ? 'W' : 'E');
+    }
+    return name;
+}
@@ -0,0 +1,72 @@
+#ifndef CLUSTERING_H
+#define CLUSTERING_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+
+// Capture time and position from a photo's EXIF block. Reads JPEG APP1
+// segments directly and finds the "Exif\0\0" item in HEIC files by
+// scanning their first megabyte.
+struct ExifInfo {
+    qint64 timestamp = -1;      // DateTimeOriginal as ms since epoch, camera local time
+    bool hasLocation = false;
+    double latitude = 0.0;
+    double longitude = 0.0;
+
+    static bool read(const QString &path, ExifInfo *info);
+    static bool parseTiff(const QByteArray &tiff, ExifInfo *info);
+    // The raw TIFF block (after "Exif\0\0"), empty if there is none.
+    static QByteArray readTiff(QIODevice *device);
+    // The block cut to what its IFDs use, with Orientation reset to 1, for
+    // writing next to pixels that were rotated on decode. Empty if it is
+    // malformed or too large for a JPEG APP1 segment.
+    static QByteArray forDecodedImage(const QByteArray &tiff);
+};
+
+struct MediaPoint {
+    qint64 timestamp = -1;      // ms since epoch, -1 when unknown
+    bool hasLocation = false;
+    double latitude = 0.0;
+    double longitude = 0.0;
+};
+
+struct MediaGroup {
+    QString name;               // also used as a folder and search token
+    qint64 start = -1;
+    qint64 end = -1;
+    bool hasLocation = false;
+    double latitude = 0.0;      // centroid of the located members
+    double longitude = 0.0;
+    QVector<int> members;       // indexes into the clustered points
+};
+
+struct ClusteringOptions {
+    qint64 gapMs = 2 * 3600 * 1000;   // a pause this long starts a new event
+    double cellDegrees = 0.01;        // spatial grid cell, ~1 km
+
+    // "clustering/gapMinutes" and "clustering/cellKm" settings
+    static ClusteringOptions load();
+};
+
+// Groups media into events and places: points are sorted by time and cut
+// wherever the gap to the previous one exceeds gapMs; inside each event,
+// located points are bucketed into grid cells and touching cells are
+// merged with union-find into places. Points without a position join the
+// place of their nearest located neighbour in time.
+class EventClusterer {
+public:
+    explicit EventClusterer(const ClusteringOptions &options = ClusteringOptions::load());
+
+    // assignment, if given, receives the group index of every point.
+    QVector<MediaGroup> cluster(const QVector<MediaPoint> &points, QVector<int> *assignment = nullptr) const;
+
+private:
+    ClusteringOptions options;
+
+    static QString groupName(const MediaGroup &group);
+};
+
+#endif // CLUSTERING_H
@@ -0,0 +1,336 @@
+#include "command_line_tools.h"
+#include "output_formats.h"
+#include "checksum.h"
+#include "conversion_policy.h"
+#include "encode_planner.h"
+#include "chunked_transfer.h"
+#include "pack_writer.h"
+#include "photos_library.h"
+#include "resource_governor.h"
+#include "session_recorder.h"
+#include "stream_converter.h"
+#include "swift_wrapper.h"
+#include "media_types.h"
+#include "memory_budget.h"
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <cstring>
+
+namespace {
+
+const char *const toolOptions[] = {
+    "--benchmark-formats",
+    "--verify",
+    "--pack-list",
+    "--pack-extract",
+    "--chunked-copy",
+    "--replay",
+    "--policy-dry-run",
+    "--stream-convert",
+    "--photos-library",
+};
+
+} // namespace
+
+bool CommandLineTools::isToolInvocation(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        for (const char *option : toolOptions) {
+            if (std::strcmp(argv[i], option) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool CommandLineTools::applyGlobalOptions(const QStringList &arguments) {
+    for (int i = 1; i < arguments.size(); ++i) {
+        QString value;
+        if (arguments[i] == "--record" && i + 1 < arguments.size()) {
+            if (!SessionRecorder::instance()->start(arguments[++i])) {
+                QTextStream(stderr) << "Cannot record to " << arguments[i] << Qt::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arguments[i] == "--finish-by" && i + 1 < arguments.size()) {
+            QDateTime deadline;
+            if (!EncodePlanner::parseDeadline(arguments[++i], &deadline)) {
+                QTextStream(stderr) << "Cannot parse finish time " << arguments[i]
+                                    << " (expected HH:mm or an ISO date and time)" << Qt::endl;
+                return false;
+            }
+            EncodePlanner::instance()->setDeadline(deadline);
+            continue;
+        }
+        if (arguments[i] == "--mb-per-minute" && i + 1 < arguments.size()) {
+            EncodePlanner::instance()->setTargetMegabytesPerMinute(arguments[++i].toDouble());
+            continue;
+        }
+        if (arguments[i] == "--priority" && i + 1 < arguments.size()) {
+            value = arguments[++i];
+        } else if (arguments[i].startsWith("--priority=")) {
+            value = arguments[i].section('=', 1);
+        } else {
+            continue;
+        }
+        ImportPriority priority;
+        if (!ResourceGovernor::fromName(value, &priority)) {
+            QTextStream(stderr) << "Unknown priority " << value
+                                << " (expected background, foreground or turbo)" << Qt::endl;
+            return false;
+        }
+        ResourceGovernor::instance()->setPriority(priority);
+    }
+    return true;
+}
+
+int CommandLineTools::run(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Feeder command line tools");
+    parser.addHelpOption();
+
+    QCommandLineOption benchmarkOption("benchmark-formats",
+        "Encode every image in <directory> with each output format and report size and speed.",
+        "directory");
+    parser.addOption(benchmarkOption);
+
+    QCommandLineOption verifyOption("verify",
+        "Check every file listed in <directory>'s checksum manifest.", "directory");
+    QCommandLineOption fastOption("fast", "With --verify, compare sizes only.");
+    parser.addOption(verifyOption);
+    parser.addOption(fastOption);
+
+    QCommandLineOption packListOption("pack-list", "List the entries of an output pack.", "pack");
+    QCommandLineOption packExtractOption("pack-extract", "Extract an output pack.", "pack");
+    QCommandLineOption toOption("to",
+                                "Destination directory for --pack-extract, --chunked-copy, --stream-convert and "
+                                "--photos-library.",
+                                "directory", ".");
+    QCommandLineOption entryOption("entry", "Extract only this entry from the pack.", "name");
+    parser.addOption(packListOption);
+    parser.addOption(packExtractOption);
+    parser.addOption(toOption);
+    parser.addOption(entryOption);
+
+    QCommandLineOption chunkedCopyOption("chunked-copy",
+        "Copy <file> with the chunked transfer engine, as a stand-in for a device file.", "file");
+    QCommandLineOption inFlightOption("in-flight", "Concurrent chunk reads for --chunked-copy.", "count", "4");
+    parser.addOption(chunkedCopyOption);
+    parser.addOption(inFlightOption);
+
+    QCommandLineOption priorityOption("priority",
+        "Import priority: background, foreground or turbo.", "mode");
+    parser.addOption(priorityOption);
+
+    QCommandLineOption recordOption("record", "Record the device session to <file>.", "file");
+    QCommandLineOption replayOption("replay",
+        "Replay a recorded import against the recorded device and compare its timing.", "file");
+    QCommandLineOption speedOption("speed", "Replay speed factor for --replay, 0 to skip all waits.", "factor", "1");
+    parser.addOption(recordOption);
+
+    QCommandLineOption finishByOption("finish-by",
+        "Pick encoder presets so conversions finish by this time (HH:mm).", "time");
+    QCommandLineOption sizeTargetOption("mb-per-minute", "Target size per minute of converted video.", "megabytes");
+    parser.addOption(finishByOption);
+    parser.addOption(sizeTargetOption);
+
+    QCommandLineOption policyDryRunOption("policy-dry-run",
+        "Show what the conversion policy would do with the files in <directory>.", "directory");
+    QCommandLineOption deviceOption("device", "Source device name for --policy-dry-run rules.", "name");
+    parser.addOption(policyDryRunOption);
+    parser.addOption(deviceOption);
+    parser.addOption(replayOption);
+    parser.addOption(speedOption);
+
+    QCommandLineOption streamConvertOption("stream-convert",
+        "Convert <file> through the streaming path, as a stand-in for a device file.", "file");
+    QCommandLineOption remuxOption("remux", "With --stream-convert, copy video streams instead of encoding.");
+    parser.addOption(streamConvertOption);
+    parser.addOption(remuxOption);
+
+    QCommandLineOption photosLibraryOption("photos-library", "Download every original in the Photos library.");
+    parser.addOption(photosLibraryOption);
+
+    parser.process(arguments);
+
+    QTextStream out(stdout);
+    if (parser.isSet(benchmarkOption)) {
+        return FormatEncoder::runBenchmark(parser.value(benchmarkOption), out);
+    }
+    if (parser.isSet(verifyOption)) {
+        const QStringList bad = ChecksumManifest::verify(parser.value(verifyOption), parser.isSet(fastOption));
+        for (const QString &path : bad) {
+            out << "MISMATCH " << path << Qt::endl;
+        }
+        out << (bad.isEmpty() ? "All files verified" : QString("%1 files failed").arg(bad.size())) << Qt::endl;
+        return bad.isEmpty() ? 0 : 2;
+    }
+    if (parser.isSet(packListOption)) {
+        PackReader reader(parser.value(packListOption));
+        if (!reader.open()) {
+            out << "Cannot read pack " << parser.value(packListOption) << Qt::endl;
+            return 1;
+        }
+        for (const PackEntry &entry : reader.entries()) {
+            out << QString("%1 %2 %3").arg(entry.size, 14).arg(entry.crc, 8, 16, QChar('0')).arg(entry.name) << Qt::endl;
+        }
+        return 0;
+    }
+    if (parser.isSet(packExtractOption)) {
+        PackReader reader(parser.value(packExtractOption));
+        if (!reader.open()) {
+            out << "Cannot read pack " << parser.value(packExtractOption) << Qt::endl;
+            return 1;
+        }
+        if (!parser.isSet(entryOption)) {
+            return reader.extractAll(parser.value(toOption)) ? 0 : 2;
+        }
+        for (const PackEntry &entry : reader.entries()) {
+            if (entry.name == parser.value(entryOption)) {
+                return reader.extract(entry, parser.value(toOption)) ? 0 : 2;
+            }
+        }
+        out << "No entry named " << parser.value(entryOption) << Qt::endl;
+        return 1;
+    }
+
+    if (parser.isSet(chunkedCopyOption)) {
+        LocalFileSource source(parser.value(chunkedCopyOption));
+        if (!source.open()) {
+            out << "Cannot read " << parser.value(chunkedCopyOption) << Qt::endl;
+            return 1;
+        }
+        QDir().mkpath(parser.value(toOption));
+        ChunkedTransferOptions options;
+        options.inFlight = qMax(1, parser.value(inFlightOption).toInt());
+        SessionRecorder *recorder = SessionRecorder::instance();
+        const qint64 transferId = recorder->transferStarted(source.name(), source.size());
+        RecordingSource recorded(&source, transferId);
+        ChunkedTransfer transfer(&recorded,
+            QDir(parser.value(toOption)).absoluteFilePath(QFileInfo(source.name()).fileName()), options);
+
+        QElapsedTimer timer;
+        timer.start();
+        const bool success = transfer.run();
+        recorder->transferFinished(transferId, success);
+        if (!success) {
+            out << "Transfer stopped at " << transfer.bytesDone() << " bytes; run again to resume" << Qt::endl;
+            return 2;
+        }
+        const double seconds = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+        const double megabytes = (transfer.bytesDone() - transfer.resumedBytes()) / 1048576.0;
+        out << QString("%1 MB in %2 s (%3 MB/s), resumed %4 bytes, final chunk %5 MB")
+                   .arg(megabytes, 0, 'f', 1).arg(seconds, 0, 'f', 2).arg(megabytes / seconds, 0, 'f', 1)
+                   .arg(transfer.resumedBytes()).arg(transfer.currentChunkSize() >> 20) << Qt::endl;
+        return 0;
+    }
+
+    if (parser.isSet(replayOption)) {
+        SessionReplay replay(qMax(0.0, parser.value(speedOption).toDouble()));
+        if (!replay.load(parser.value(replayOption))) {
+            out << "Cannot read session " << parser.value(replayOption) << Qt::endl;
+            return 1;
+        }
+        QStringList commands;
+        QString prefix = "Feeder";
+        qint64 recordedUs = 0;
+        for (const SessionEvent &event : replay.events()) {
+            if (event.type == SessionEventType::Command) {
+                commands << event.values.join(' ');
+                if (event.values.size() > 2 && event.values.first() == "download") {
+                    prefix = event.values[2];
+                }
+            }
+            recordedUs = event.timeUs;
+        }
+        const QStringList files = replay.transferredFiles();
+        if (files.isEmpty()) {
+            out << "The session has no transfers to replay" << Qt::endl;
+            return 1;
+        }
+
+        // The import itself runs, with the recording standing in for the
+        // device and the Swift helper
+        SwiftWrapper wrapper;
+        wrapper.setReplay(&replay);
+        QTemporaryDir output;
+        QElapsedTimer timer;
+        timer.start();
+        if (!commands.isEmpty() && commands.first().startsWith("select ")) {
+            wrapper.selectDevice(commands.first().mid(7));
+        } else if (!commands.isEmpty() && commands.first() == "files") {
+            wrapper.getDeviceFiles();
+        }
+        const bool success = wrapper.downloadSelectedFiles(files, output.path(), prefix);
+        out << QString("Replayed %1 files in %2 s (recorded session %3 s, speed %4x)%5")
+                   .arg(files.size())
+                   .arg(timer.elapsed() / 1000.0, 0, 'f', 2)
+                   .arg(recordedUs / 1e6, 0, 'f', 2)
+                   .arg(replay.speed())
+                   .arg(success ? QString() : QString(", import failed")) << Qt::endl;
+        return success ? 0 : 2;
+    }
+
+    if (parser.isSet(streamConvertOption)) {
+        LocalFileSource source(parser.value(streamConvertOption));
+        if (!source.open()) {
+            out << "Cannot read " << parser.value(streamConvertOption) << Qt::endl;
+            return 1;
+        }
+        const QDir outputDirectory(parser.value(toOption));
+        QDir().mkpath(outputDirectory.absolutePath());
+        const QString baseName = QFileInfo(source.name()).completeBaseName();
+        StreamConverter converter(&source);
+
+        QElapsedTimer timer;
+        timer.start();
+        bool success = false;
+        const MediaKind kind = mediaKind(mediaTypeForPath(source.name()));
+        if (kind == MediaKind::Video) {
+            const QStringList codec = parser.isSet(remuxOption)
+                ? QStringList() << "-c" << "copy"
+                : QStringList() << "-c:v" << "libx264" << "-c:a" << "aac" << VideoPlan().ffmpegArguments();
+            success = converter.convertVideo(outputDirectory.absoluteFilePath(baseName + ".mp4"), codec);
+        } else if (kind == MediaKind::Image) {
+            success = converter.convertImage(ImageRenditioner(ImageRenditioner::loadSpecs()),
+                                             outputDirectory.absolutePath(), baseName);
+        } else {
+            out << source.name() << " is neither an image nor a video" << Qt::endl;
+            return 1;
+        }
+        if (!success) {
+            out << "Cannot stream " << source.name() << "; it would be downloaded and converted from disk" << Qt::endl;
+            return 2;
+        }
+        out << QString("Converted %1 MB in %2 s without staging the original")
+                   .arg(source.size() / 1048576.0, 0, 'f', 1).arg(timer.elapsed() / 1000.0, 0, 'f', 2) << Qt::endl;
+        return 0;
+    }
+
+    if (parser.isSet(photosLibraryOption)) {
+        QElapsedTimer timer;
+        timer.start();
+        const bool success = PhotosLibrary::download(parser.value(toOption));
+        out << QString("Photos library %1 in %2 s, peak pipeline memory %3 MB")
+                   .arg(success ? "downloaded" : "download incomplete")
+                   .arg(timer.elapsed() / 1000.0, 0, 'f', 2)
+                   .arg(MemoryBudget::instance()->peak() / 1048576) << Qt::endl;
+        return success ? 0 : 2;
+    }
+
+    if (parser.isSet(policyDryRunOption)) {
+        const ConversionPolicy policy = ConversionPolicy::load();
+        if (policy.isEmpty()) {
+            out << "No conversionPolicy rules are set; every file would be transcoded" << Qt::endl;
+        }
+        return policy.dryRun(parser.value(policyDryRunOption), parser.value(deviceOption), out);
+    }
+
+    parser.showHelp(1);
+    return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef COMMAND_LINE_TOOLS_H
+#define COMMAND_LINE_TOOLS_H
+
+#include <QStringList>
+
+// Headless entry points that run instead of the main window, e.g.
+//   feeder --benchmark-formats ~/Pictures/sample
+class CommandLineTools {
+public:
+    static bool isToolInvocation(int argc, char *argv[]);
+    static int run(const QStringList &arguments);
+
+    // Options shared by the tools and the window, e.g.
+    //   feeder --priority background
+    static bool applyGlobalOptions(const QStringList &arguments);
+};
+
+#endif // COMMAND_LINE_TOOLS_H
@@ -0,0 +1,310 @@
+#include "conversion_policy.h"
+#include "catalog_index.h"
+#include "encode_planner.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QRegularExpression>
+#include <QSettings>
+
+namespace {
+
+enum class Match {
+    No,
+    Yes,
+    NeedsProbe
+};
+
+bool compare(double value, const QString &op, double target) {
+    if (op == "<") return value < target;
+    if (op == "<=") return value <= target;
+    if (op == ">") return value > target;
+    if (op == ">=") return value >= target;
+    return value == target;
+}
+
+Match matches(const PolicyCondition &condition, const PolicyFacts &facts) {
+    const QString &field = condition.field;
+    if (field == "codec" || field == "width" || field == "height" || field == "duration") {
+        if (!facts.probed) {
+            return Match::NeedsProbe;
+        }
+    }
+
+    bool result = false;
+    if (field == "type") {
+        // A kind ("video") or a format ("heic")
+        const MediaKind kind = mediaKind(facts.type);
+        result = condition.text == mediaTypeName(facts.type)
+            || (condition.text == "image" && kind == MediaKind::Image)
+            || (condition.text == "video" && kind == MediaKind::Video);
+    } else if (field == "name") {
+        const QRegularExpression pattern(QRegularExpression::wildcardToRegularExpression(condition.text),
+                                         QRegularExpression::CaseInsensitiveOption);
+        result = pattern.match(facts.fileName).hasMatch();
+    } else if (field == "codec") {
+        result = facts.codec.compare(condition.text, Qt::CaseInsensitive) == 0;
+    } else if (field == "device") {
+        result = facts.device.contains(condition.text, Qt::CaseInsensitive);
+    } else if (field == "size") {
+        result = facts.size >= 0 && compare(double(facts.size), condition.op, condition.number);
+    } else if (field == "width") {
+        result = compare(facts.width, condition.op, condition.number);
+    } else if (field == "height") {
+        result = compare(facts.height, condition.op, condition.number);
+    } else if (field == "duration") {
+        result = compare(facts.durationSeconds, condition.op, condition.number);
+    } else if (field == "date") {
+        result = facts.timestamp >= condition.from && facts.timestamp <= condition.to;
+    } else if (field == "from") {
+        result = facts.timestamp >= condition.from;
+    } else if (field == "to") {
+        result = facts.timestamp >= 0 && facts.timestamp <= condition.to;
+    }
+    return result ? Match::Yes : Match::No;
+}
+
+QString megabytes(qint64 bytes) {
+    return QString("%1 MB").arg(bytes / 1048576.0, 0, 'f', 1);
+}
+
+} // namespace
+
+PolicyFacts PolicyFacts::fromListing(const QString &fileName, const QString &size, const QString &date,
+                                     const QString &device) {
+    PolicyFacts facts;
+    facts.fileName = fileName;
+    facts.type = mediaTypeForPath(fileName);
+    bool sizeKnown = false;
+    facts.size = size.toLongLong(&sizeKnown);
+    if (!sizeKnown) {
+        facts.size = -1;
+    }
+    // Swift prints dates in UTC as "2025-08-06 09:01:10 +0000"
+    QDateTime parsed = QDateTime::fromString(date.left(19), "yyyy-MM-dd HH:mm:ss");
+    if (parsed.isValid()) {
+        parsed.setTimeSpec(Qt::UTC);
+        facts.timestamp = parsed.toMSecsSinceEpoch();
+    }
+    facts.device = device;
+    return facts;
+}
+
+PolicyFacts PolicyFacts::fromFile(const QString &path, const QString &device) {
+    QFileInfo info(path);
+    PolicyFacts facts;
+    facts.fileName = info.fileName();
+    facts.type = mediaTypeOfFile(path);
+    facts.size = info.size();
+    facts.timestamp = info.lastModified().toMSecsSinceEpoch();
+    facts.device = device;
+    return facts;
+}
+
+void PolicyFacts::probe(const QString &path) {
+    probed = true;
+    if (mediaKind(type) == MediaKind::Video) {
+        const VideoProbe video = VideoProbe::read(path);
+        codec = video.codec;
+        width = video.width;
+        height = video.height;
+        durationSeconds = video.durationSeconds;
+        return;
+    }
+    // Only the header is read for the size
+    QImageReader reader(path);
+    const QSize imageSize = reader.size();
+    codec = mediaTypeName(type);
+    width = imageSize.width();
+    height = imageSize.height();
+}
+
+ConversionPolicy ConversionPolicy::load() {
+    ConversionPolicy policy;
+    QSettings settings;
+    for (const QString &entry : settings.value("conversionPolicy").toStringList()) {
+        PolicyRule rule;
+        if (parseRule(entry, &rule)) {
+            policy.addRule(rule);
+        } else {
+            qDebug() << "ConversionPolicy: Ignoring rule" << entry;
+        }
+    }
+    return policy;
+}
+
+bool ConversionPolicy::parseRule(const QString &text, PolicyRule *rule) {
+    static const QRegularExpression token("^([a-z]+)(:|<=|>=|<|>|=)(.+)$");
+    const int arrow = text.indexOf("=>");
+    if (arrow < 0) {
+        return false;
+    }
+
+    const QString action = text.mid(arrow + 2).trimmed().toLower();
+    if (action == "transcode") {
+        rule->action = PolicyAction::Transcode;
+    } else if (action == "remux") {
+        rule->action = PolicyAction::Remux;
+    } else if (action == "keep") {
+        rule->action = PolicyAction::Keep;
+    } else if (action == "skip") {
+        rule->action = PolicyAction::Skip;
+    } else {
+        return false;
+    }
+
+    rule->text = text.trimmed();
+    rule->conditions.clear();
+    for (const QString &part : text.left(arrow).split(' ', Qt::SkipEmptyParts)) {
+        if (part == "*") {
+            continue;
+        }
+        const QRegularExpressionMatch match = token.match(part.toLower());
+        if (!match.hasMatch()) {
+            return false;
+        }
+        PolicyCondition condition;
+        condition.field = match.captured(1);
+        condition.op = match.captured(2);
+        condition.text = match.captured(3);
+
+        bool ok = true;
+        if (condition.field == "size") {
+            condition.number = double(parseByteSize(condition.text));
+            ok = condition.number >= 0;
+        } else if (condition.field == "width" || condition.field == "height" || condition.field == "duration") {
+            condition.number = condition.text.toDouble(&ok);
+        } else if (condition.field == "date" || condition.field == "from" || condition.field == "to") {
+            ok = parseDateRange(condition.text, &condition.from, &condition.to);
+        } else if (condition.field != "type" && condition.field != "name" && condition.field != "codec"
+                   && condition.field != "device") {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+        rule->conditions << condition;
+    }
+    return true;
+}
+
+QString ConversionPolicy::actionName(PolicyAction action) {
+    switch (action) {
+    case PolicyAction::Remux:
+        return "remux";
+    case PolicyAction::Keep:
+        return "keep";
+    case PolicyAction::Skip:
+        return "skip";
+    default:
+        return "transcode";
+    }
+}
+
+void ConversionPolicy::addRule(const PolicyRule &rule) {
+    rules << rule;
+}
+
+PolicyAction ConversionPolicy::evaluate(const PolicyFacts &facts, bool *decided) const {
+    if (decided) {
+        *decided = true;
+    }
+    for (const PolicyRule &rule : rules) {
+        Match result = Match::Yes;
+        for (const PolicyCondition &condition : rule.conditions) {
+            const Match match = matches(condition, facts);
+            if (match == Match::No) {
+                result = Match::No;
+                break;
+            }
+            if (match == Match::NeedsProbe) {
+                result = Match::NeedsProbe;
+            }
+        }
+        if (result == Match::Yes) {
+            return rule.action;
+        }
+        if (result == Match::NeedsProbe) {
+            // Later rules can't be trusted until this one is settled
+            if (decided) {
+                *decided = false;
+            }
+            return PolicyAction::Transcode;
+        }
+    }
+    return PolicyAction::Transcode;
+}
+
+int ConversionPolicy::dryRun(const QString &directory, const QString &device, QTextStream &out) const {
+    QSettings settings;
+    const double transferRate = settings.value("policy/transferMBps", 25.0).toDouble() * 1048576.0;
+    EncodePlanner *planner = EncodePlanner::instance();
+
+    QList<QPair<QString, PolicyFacts>> files;
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString path = it.next();
+        PolicyFacts facts = PolicyFacts::fromFile(path, device);
+        facts.probe(path);
+        files.append(qMakePair(path, facts));
+    }
+
+    // Encode estimates need a calibrated planner
+    for (const auto &file : files) {
+        if (mediaKind(file.second.type) == MediaKind::Video) {
+            if (planner->estimate(VideoProbe::read(file.first)).estimatedSeconds <= 0.0) {
+                out << "Calibrating encoder presets with " << QFileInfo(file.first).fileName() << "..." << Qt::endl;
+                planner->calibrate(file.first);
+            }
+            break;
+        }
+    }
+
+    int counts[4] = {0, 0, 0, 0};
+    qint64 skippedBytes = 0;
+    double encodeSecondsSaved = 0.0;
+    qint64 outputBytesAvoided = 0;
+    for (const auto &file : files) {
+        const PolicyFacts &facts = file.second;
+        const PolicyAction action = evaluate(facts);
+        ++counts[int(action)];
+
+        QString estimate;
+        if (mediaKind(facts.type) == MediaKind::Video) {
+            VideoProbe probe;
+            probe.codec = facts.codec;
+            probe.width = facts.width;
+            probe.height = facts.height;
+            probe.durationSeconds = facts.durationSeconds;
+            const VideoPlan plan = planner->estimate(probe);
+            estimate = QString("encode ~%1 s").arg(plan.estimatedSeconds, 0, 'f', 0);
+            if (action != PolicyAction::Transcode) {
+                encodeSecondsSaved += plan.estimatedSeconds;
+                outputBytesAvoided += plan.estimatedBytes;
+            }
+        }
+        if (action == PolicyAction::Skip) {
+            skippedBytes += facts.size;
+        }
+        out << QString("%1 %2 %3 %4 %5x%6 %7")
+                   .arg(actionName(action), -9)
+                   .arg(facts.fileName, -24)
+                   .arg(megabytes(facts.size), 11)
+                   .arg(facts.codec, -6)
+                   .arg(facts.width).arg(facts.height)
+                   .arg(estimate) << Qt::endl;
+    }
+
+    out << QString("%1 transcode, %2 remux, %3 keep, %4 skip")
+               .arg(counts[int(PolicyAction::Transcode)]).arg(counts[int(PolicyAction::Remux)])
+               .arg(counts[int(PolicyAction::Keep)]).arg(counts[int(PolicyAction::Skip)]) << Qt::endl;
+    out << QString("Transfers avoided: %1 (~%2 s at %3 MB/s)")
+               .arg(megabytes(skippedBytes))
+               .arg(skippedBytes / transferRate, 0, 'f', 0)
+               .arg(transferRate / 1048576.0, 0, 'f', 0) << Qt::endl;
+    out << QString("Video encoding avoided: ~%1 s, %2 of encoder output")
+               .arg(encodeSecondsSaved, 0, 'f', 0).arg(megabytes(outputBytesAvoided)) << Qt::endl;
+    return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef CONVERSION_POLICY_H
+#define CONVERSION_POLICY_H
+
+#include "media_types.h"
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+enum class PolicyAction {
+    Transcode,  // convert with the registered route (the default)
+    Remux,      // new container, streams copied as they are
+    Keep,       // import the original untouched
+    Skip        // don't import at all
+};
+
+// What is known about a file when the policy looks at it. The listing
+// gives name, size, date and device before anything is transferred;
+// codec, resolution and duration need the file itself (probe()).
+struct PolicyFacts {
+    QString fileName;
+    MediaType type = MediaType::Unknown;
+    qint64 size = -1;
+    qint64 timestamp = -1;     // ms since epoch, -1 when unknown
+    QString device;
+    bool probed = false;
+    QString codec;
+    int width = 0;
+    int height = 0;
+    double durationSeconds = 0.0;
+
+    static PolicyFacts fromListing(const QString &fileName, const QString &size, const QString &date,
+                                   const QString &device);
+    static PolicyFacts fromFile(const QString &path, const QString &device);
+    void probe(const QString &path);
+};
+
+struct PolicyCondition {
+    QString field;     // type, name, codec, device, size, width, height, duration, date, from, to
+    QString op;        // ":" for text, or < <= = >= >
+    QString text;
+    double number = 0.0;
+    qint64 from = -1;
+    qint64 to = -1;
+};
+
+struct PolicyRule {
+    QString text;
+    QList<PolicyCondition> conditions;  // all must hold; none matches everything
+    PolicyAction action = PolicyAction::Transcode;
+};
+
+// Ordered keep / remux / transcode / skip rules from the "conversionPolicy"
+// setting, one rule per entry, e.g.
+//   "codec:hevc height>=2160 => keep"
+//   "type:video duration<3 => skip"
+//   "type:mov device:ipad => remux"
+// The first matching rule decides; files no rule matches are transcoded
+// as before.
+class ConversionPolicy {
+public:
+    static ConversionPolicy load();
+    static bool parseRule(const QString &text, PolicyRule *rule);
+    static QString actionName(PolicyAction action);
+
+    void addRule(const PolicyRule &rule);
+    bool isEmpty() const { return rules.isEmpty(); }
+
+    // On unprobed facts, *decided is false when a rule that needs a probe
+    // comes before any match; evaluate again once the file is local.
+    PolicyAction evaluate(const PolicyFacts &facts, bool *decided = nullptr) const;
+
+    // Applies the policy to the files under directory without touching them
+    // and reports the transfer and encode time and bytes it would save.
+    int dryRun(const QString &directory, const QString &device, QTextStream &out) const;
+
+private:
+    QList<PolicyRule> rules;
+};
+
+#endif // CONVERSION_POLICY_H
@@ -0,0 +1,34 @@
+#include "converter_registry.h"
+#include <QFileInfo>
+
+void ConverterRegistry::addFileConverter(MediaType source, MediaType target, const FileConverter &converter) {
+    fileConverters[std::size_t(source)] << FileConverterEntry{target, converter};
+}
+
+const FileConverter *ConverterRegistry::fileConverter(MediaType source, MediaType target) const {
+    for (const FileConverterEntry &entry : fileConverters[std::size_t(source)]) {
+        if (entry.target == target) {
+            return &entry.converter;
+        }
+    }
+    return nullptr;
+}
+
+void ConverterRegistry::addRoute(MediaType source, const ConversionRoute &route) {
+    routes[std::size_t(source)] << route;
+}
+
+const ConversionRoute *ConverterRegistry::route(MediaType source, const QString &inputPath,
+                                                QString *outputPath) const {
+    QFileInfo input(inputPath);
+    for (const ConversionRoute &candidate : routes[std::size_t(source)]) {
+        // Outputs sit next to the input: IMG_0001.HEIC -> IMG_0001.jpg
+        const QString candidateOutput = input.dir().absoluteFilePath(
+            input.baseName() + '.' + mediaTypeName(candidate.target));
+        if (!candidate.accepts || candidate.accepts(inputPath, candidateOutput)) {
+            *outputPath = candidateOutput;
+            return &candidate;
+        }
+    }
+    return nullptr;
+}
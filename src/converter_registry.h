@@ -0,0 +1,53 @@
+#ifndef CONVERTER_REGISTRY_H
+#define CONVERTER_REGISTRY_H
+
+#include "media_types.h"
+#include <QList>
+#include <QString>
+#include <array>
+#include <functional>
+
+class RangedSource;
+
+// A single file-to-file conversion (sips, ffmpeg, ...).
+using FileConverter = std::function<bool(const QString &inputPath, const QString &outputPath)>;
+
+// What convertDownloadedFiles does with a downloaded file of one type.
+struct ConversionRoute {
+    QString name;                   // metrics and log label
+    MediaType target = MediaType::Unknown;
+    bool pooled = false;            // CPU-bound work that runs on the conversion pool
+    bool removeSource = true;       // delete the original once converted
+    // Optional extra condition, e.g. "only when JPEG XL is configured"
+    std::function<bool(const QString &inputPath, const QString &outputPath)> accepts;
+    std::function<bool(const QString &inputPath, const QString &outputPath)> convert;
+    // Optional conversion straight off the device, without the original on
+    // disk (inputPath is only where it would have been); false when the
+    // file can't be streamed
+    std::function<bool(RangedSource *source, const QString &inputPath, const QString &outputPath)> stream;
+};
+
+// Routing tables from source media type to converters. Registering a new
+// converter is all it takes to support a new source format; the dispatch
+// code never names a type.
+class ConverterRegistry {
+public:
+    void addFileConverter(MediaType source, MediaType target, const FileConverter &converter);
+    const FileConverter *fileConverter(MediaType source, MediaType target) const;
+
+    // Routes for the same source are tried in registration order.
+    void addRoute(MediaType source, const ConversionRoute &route);
+    const ConversionRoute *route(MediaType source, const QString &inputPath, QString *outputPath) const;
+
+private:
+    struct FileConverterEntry {
+        MediaType target;
+        FileConverter converter;
+    };
+    static const std::size_t typeCount = std::size_t(MediaType::Count);
+
+    std::array<QList<FileConverterEntry>, typeCount> fileConverters;
+    std::array<QList<ConversionRoute>, typeCount> routes;
+};
+
+#endif // CONVERTER_REGISTRY_H
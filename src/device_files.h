@@ -0,0 +1,36 @@
+#ifndef DEVICE_FILES_H
+#define DEVICE_FILES_H
+
+#include "chunked_transfer.h"
+#include <QString>
+#include <memory>
+
+struct DeviceFilesState;
+
+// The connected device's files through ImageCaptureCore, for ranged reads
+// next to the Swift helper, which still lists and selects the device.
+// ImageCapture answers on the main run loop, so waitUntilReady() and reads
+// block the calling thread until it does and must not be made from the
+// main thread, which has to keep its run loop spinning meanwhile.
+class DeviceFiles {
+public:
+    static DeviceFiles *instance();
+
+    // Starts browsing on first use; true once a camera session is open and
+    // its catalog is complete, waiting at most msecs for that.
+    bool waitUntilReady(int msecs);
+    QString deviceName() const;
+
+    // Ranged reads of one file in the catalog; nullptr if it isn't there,
+    // its size isn't expectedSize (when >= 0), or more than one file on
+    // the device has that name. Doesn't wait for the main thread.
+    std::unique_ptr<RangedSource> open(const QString &fileName, qint64 expectedSize = -1);
+
+private:
+    DeviceFiles();
+    ~DeviceFiles();
+
+    DeviceFilesState *d;
+};
+
+#endif // DEVICE_FILES_H
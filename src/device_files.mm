@@ -0,0 +1,274 @@
+#include "device_files.h"
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <cstring>
+
+#import <Foundation/Foundation.h>
+#import <ImageCaptureCore/ImageCaptureCore.h>
+
+@class DeviceFilesDelegate;
+
+// A catalog entry, with what lookups need copied out on the main thread
+struct DeviceFileEntry {
+    ICCameraFile *file = nil;           // retained
+    qint64 size = 0;
+};
+
+struct DeviceFilesState {
+    QMutex mutex;
+    QWaitCondition changed;
+    DeviceFilesDelegate *delegate = nil;
+    ICDeviceBrowser *browser = nil;
+    ICCameraDevice *camera = nil;       // open session with a complete catalog
+    QString deviceName;
+    QHash<QString, QList<DeviceFileEntry>> files;   // by name, as the listing has them
+    bool started = false;
+
+    void clearFiles() {
+        for (const QList<DeviceFileEntry> &entries : files) {
+            for (const DeviceFileEntry &entry : entries) {
+                [entry.file release];
+            }
+        }
+        files.clear();
+    }
+};
+
+namespace {
+
+// Ranged reads of one file on the device. readAt() blocks the calling
+// transfer thread until ImageCapture answers; a chunk that times out is
+// retried by ChunkedTransfer.
+class DeviceFileSource : public RangedSource {
+public:
+    DeviceFileSource(ICCameraFile *file, const QString &fileName, qint64 fileSize)
+        : file([file retain]), fileName(fileName), fileSize(fileSize) {}
+    ~DeviceFileSource() override { [file release]; }
+
+    QString name() const override { return fileName; }
+    qint64 size() const override { return fileSize; }
+
+    qint64 readAt(qint64 offset, char *data, qint64 length) override {
+        // Shared with the completion block, which may outlive a timed out wait
+        struct Reply {
+            QByteArray bytes;
+            bool ok = false;
+        };
+        std::shared_ptr<Reply> reply = std::make_shared<Reply>();
+        dispatch_semaphore_t arrived = dispatch_semaphore_create(0);
+        ICCameraFile *target = file;
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [target requestReadDataAtOffset:offset length:length completion:^(NSData *chunk, NSError *error) {
+                if (error) {
+                    qDebug() << "DeviceFileSource: Read error:" << QString::fromNSString(error.localizedDescription);
+                } else if (chunk) {
+                    reply->bytes = QByteArray(static_cast<const char *>(chunk.bytes), int(chunk.length));
+                    reply->ok = true;
+                }
+                dispatch_semaphore_signal(arrived);
+            }];
+        });
+
+        const bool answered = dispatch_semaphore_wait(arrived, dispatch_time(DISPATCH_TIME_NOW, 60 * NSEC_PER_SEC)) == 0;
+        dispatch_release(arrived);
+        if (!answered || !reply->ok) {
+            return -1;
+        }
+        const qint64 received = qMin<qint64>(reply->bytes.size(), length);
+        std::memcpy(data, reply->bytes.constData(), size_t(received));
+        return received;
+    }
+
+private:
+    ICCameraFile *file;
+    QString fileName;
+    qint64 fileSize;
+};
+
+} // namespace
+
+@interface DeviceFilesDelegate : NSObject <ICDeviceBrowserDelegate, ICCameraDeviceDelegate>
+@property (nonatomic, assign) DeviceFilesState *state;
+@end
+
+@implementation DeviceFilesDelegate
+
+- (void)forgetDevice:(ICDevice *)device {
+    QMutexLocker locker(&self.state->mutex);
+    if (self.state->camera == device) {
+        [self.state->camera release];
+        self.state->camera = nil;
+        self.state->deviceName.clear();
+        self.state->clearFiles();
+        self.state->changed.wakeAll();
+    }
+}
+
+// Called on the main thread with the state locked
+- (void)addFiles:(NSArray<ICCameraItem *> *)items {
+    for (ICCameraItem *item in items) {
+        if ([item isKindOfClass:[ICCameraFile class]]) {
+            ICCameraFile *file = (ICCameraFile *)item;
+            DeviceFileEntry entry;
+            entry.file = [file retain];
+            entry.size = file.fileSize;
+            self.state->files[QString::fromNSString(file.name)].append(entry);
+        }
+    }
+}
+
+- (void)deviceBrowser:(ICDeviceBrowser *)browser didAddDevice:(ICDevice *)device moreComing:(BOOL)moreComing {
+    if (device.type == ICDeviceTypeCamera) {
+        device.delegate = self;
+        [device requestOpenSession];
+    }
+}
+
+- (void)deviceBrowser:(ICDeviceBrowser *)browser didRemoveDevice:(ICDevice *)device moreGoing:(BOOL)moreGoing {
+    [self forgetDevice:device];
+}
+
+- (void)didRemoveDevice:(ICDevice *)device {
+    [self forgetDevice:device];
+}
+
+- (void)device:(ICDevice *)device didOpenSessionWithError:(NSError *)error {
+    if (error) {
+        // Usually a locked phone, or one that doesn't trust this Mac yet
+        qDebug() << "DeviceFiles: Cannot open a session with" << QString::fromNSString(device.name) << ":"
+                 << QString::fromNSString(error.localizedDescription);
+    }
+}
+
+- (void)device:(ICDevice *)device didCloseSessionWithError:(NSError *)error {
+    [self forgetDevice:device];
+}
+
+- (void)deviceDidBecomeReadyWithCompleteContentCatalog:(ICCameraDevice *)device {
+    // The catalog is indexed once here, so opening a file never has to
+    // walk it or wait for the main thread
+    QMutexLocker locker(&self.state->mutex);
+    if (self.state->camera != device) {
+        [self.state->camera release];
+        self.state->camera = [device retain];
+        self.state->deviceName = QString::fromNSString(device.name);
+    }
+    self.state->clearFiles();
+    [self addFiles:device.mediaFiles];
+    self.state->changed.wakeAll();
+}
+
+- (void)cameraDevice:(ICCameraDevice *)camera didAddItems:(NSArray<ICCameraItem *> *)items {
+    QMutexLocker locker(&self.state->mutex);
+    if (self.state->camera == camera) {
+        [self addFiles:items];
+    }
+}
+
+- (void)cameraDevice:(ICCameraDevice *)camera didRemoveItems:(NSArray<ICCameraItem *> *)items {
+    QMutexLocker locker(&self.state->mutex);
+    if (self.state->camera != camera) {
+        return;
+    }
+    for (ICCameraItem *item in items) {
+        auto it = self.state->files.find(QString::fromNSString(item.name));
+        if (it == self.state->files.end()) {
+            continue;
+        }
+        for (int i = it->size() - 1; i >= 0; --i) {
+            if ((*it)[i].file == item) {
+                [(*it)[i].file release];
+                it->removeAt(i);
+            }
+        }
+        if (it->isEmpty()) {
+            self.state->files.erase(it);
+        }
+    }
+}
+
+- (void)cameraDevice:(ICCameraDevice *)camera didReceiveThumbnail:(CGImageRef)thumbnail forItem:(ICCameraItem *)item error:(NSError *)error {
+}
+
+- (void)cameraDevice:(ICCameraDevice *)camera didReceiveMetadata:(NSDictionary *)metadata forItem:(ICCameraItem *)item error:(NSError *)error {
+}
+
+- (void)cameraDevice:(ICCameraDevice *)camera didRenameItems:(NSArray<ICCameraItem *> *)items {
+}
+
+- (void)cameraDeviceDidChangeCapability:(ICCameraDevice *)camera {
+}
+
+- (void)cameraDevice:(ICCameraDevice *)camera didReceivePTPEvent:(NSData *)eventData {
+}
+
+- (void)cameraDeviceDidRemoveAccessRestriction:(ICDevice *)device {
+}
+
+- (void)cameraDeviceDidEnableAccessRestriction:(ICDevice *)device {
+}
+
+@end
+
+DeviceFiles *DeviceFiles::instance() {
+    static DeviceFiles files;
+    return &files;
+}
+
+DeviceFiles::DeviceFiles() : d(new DeviceFilesState) {
+}
+
+DeviceFiles::~DeviceFiles() {
+    [d->browser stop];
+    [d->browser release];
+    [d->camera release];
+    d->clearFiles();
+    [d->delegate release];
+    delete d;
+}
+
+bool DeviceFiles::waitUntilReady(int msecs) {
+    QMutexLocker locker(&d->mutex);
+    if (!d->started) {
+        d->started = true;
+        DeviceFilesState *state = d;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            state->delegate = [[DeviceFilesDelegate alloc] init];
+            state->delegate.state = state;
+            state->browser = [[ICDeviceBrowser alloc] init];
+            state->browser.delegate = state->delegate;
+            state->browser.browsedDeviceTypeMask = ICDeviceTypeMask(ICDeviceTypeMaskCamera | ICDeviceLocationTypeMaskLocal);
+            [state->browser start];
+        });
+    }
+    QDeadlineTimer deadline(msecs);
+    while (!d->camera && !deadline.hasExpired()) {
+        d->changed.wait(&d->mutex, deadline);
+    }
+    return d->camera != nil;
+}
+
+QString DeviceFiles::deviceName() const {
+    QMutexLocker locker(&d->mutex);
+    return d->deviceName;
+}
+
+std::unique_ptr<RangedSource> DeviceFiles::open(const QString &fileName, qint64 expectedSize) {
+    QMutexLocker locker(&d->mutex);
+    const QList<DeviceFileEntry> entries = d->files.value(fileName);
+    if (entries.size() > 1) {
+        // Same name in different folders; the name alone can't say which
+        qDebug() << "DeviceFiles:" << entries.size() << "files named" << fileName << "; left to the Swift helper";
+        return nullptr;
+    }
+    if (entries.isEmpty() || (expectedSize >= 0 && entries.first().size != expectedSize)) {
+        return nullptr;
+    }
+    return std::unique_ptr<RangedSource>(new DeviceFileSource(entries.first().file, fileName, entries.first().size));
+}
@@ -1,4 +1,6 @@
 #include "devicecontroller.h"
+#include "photos_library.h"
+#include "session_recorder.h"
 #include <QDebug>
 #include <QStringList>
 #include <QImage>
@@ -45,6 +47,8 @@
         
         qDebug() << "Requesting device authorization...";
         
+        SessionRecorder::instance()->deviceConnected(QString::fromNSString(device.name));
+        
         // Emit device connected signal
         if (self.controller) {
             emit self.controller->deviceConnected(QString::fromNSString(device.name));
@@ -56,6 +60,7 @@
 
 - (void)deviceBrowser:(ICDeviceBrowser *)browser didRemoveDevice:(ICDevice *)device moreGoing:(BOOL)moreGoing {
     qDebug() << "Device removed:" << QString::fromNSString(device.name);
+    SessionRecorder::instance()->deviceDisconnected(QString::fromNSString(device.name));
     
     // Emit device disconnected signal
     if (self.controller) {
@@ -365,73 +370,11 @@
 }
 
 - (void)downloadWithPhotosFramework:(NSString *)outputDirectory {
-    qDebug() << "=== PHOTOS FRAMEWORK DEBUG ===";
-    qDebug() << "Output directory:" << QString::fromNSString(outputDirectory);
-    
-    // Request photo library access
-    PHAuthorizationStatus status = [PHPhotoLibrary authorizationStatus];
-    qDebug() << "Photo library authorization status:" << status;
-    
-    if (status == PHAuthorizationStatusNotDetermined) {
-        [PHPhotoLibrary requestAuthorization:^(PHAuthorizationStatus status) {
-            qDebug() << "Authorization result:" << status;
-            if (status == PHAuthorizationStatusAuthorized) {
-                [self performPhotosDownload:outputDirectory];
-            } else {
-                qDebug() << "Photo library access denied";
-            }
-        }];
-    } else if (status == PHAuthorizationStatusAuthorized) {
-        [self performPhotosDownload:outputDirectory];
-    } else {
-        qDebug() << "Photo library access denied or restricted";
-    }
-}
-
-- (void)performPhotosDownload:(NSString *)outputDirectory {
-    qDebug() << "=== PERFORMING PHOTOS DOWNLOAD ===";
-    
-    // Create output directory
-    NSFileManager *fileManager = [NSFileManager defaultManager];
-    NSError *createError = nil;
-    if (![fileManager createDirectoryAtPath:outputDirectory withIntermediateDirectories:YES attributes:nil error:&createError]) {
-        qDebug() << "Failed to create directory:" << QString::fromNSString(createError.localizedDescription);
-        return;
-    }
-    
-    // Fetch all photos
-    PHFetchOptions *fetchOptions = [[PHFetchOptions alloc] init];
-    fetchOptions.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"creationDate" ascending:NO]];
-    
-    PHFetchResult *fetchResult = [PHAsset fetchAssetsWithOptions:fetchOptions];
-    qDebug() << "Found" << fetchResult.count << "photos/videos";
-    
-    // Download each asset
-    for (int i = 0; i < fetchResult.count; i++) {
-        PHAsset *asset = [fetchResult objectAtIndex:i];
-        qDebug() << "Processing asset" << i << "of" << fetchResult.count;
-        
-        // Get the filename
-        NSString *filename = [NSString stringWithFormat:@"IMG_%04d", i + 1];
-        if (asset.mediaType == PHAssetMediaTypeImage) {
-            filename = [filename stringByAppendingString:@".jpg"];
-        } else if (asset.mediaType == PHAssetMediaTypeVideo) {
-            filename = [filename stringByAppendingString:@".mov"];
-        }
-        
-        NSString *outputPath = [outputDirectory stringByAppendingPathComponent:filename];
-        qDebug() << "Downloading to:" << QString::fromNSString(outputPath);
-        
-        // Download the asset
-        [[PHImageManager defaultManager] requestImageDataAndOrientationForAsset:asset options:nil resultHandler:^(NSData * _Nullable imageData, NSString * _Nullable dataUTI, CGImagePropertyOrientation orientation, NSDictionary * _Nullable info) {
-            if (imageData) {
-                [imageData writeToFile:outputPath atomically:YES];
-                qDebug() << "Successfully downloaded:" << QString::fromNSString(filename);
-            } else {
-                qDebug() << "Failed to download:" << QString::fromNSString(filename);
-            }
-        }];
-    }
+    // Blocks until every asset is written, so it runs off the main queue
+    const QString directory = QString::fromNSString(outputDirectory);
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        PhotosLibrary::download(directory);
+    });
 }
 
 // Add the missing protocol methods that AppleOffloadTool has
@@ -0,0 +1,407 @@
+#include "encode_planner.h"
+#include "resource_governor.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Fastest to slowest; each step costs roughly twice the time of the last
+const char *const presets[] = {"ultrafast", "veryfast", "fast", "medium", "slow", "slower"};
+
+const int defaultCrf = 23;
+const int defaultEffort = 7;
+
+// Wall time calibration may take; slower presets are skipped once the next
+// one would go over
+const qint64 calibrationBudgetMs = 60000;
+const qint64 calibrationEncodeMs = 120000;
+
+// Encoder effort steps cost about 40% more time each
+double effortCost(int effort) {
+    return std::pow(1.4, effort - defaultEffort);
+}
+
+QString toolPath(const QString &name) {
+    const QString homebrew = "/opt/homebrew/bin/" + name;
+    return QFileInfo::exists(homebrew) ? homebrew : name;
+}
+
+} // namespace
+
+VideoProbe VideoProbe::read(const QString &path) {
+    VideoProbe probe;
+    QProcess process;
+    process.setProgram(toolPath("ffprobe"));
+    process.setArguments(QStringList()
+        << "-v" << "error"
+        << "-select_streams" << "v:0"
+        << "-show_entries" << "stream=codec_name,width,height:format=duration"
+        << "-of" << "default=noprint_wrappers=1"
+        << path);
+    process.start();
+    if (!process.waitForFinished(10000) || process.exitCode() != 0) {
+        process.kill();
+        return probe;
+    }
+
+    const QStringList lines = QString::fromUtf8(process.readAllStandardOutput()).split('\n');
+    for (const QString &line : lines) {
+        const QString key = line.section('=', 0, 0).trimmed();
+        const QString value = line.section('=', 1).trimmed();
+        if (key == "codec_name") {
+            probe.codec = value;
+        } else if (key == "width") {
+            probe.width = value.toInt();
+        } else if (key == "height") {
+            probe.height = value.toInt();
+        } else if (key == "duration") {
+            probe.durationSeconds = value.toDouble();
+        }
+    }
+    return probe;
+}
+
+QStringList VideoPlan::ffmpegArguments() const {
+    QStringList arguments;
+    arguments << "-preset" << preset << "-crf" << QString::number(crf);
+    if (maxrateKbps > 0) {
+        arguments << "-maxrate" << QString("%1k").arg(maxrateKbps)
+                  << "-bufsize" << QString("%1k").arg(maxrateKbps * 2);
+    }
+    return arguments;
+}
+
+EncodePlanner *EncodePlanner::instance() {
+    static EncodePlanner planner;
+    return &planner;
+}
+
+EncodePlanner::EncodePlanner() {
+    QSettings settings;
+    QDateTime finishBy;
+    if (parseDeadline(settings.value("encode/finishBy").toString(), &finishBy)) {
+        deadline = finishBy;
+    }
+    targetBytesPerSecond = settings.value("encode/mbPerMinute", 0.0).toDouble() * 1048576.0 / 60.0;
+    loadCalibration(ResourceGovernor::instance()->encoderThreads(1));
+}
+
+EncodePlanner::~EncodePlanner() {
+    stopping = true;
+    if (calibration) {
+        calibration->wait();
+        delete calibration;
+    }
+}
+
+bool EncodePlanner::parseDeadline(const QString &text, QDateTime *deadline) {
+    const QTime time = QTime::fromString(text.trimmed(), "HH:mm");
+    if (time.isValid()) {
+        // A time already past today means tomorrow
+        QDateTime when(QDate::currentDate(), time);
+        if (when < QDateTime::currentDateTime()) {
+            when = when.addDays(1);
+        }
+        *deadline = when;
+        return true;
+    }
+    const QDateTime when = QDateTime::fromString(text.trimmed(), Qt::ISODate);
+    if (when.isValid()) {
+        *deadline = when;
+        return true;
+    }
+    return false;
+}
+
+void EncodePlanner::setDeadline(const QDateTime &deadline) {
+    QMutexLocker locker(&mutex);
+    this->deadline = deadline;
+}
+
+void EncodePlanner::setTargetMegabytesPerMinute(double megabytes) {
+    QMutexLocker locker(&mutex);
+    targetBytesPerSecond = qMax(0.0, megabytes) * 1048576.0 / 60.0;
+}
+
+bool EncodePlanner::isActive() const {
+    QMutexLocker locker(&mutex);
+    return deadline.isValid() || targetBytesPerSecond > 0.0;
+}
+
+void EncodePlanner::loadCalibration(int threads) {
+    calibrations.clear();
+    calibratedThreads = threads;
+    QSettings settings;
+    const QStringList entries = settings.value(QString("encodePlanner/calibration%1").arg(threads)).toStringList();
+    for (const QString &entry : entries) {
+        const QStringList parts = entry.split(':');
+        if (parts.size() == 3) {
+            calibrations.append({parts[0], parts[1].toDouble(), parts[2].toDouble()});
+        }
+    }
+}
+
+bool EncodePlanner::calibrate(const QString &samplePath) {
+    const VideoProbe probe = VideoProbe::read(samplePath);
+    const double clipSeconds = qMin(probe.durationSeconds, 2.0);
+    if (probe.width <= 0 || probe.height <= 0 || clipSeconds < 0.2) {
+        qDebug() << "EncodePlanner: Cannot calibrate with" << samplePath;
+        return false;
+    }
+
+    QTemporaryDir scratch;
+    const QString outputPath = QDir(scratch.path()).absoluteFilePath("calibration.mp4");
+    // Measured as the lone encode, with the threads that gets
+    const int threads = ResourceGovernor::instance()->encoderThreads(1);
+    const double pixelSeconds = double(probe.width) * probe.height * clipSeconds;
+    QList<PresetCalibration> measured;
+    QStringList entries;
+    QElapsedTimer total;
+    total.start();
+    double lastSeconds = 0.0;
+
+    for (const char *preset : presets) {
+        if (stopping || total.elapsed() + 2 * lastSeconds * 1000 > calibrationBudgetMs) {
+            break;
+        }
+        QStringList arguments = QStringList()
+            << "-v" << "error"
+            << "-t" << QString::number(clipSeconds)
+            << "-i" << samplePath
+            << "-an" << "-c:v" << "libx264"
+            << "-preset" << preset
+            << "-crf" << QString::number(defaultCrf);
+        arguments << "-threads" << QString::number(threads) << "-y" << outputPath;
+
+        QProcess process;
+        process.setProgram(toolPath("ffmpeg"));
+        process.setArguments(arguments);
+        ResourceGovernor::instance()->applyToProcess(process);
+        QElapsedTimer timer;
+        timer.start();
+        process.start();
+        bool finished = false;
+        while (!(finished = process.waitForFinished(200)) && process.state() != QProcess::NotRunning) {
+            if (stopping || timer.elapsed() > calibrationEncodeMs) {
+                break;
+            }
+        }
+        if (!finished || process.exitCode() != 0) {
+            process.kill();
+            process.waitForFinished();
+            qDebug() << "EncodePlanner: Calibration encode failed for preset" << preset;
+            break;
+        }
+        const double seconds = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+        lastSeconds = seconds;
+        PresetCalibration calibration{preset, pixelSeconds / seconds, QFileInfo(outputPath).size() / pixelSeconds};
+        measured << calibration;
+        entries << QString("%1:%2:%3").arg(calibration.preset).arg(calibration.pixelRate)
+                       .arg(calibration.bytesPerPixelSecond);
+        qDebug() << "EncodePlanner:" << preset << QString::number(clipSeconds / seconds, 'f', 2) << "x realtime";
+    }
+    if (measured.isEmpty()) {
+        return false;
+    }
+
+    QSettings settings;
+    settings.setValue(QString("encodePlanner/calibration%1").arg(threads), entries);
+    QMutexLocker locker(&mutex);
+    calibrations = measured;
+    calibratedThreads = threads;
+    speedCorrection = 1.0;
+    return true;
+}
+
+void EncodePlanner::beginBatch(const QStringList &videos, int images, int imageWorkers) {
+    {
+        QMutexLocker locker(&mutex);
+        probes.clear();
+        plannedSeconds.clear();
+        remainingPixelSeconds = 0.0;
+        remainingImages = 0;
+        this->imageWorkers = qMax(1, imageWorkers);
+    }
+    addToBatch(videos, images);
+    qDebug() << "EncodePlanner: Batch of" << videos.size() << "videos and" << images << "images,"
+             << (deadline.isValid() ? QString("%1 s to the deadline").arg(secondsLeft(), 0, 'f', 0)
+                                    : QString("no deadline"));
+}
+
+void EncodePlanner::addToBatch(const QStringList &videos, int images) {
+    const int threads = ResourceGovernor::instance()->encoderThreads(1);
+    {
+        QMutexLocker locker(&mutex);
+        if (calibratedThreads != threads) {
+            loadCalibration(threads);
+        }
+        if (calibrations.isEmpty() && !videos.isEmpty()) {
+            startCalibration(videos.first());
+        }
+    }
+
+    QHash<QString, VideoProbe> batch;
+    double pixelSeconds = 0.0;
+    for (const QString &video : videos) {
+        const VideoProbe probe = VideoProbe::read(video);
+        batch.insert(video, probe);
+        pixelSeconds += probe.pixelSeconds();
+    }
+
+    QMutexLocker locker(&mutex);
+    probes.insert(batch);
+    remainingPixelSeconds += pixelSeconds;
+    remainingImages += images;
+}
+
+void EncodePlanner::startCalibration(const QString &samplePath) {
+    if (calibration) {
+        if (!calibration->isFinished()) {
+            return;
+        }
+        delete calibration;
+    }
+    calibration = QThread::create([this, samplePath]() { calibrate(samplePath); });
+    calibration->start(QThread::LowPriority);
+}
+
+double EncodePlanner::contention() const {
+    // The video encoder runs alongside the image workers; calibration ran
+    // it alone. It gets fewer threads when they share the cores, and when
+    // together they still ask for more than the budget's cores each gets a
+    // proportional share
+    ResourceGovernor *governor = ResourceGovernor::instance();
+    const ResourceBudget budget = governor->budget();
+    const int busyWorkers = qMin(imageWorkers, remainingImages);
+    const int threads = governor->encoderThreads(1 + busyWorkers);
+    const double fewerThreads = double(governor->encoderThreads(1)) / threads;
+    const int demand = threads + busyWorkers;
+    return qMax(1.0, fewerThreads) * qMax(1.0, double(demand) / qMax(1, budget.cores));
+}
+
+double EncodePlanner::secondsLeft() const {
+    return qMax<qint64>(1, QDateTime::currentDateTime().msecsTo(deadline)) / 1000.0;
+}
+
+const PresetCalibration *EncodePlanner::calibrationFor(const QString &preset) const {
+    for (const PresetCalibration &calibration : calibrations) {
+        if (calibration.preset == preset) {
+            return &calibration;
+        }
+    }
+    return nullptr;
+}
+
+VideoPlan EncodePlanner::planFor(const VideoProbe &probe, double availableSeconds) const {
+    VideoPlan plan;
+    if (calibrations.isEmpty()) {
+        return plan;
+    }
+
+    // Slowest preset that still encodes what is left in the time left, one
+    // video at a time on the cores the image workers leave it
+    const double slowdown = speedCorrection * contention();
+    if (availableSeconds > 0.0) {
+        const double neededRate = remainingPixelSeconds / availableSeconds;
+        plan.preset = calibrations.first().preset;
+        for (auto it = calibrations.crbegin(); it != calibrations.crend(); ++it) {
+            if (it->pixelRate / slowdown >= neededRate) {
+                plan.preset = it->preset;
+                break;
+            }
+        }
+    }
+
+    const PresetCalibration *calibration = calibrationFor(plan.preset);
+    if (!calibration) {
+        calibration = &calibrations.last();
+        plan.preset = calibration->preset;
+    }
+
+    // Every 6 CRF steps halve the bitrate
+    if (targetBytesPerSecond > 0.0 && probe.durationSeconds > 0.0) {
+        const double predicted = calibration->bytesPerPixelSecond * probe.pixelSeconds() / probe.durationSeconds;
+        plan.crf = qBound(18, int(std::lround(defaultCrf + 6.0 * std::log2(predicted / targetBytesPerSecond))), 40);
+        plan.maxrateKbps = int(targetBytesPerSecond * 8.0 * 1.5 / 1000.0);
+    }
+
+    plan.estimatedSeconds = probe.pixelSeconds() / calibration->pixelRate * slowdown;
+    plan.estimatedBytes = qint64(calibration->bytesPerPixelSecond * probe.pixelSeconds()
+                                 * std::pow(2.0, (defaultCrf - plan.crf) / 6.0));
+    return plan;
+}
+
+VideoPlan EncodePlanner::planVideo(const QString &path) {
+    QMutexLocker locker(&mutex);
+    if (!deadline.isValid() && targetBytesPerSecond <= 0.0) {
+        return VideoPlan();
+    }
+    if (!probes.contains(path)) {
+        locker.unlock();
+        const VideoProbe probe = VideoProbe::read(path);
+        locker.relock();
+        probes.insert(path, probe);
+    }
+    const VideoProbe probe = probes.value(path);
+    const VideoPlan plan = planFor(probe, deadline.isValid() ? secondsLeft() : 0.0);
+    if (const PresetCalibration *calibration = calibrationFor(plan.preset)) {
+        // Contention is part of the plan, so the correction only learns the rest
+        plannedSeconds.insert(path, probe.pixelSeconds() / calibration->pixelRate * contention());
+    }
+    qDebug() << "EncodePlanner:" << QFileInfo(path).fileName() << "preset" << plan.preset << "crf" << plan.crf
+             << "estimated" << plan.estimatedSeconds << "s";
+    return plan;
+}
+
+void EncodePlanner::videoFinished(const QString &path, qint64 wallUs) {
+    QMutexLocker locker(&mutex);
+    remainingPixelSeconds = qMax(0.0, remainingPixelSeconds - probes.value(path).pixelSeconds());
+    const double planned = plannedSeconds.take(path);
+    if (planned > 0.0) {
+        // Smoothed, so one odd clip doesn't swing the whole plan
+        const double ratio = wallUs / 1e6 / planned;
+        speedCorrection = 0.7 * speedCorrection + 0.3 * qBound(0.1, ratio, 10.0);
+        qDebug() << "EncodePlanner:" << QFileInfo(path).fileName() << "took" << ratio << "x the calibrated time";
+    }
+}
+
+int EncodePlanner::imageEffort(int configured) const {
+    QMutexLocker locker(&mutex);
+    if (!deadline.isValid() || imageSeconds <= 0.0 || remainingImages <= 0) {
+        return configured;
+    }
+    // Highest effort up to the configured one that fits the time left
+    const double available = secondsLeft();
+    for (int effort = configured; effort > 1; --effort) {
+        if (remainingImages * imageSeconds * effortCost(effort) / imageWorkers <= available) {
+            return effort;
+        }
+    }
+    return 1;
+}
+
+void EncodePlanner::imageFinished(int effort, qint64 wallUs) {
+    QMutexLocker locker(&mutex);
+    remainingImages = qMax(0, remainingImages - 1);
+    const double normalized = wallUs / 1e6 / effortCost(effort);
+    imageSeconds = imageSeconds > 0.0 ? 0.8 * imageSeconds + 0.2 * normalized : normalized;
+}
+
+VideoPlan EncodePlanner::estimate(const VideoProbe &probe) const {
+    QMutexLocker locker(&mutex);
+    VideoPlan plan;
+    if (const PresetCalibration *calibration = calibrationFor(plan.preset)) {
+        plan.estimatedSeconds = probe.pixelSeconds() / calibration->pixelRate * speedCorrection;
+        plan.estimatedBytes = qint64(calibration->bytesPerPixelSecond * probe.pixelSeconds());
+    }
+    return plan;
+}
@@ -0,0 +1,104 @@
+#ifndef ENCODE_PLANNER_H
+#define ENCODE_PLANNER_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+
+class QThread;
+
+struct VideoProbe {
+    QString codec;
+    double durationSeconds = 0.0;
+    int width = 0;
+    int height = 0;
+
+    double pixelSeconds() const { return double(width) * height * durationSeconds; }
+
+    // First video stream's codec and size and the container duration, from ffprobe.
+    static VideoProbe read(const QString &path);
+};
+
+// Measured cost of one x264 preset on this machine at CRF 23.
+struct PresetCalibration {
+    QString preset;
+    double pixelRate = 0.0;          // pixel-seconds of video encoded per wall second
+    double bytesPerPixelSecond = 0.0;
+};
+
+struct VideoPlan {
+    QString preset = "medium";
+    int crf = 23;
+    int maxrateKbps = 0;             // 0 leaves the bitrate to CRF
+    double estimatedSeconds = 0.0;   // 0 when uncalibrated
+    qint64 estimatedBytes = 0;
+
+    QStringList ffmpegArguments() const;
+};
+
+// Chooses x264 preset and CRF per video, and image encoder effort, so a
+// batch finishes by a deadline ("encode/finishBy", HH:mm) or stays within
+// a size budget ("encode/mbPerMinute" of video). Presets are calibrated
+// once per encoder thread count with short encodes of a real clip, on a
+// thread of their own so the batch isn't held up; videos planned before
+// that finishes get the default preset. Videos are planned against the
+// cores they share with the image workers, and every finished job
+// corrects the estimates, so later jobs are planned against how far ahead
+// or behind the batch actually is.
+class EncodePlanner {
+public:
+    static EncodePlanner *instance();
+
+    static bool parseDeadline(const QString &text, QDateTime *deadline);
+    void setDeadline(const QDateTime &deadline);
+    void setTargetMegabytesPerMinute(double megabytes);
+    bool isActive() const;
+
+    // Starts calibrating with the first video when needed and records the work ahead.
+    void beginBatch(const QStringList &videos, int images, int imageWorkers);
+    // More work for the running batch, as files keep arriving.
+    void addToBatch(const QStringList &videos, int images);
+
+    VideoPlan planVideo(const QString &path);
+    void videoFinished(const QString &path, qint64 wallUs);
+    int imageEffort(int configured) const;
+    void imageFinished(int effort, qint64 wallUs);
+
+    // Estimate with the default preset and CRF, for dry runs.
+    VideoPlan estimate(const VideoProbe &probe) const;
+
+    // Blocks until every preset that fits is measured.
+    bool calibrate(const QString &samplePath);
+
+private:
+    EncodePlanner();
+    ~EncodePlanner();
+
+    mutable QMutex mutex;
+    QDateTime deadline;
+    double targetBytesPerSecond = 0.0;
+    QList<PresetCalibration> calibrations;   // fastest first
+    int calibratedThreads = -1;
+    QThread *calibration = nullptr;          // running in the background, if any
+    std::atomic<bool> stopping{false};
+    double speedCorrection = 1.0;            // measured / calibrated encode time
+    double remainingPixelSeconds = 0.0;
+    QHash<QString, VideoProbe> probes;
+    QHash<QString, double> plannedSeconds;   // uncorrected estimate per running video
+    int remainingImages = 0;
+    int imageWorkers = 1;
+    double imageSeconds = 0.0;               // per image at effort 7, 0 until measured
+
+    void loadCalibration(int threads);
+    const PresetCalibration *calibrationFor(const QString &preset) const;
+    void startCalibration(const QString &samplePath);
+    double contention() const;
+    VideoPlan planFor(const VideoProbe &probe, double availableSeconds) const;
+    double secondsLeft() const;
+};
+
+#endif // ENCODE_PLANNER_H
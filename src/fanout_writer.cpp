@@ -0,0 +1,234 @@
+#include "fanout_writer.h"
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include <QThread>
+
+FanoutWriter::FanoutWriter(const QStringList &paths, int queueChunks, qint64 chunkSize, QObject *parent)
+    : QIODevice(parent), paths(paths), queueChunks(qMax(1, queueChunks)), chunkSize(chunkSize) {
+}
+
+FanoutWriter::~FanoutWriter() {
+    if (isOpen()) {
+        abort();
+    }
+}
+
+bool FanoutWriter::open(OpenMode mode) {
+    if ((mode & QIODevice::ReadOnly) || paths.isEmpty()) {
+        return false;
+    }
+    destinations.clear();
+    closing = false;
+    pending.clear();
+    // Every queue shares the same chunks, so the slowest one bounds the total
+    reservation = MemoryReservation(MemoryStage::Write, (queueChunks + 1) * chunkSize);
+
+    for (const QString &path : paths) {
+        auto destination = std::make_shared<Destination>();
+        destination->result.path = path;
+        // Chunks arrive whole, so the writer never buffers them again
+        destination->writer.reset(new ChecksumWriter(path, chunkSize));
+        if (!destination->writer->open()) {
+            destination->failed = true;
+        } else {
+            Destination *raw = destination.get();
+            destination->thread = QThread::create([this, raw]() { drain(raw); });
+            destination->thread->start();
+        }
+        destinations << destination;
+    }
+    return QIODevice::open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+qint64 FanoutWriter::readData(char *, qint64) {
+    return -1;
+}
+
+qint64 FanoutWriter::writeData(const char *data, qint64 size) {
+    pending.append(data, int(size));
+    if (pending.size() >= chunkSize) {
+        QByteArray chunk = pending;
+        pending.clear();
+        if (!dispatch(chunk)) {
+            return -1;
+        }
+    }
+    return size;
+}
+
+bool FanoutWriter::writeChunk(const QByteArray &chunk) {
+    if (!pending.isEmpty()) {
+        QByteArray buffered = pending;
+        pending.clear();
+        if (!dispatch(buffered)) {
+            return false;
+        }
+    }
+    return dispatch(chunk);
+}
+
+bool FanoutWriter::dispatch(const QByteArray &chunk) {
+    QMutexLocker locker(&mutex);
+    bool delivered = false;
+    for (const std::shared_ptr<Destination> &destination : destinations) {
+        while (!destination->failed && destination->queue.size() >= queueChunks) {
+            chunkTaken.wait(&mutex);
+        }
+        if (!destination->failed) {
+            // Implicitly shared: every queue holds the same bytes
+            destination->queue.enqueue(chunk);
+            delivered = true;
+        }
+    }
+    chunkQueued.wakeAll();
+    return delivered;
+}
+
+void FanoutWriter::drain(Destination *destination) {
+    for (;;) {
+        QByteArray chunk;
+        {
+            QMutexLocker locker(&mutex);
+            while (destination->queue.isEmpty() && !closing) {
+                chunkQueued.wait(&mutex);
+            }
+            if (destination->queue.isEmpty()) {
+                break;
+            }
+            chunk = destination->queue.dequeue();
+            chunkTaken.wakeAll();
+        }
+        if (destination->writer->write(chunk) != chunk.size()) {
+            qDebug() << "FanoutWriter: Dropping destination" << destination->result.path;
+            QMutexLocker locker(&mutex);
+            destination->failed = true;
+            destination->queue.clear();
+            chunkTaken.wakeAll();
+            break;
+        }
+    }
+
+    // Destinations fsync and rename in parallel too
+    const bool failed = [&]() {
+        QMutexLocker locker(&mutex);
+        return destination->failed;
+    }();
+    if (failed) {
+        destination->writer->abort();
+        return;
+    }
+    destination->result.success = destination->writer->commit();
+    destination->result.crc = destination->writer->checksum();
+    destination->result.bytes = destination->writer->bytesWritten();
+}
+
+void FanoutWriter::finish() {
+    {
+        QMutexLocker locker(&mutex);
+        closing = true;
+        chunkQueued.wakeAll();
+    }
+    for (const std::shared_ptr<Destination> &destination : destinations) {
+        if (destination->thread) {
+            destination->thread->wait();
+            delete destination->thread;
+            destination->thread = nullptr;
+        }
+    }
+    reservation.release();
+    QIODevice::close();
+}
+
+bool FanoutWriter::commit() {
+    if (!isOpen()) {
+        return false;
+    }
+    if (!pending.isEmpty()) {
+        QByteArray chunk = pending;
+        pending.clear();
+        dispatch(chunk);
+    }
+    finish();
+
+    bool success = true;
+    for (const std::shared_ptr<Destination> &destination : destinations) {
+        if (!destination->result.success) {
+            qDebug() << "FanoutWriter: Failed to write" << destination->result.path;
+            success = false;
+        }
+    }
+    return success;
+}
+
+void FanoutWriter::abort() {
+    {
+        QMutexLocker locker(&mutex);
+        for (const std::shared_ptr<Destination> &destination : destinations) {
+            destination->failed = true;
+            destination->queue.clear();
+        }
+        chunkTaken.wakeAll();
+    }
+    pending.clear();
+    finish();
+    for (const std::shared_ptr<Destination> &destination : destinations) {
+        if (destination->writer->isOpen()) {
+            destination->writer->abort();
+        }
+    }
+}
+
+QList<FanoutResult> FanoutWriter::results() const {
+    QList<FanoutResult> list;
+    for (const std::shared_ptr<Destination> &destination : destinations) {
+        list << destination->result;
+    }
+    return list;
+}
+
+QStringList FanoutWriter::splitDestinations(const QString &outputDirectory) {
+    QStringList destinations;
+    for (const QString &part : outputDirectory.split(';')) {
+        if (!part.trimmed().isEmpty()) {
+            destinations << part.trimmed();
+        }
+    }
+    return destinations;
+}
+
+bool FanoutWriter::copyFile(const QString &sourcePath, const QStringList &destinationPaths,
+                            QList<FanoutResult> *results) {
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly)) {
+        qDebug() << "FanoutWriter: Cannot read" << sourcePath;
+        return false;
+    }
+    const qint64 chunkSize = 4 << 20;
+    FanoutWriter writer(destinationPaths, 8, chunkSize);
+    if (!writer.open()) {
+        return false;
+    }
+
+    bool readFailed = false;
+    while (!source.atEnd()) {
+        // A fresh buffer per chunk, since the previous one may still be queued
+        QByteArray chunk = source.read(chunkSize);
+        if (chunk.isEmpty()) {
+            readFailed = source.error() != QFile::NoError;
+            break;
+        }
+        if (!writer.writeChunk(chunk)) {
+            break;
+        }
+    }
+    if (readFailed) {
+        writer.abort();
+        return false;
+    }
+    const bool success = writer.commit();
+    if (results) {
+        *results = writer.results();
+    }
+    return success;
+}
@@ -0,0 +1,88 @@
+#ifndef FANOUT_WRITER_H
+#define FANOUT_WRITER_H
+
+#include "checksum.h"
+#include "memory_budget.h"
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+#include <memory>
+
+class QThread;
+
+struct FanoutResult {
+    QString path;
+    bool success = false;
+    quint32 crc = 0;
+    qint64 bytes = 0;
+};
+
+// Write-only device that sends one stream to several files at once. Each
+// chunk is read into memory once and shared by every destination; each
+// destination has its own thread and ChecksumWriter, so it gets its own
+// CRC, manifest entry and success flag. A slow destination holds back the
+// others only once queueChunks of its chunks are waiting, and a failed one
+// is dropped without stopping the rest.
+class FanoutWriter : public QIODevice {
+    Q_OBJECT
+
+public:
+    explicit FanoutWriter(const QStringList &paths, int queueChunks = 8, qint64 chunkSize = 1 << 20,
+                          QObject *parent = nullptr);
+    ~FanoutWriter();
+
+    bool open(OpenMode mode = QIODevice::WriteOnly) override;
+    bool isSequential() const override { return true; }
+
+    // Hands a whole chunk to every destination without copying it.
+    bool writeChunk(const QByteArray &chunk);
+
+    // Waits for every destination and commits it. Returns true when all of
+    // them succeeded; results() tells which did.
+    bool commit();
+    void abort();
+
+    QList<FanoutResult> results() const;
+
+    // "outputDirectory" may list several destinations separated by ';'.
+    static QStringList splitDestinations(const QString &outputDirectory);
+
+    // Reads sourcePath once and writes it to every destination path.
+    static bool copyFile(const QString &sourcePath, const QStringList &destinationPaths,
+                         QList<FanoutResult> *results = nullptr);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    struct Destination {
+        std::unique_ptr<ChecksumWriter> writer;
+        QQueue<QByteArray> queue;
+        QThread *thread = nullptr;
+        bool failed = false;
+        FanoutResult result;
+    };
+
+    QStringList paths;
+    int queueChunks;
+    qint64 chunkSize;
+    QByteArray pending;
+    QList<std::shared_ptr<Destination>> destinations;
+    MemoryReservation reservation;
+    mutable QMutex mutex;
+    QWaitCondition chunkQueued;
+    QWaitCondition chunkTaken;
+    bool closing = false;
+
+    void drain(Destination *destination);
+    bool dispatch(const QByteArray &chunk);
+    void finish();
+};
+
+#endif // FANOUT_WRITER_H
@@ -0,0 +1,267 @@
+#include "image_renditions.h"
+#include "clustering.h"
+#include "memory_budget.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QSettings>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Per-destination-column source span for the horizontal pass.
+struct ColumnSpan {
+    int start;
+    int count;
+    int weightOffset;
+};
+
+void buildColumnSpans(int srcWidth, int dstWidth,
+                      std::vector<ColumnSpan> &spans, std::vector<float> &weights) {
+    const double scale = double(srcWidth) / dstWidth;
+    spans.resize(dstWidth);
+    weights.clear();
+    weights.reserve(size_t(dstWidth) * (size_t(std::ceil(scale)) + 1));
+
+    for (int x = 0; x < dstWidth; ++x) {
+        const double left = x * scale;
+        const double right = std::min(double(srcWidth), (x + 1) * scale);
+        const int first = int(left);
+        const int last = std::min(srcWidth, int(std::ceil(right)));
+
+        spans[x].start = first;
+        spans[x].weightOffset = int(weights.size());
+        for (int i = first; i < last; ++i) {
+            const double overlap = std::min(double(i + 1), right) - std::max(double(i), left);
+            weights.push_back(float(overlap / scale));
+        }
+        spans[x].count = last - first;
+    }
+}
+
+// Four interleaved channels per pixel; the inner loops stay on contiguous
+// floats so the compiler can keep them in vector registers.
+void resampleRow(const uchar *src, float *dst, const std::vector<ColumnSpan> &spans,
+                 const std::vector<float> &weights) {
+    const int dstWidth = int(spans.size());
+    for (int x = 0; x < dstWidth; ++x) {
+        const ColumnSpan &span = spans[x];
+        const uchar *pixel = src + span.start * 4;
+        const float *w = weights.data() + span.weightOffset;
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int k = 0; k < span.count; ++k) {
+            for (int c = 0; c < 4; ++c) {
+                sum[c] += w[k] * pixel[k * 4 + c];
+            }
+        }
+        for (int c = 0; c < 4; ++c) {
+            dst[x * 4 + c] = sum[c];
+        }
+    }
+}
+
+void accumulateRow(float *acc, const float *row, float weight, int count) {
+    for (int i = 0; i < count; ++i) {
+        acc[i] += weight * row[i];
+    }
+}
+
+void storeRow(uchar *dst, const float *acc, int count) {
+    for (int i = 0; i < count; ++i) {
+        const float v = acc[i] + 0.5f;
+        dst[i] = uchar(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+    }
+}
+
+QSize fitLongEdge(const QSize &size, int longEdge) {
+    if (longEdge <= 0 || std::max(size.width(), size.height()) <= longEdge) {
+        return size;
+    }
+    return size.scaled(longEdge, longEdge, Qt::KeepAspectRatio);
+}
+
+} // namespace
+
+ImageRenditioner::ImageRenditioner(const QList<RenditionSpec> &specs, const QList<EncoderSettings> &formats)
+    : specs(specs), formats(formats) {
+    // Largest first so smaller renditions can be derived from the previous one
+    std::stable_sort(this->specs.begin(), this->specs.end(), [](const RenditionSpec &a, const RenditionSpec &b) {
+        const int edgeA = a.longEdge <= 0 ? INT_MAX : a.longEdge;
+        const int edgeB = b.longEdge <= 0 ? INT_MAX : b.longEdge;
+        return edgeA > edgeB;
+    });
+}
+
+QList<RenditionSpec> ImageRenditioner::defaultSpecs() {
+    return {
+        {"full", 0, 95, ""},
+        {"web", 2048, 85, "_web"},
+        {"preview", 256, 75, "_preview"},
+    };
+}
+
+QList<RenditionSpec> ImageRenditioner::loadSpecs() {
+    QSettings settings;
+    QStringList entries = settings.value("renditions").toStringList();
+    if (entries.isEmpty()) {
+        return defaultSpecs();
+    }
+
+    QList<RenditionSpec> specs;
+    for (const QString &entry : entries) {
+        QStringList parts = entry.split(':');
+        if (parts.size() < 3) {
+            qDebug() << "ImageRenditioner: Ignoring malformed rendition" << entry;
+            continue;
+        }
+        RenditionSpec spec;
+        spec.name = parts[0];
+        spec.longEdge = parts[1].toInt();
+        spec.quality = std::clamp(parts[2].toInt(), 1, 100);
+        spec.suffix = parts.size() > 3 ? parts[3] : (spec.longEdge > 0 ? "_" + spec.name : QString());
+        specs << spec;
+    }
+    return specs.isEmpty() ? defaultSpecs() : specs;
+}
+
+bool ImageRenditioner::render(const QString &inputPath, const QString &outputDirectory,
+                              const QString &baseName, QStringList *writtenFiles) const {
+    QByteArray exif;
+    QFile file(inputPath);
+    if (file.open(QIODevice::ReadOnly)) {
+        exif = ExifInfo::forDecodedImage(ExifInfo::readTiff(&file));
+    }
+    QImageReader reader(inputPath);
+    return render(reader, inputPath, exif, outputDirectory, baseName, writtenFiles);
+}
+
+bool ImageRenditioner::render(QIODevice *input, const QString &outputDirectory,
+                              const QString &baseName, QStringList *writtenFiles) const {
+    const QByteArray exif = ExifInfo::forDecodedImage(ExifInfo::readTiff(input));
+    input->seek(0);
+    // No file name to go by, so the format comes from the content
+    QImageReader reader(input);
+    return render(reader, baseName, exif, outputDirectory, baseName, writtenFiles);
+}
+
+bool ImageRenditioner::render(QImageReader &reader, const QString &inputName, const QByteArray &exif,
+                              const QString &outputDirectory, const QString &baseName,
+                              QStringList *writtenFiles) const {
+    reader.setAutoTransform(true);
+    // Parallel decodes wait for each other once the decode budget is spent
+    const QSize inputSize = reader.size();
+    MemoryReservation decode(MemoryStage::Decode, qint64(qMax(0, inputSize.width())) * qMax(0, inputSize.height()) * 4);
+    QImage decoded = reader.read();
+    if (decoded.isNull()) {
+        qDebug() << "ImageRenditioner: Cannot decode" << inputName << reader.errorString();
+        return false;
+    }
+
+    const QImage::Format workingFormat = decoded.hasAlphaChannel()
+        ? QImage::Format_RGBA8888_Premultiplied : QImage::Format_RGBX8888;
+    decoded.convertTo(workingFormat);
+
+    QDir outDir(outputDirectory);
+    QImage previous = decoded;
+    bool success = true;
+
+    for (const RenditionSpec &spec : specs) {
+        const QSize target = fitLongEdge(decoded.size(), spec.longEdge);
+        MemoryReservation encode(MemoryStage::Encode,
+                                 target == decoded.size() ? 0 : qint64(target.width()) * target.height() * 4);
+
+        // Downscale from the previous (smaller) rendition when it still has
+        // enough headroom, instead of touching the full decode again.
+        const QImage &source = (previous.width() >= target.width() * 2) ? previous : decoded;
+        QImage output = (target == source.size()) ? source
+                                                  : resampleArea(source, target.width(), target.height());
+
+        for (EncoderSettings settings : formats) {
+            if (settings.format == OutputFormat::Jpeg) {
+                settings.quality = spec.quality;
+            }
+            QString outputPath = outDir.absoluteFilePath(
+                baseName + spec.suffix + "." + FormatEncoder::extension(settings.format));
+            // Capture date, place and camera go along with the full-size copy
+            const QByteArray metadata = target == decoded.size() ? exif : QByteArray();
+            if (!FormatEncoder::encode(output, outputPath, settings, metadata)) {
+                qDebug() << "ImageRenditioner: Failed to write" << outputPath;
+                success = false;
+                continue;
+            }
+            if (writtenFiles) {
+                writtenFiles->append(outputPath);
+            }
+        }
+        previous = output;
+    }
+
+    return success;
+}
+
+QImage ImageRenditioner::resampleArea(const QImage &source, int targetWidth, int targetHeight) {
+    if (source.isNull() || targetWidth <= 0 || targetHeight <= 0) {
+        return QImage();
+    }
+    if (targetWidth >= source.width() || targetHeight >= source.height()) {
+        // Area averaging only reduces; anything else is left to Qt
+        return source.scaled(targetWidth, targetHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+
+    QImage src = source;
+    if (src.depth() != 32) {
+        src.convertTo(src.hasAlphaChannel() ? QImage::Format_RGBA8888_Premultiplied : QImage::Format_RGBX8888);
+    }
+
+    const int srcWidth = src.width();
+    const int srcHeight = src.height();
+    const int rowFloats = targetWidth * 4;
+    QImage dst(targetWidth, targetHeight, src.format());
+
+    std::vector<ColumnSpan> spans;
+    std::vector<float> weights;
+    buildColumnSpans(srcWidth, targetWidth, spans, weights);
+
+    std::vector<float> horizontal(rowFloats);
+    std::vector<float> current(rowFloats, 0.0f);
+    std::vector<float> next(rowFloats, 0.0f);
+
+    // Each source row is read exactly once; it contributes to at most two
+    // destination rows because the vertical scale is always >= 1 here.
+    const double scaleY = double(srcHeight) / targetHeight;
+    int row = 0;
+    for (int y = 0; y < srcHeight && row < targetHeight; ++y) {
+        resampleRow(src.constScanLine(y), horizontal.data(), spans, weights);
+
+        const double top = y;
+        const double bottom = y + 1;
+        const int firstRow = std::max(row, int(top / scaleY));
+        const int lastRow = std::min(targetHeight - 1, int(std::ceil(bottom / scaleY)) - 1);
+        for (int r = firstRow; r <= lastRow && r <= row + 1; ++r) {
+            const double overlap = std::min(bottom, (r + 1) * scaleY) - std::max(top, r * scaleY);
+            if (overlap <= 0.0) {
+                continue;
+            }
+            float *acc = (r == row) ? current.data() : next.data();
+            accumulateRow(acc, horizontal.data(), float(overlap / scaleY), rowFloats);
+        }
+
+        while (row < targetHeight && (row + 1) * scaleY <= bottom + 1e-9) {
+            storeRow(dst.scanLine(row), current.data(), rowFloats);
+            current.swap(next);
+            std::fill(next.begin(), next.end(), 0.0f);
+            ++row;
+        }
+    }
+    for (; row < targetHeight; ++row) {
+        storeRow(dst.scanLine(row), current.data(), rowFloats);
+        current.swap(next);
+        std::fill(next.begin(), next.end(), 0.0f);
+    }
+
+    return dst;
+}
@@ -0,0 +1,54 @@
+#ifndef IMAGE_RENDITIONS_H
+#define IMAGE_RENDITIONS_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "output_formats.h"
+
+class QIODevice;
+class QImageReader;
+
+// One output produced from a decoded image. A longEdge of 0 keeps the
+// original dimensions.
+struct RenditionSpec {
+    QString name;
+    int longEdge = 0;
+    int quality = 90;
+    QString suffix;
+};
+
+class ImageRenditioner {
+public:
+    explicit ImageRenditioner(const QList<RenditionSpec> &specs,
+                              const QList<EncoderSettings> &formats = {EncoderSettings()});
+
+    // Built-in full / web / preview set, overridable through the
+    // "renditions" setting ("name:longEdge:quality:suffix" entries).
+    static QList<RenditionSpec> defaultSpecs();
+    static QList<RenditionSpec> loadSpecs();
+
+    // Decodes inputPath once and writes every rendition in every output
+    // format into outputDirectory as baseName + suffix + extension; JPEG
+    // outputs use the rendition's quality, and the full-size JPEG keeps the
+    // source's EXIF. Returns false if the image could not be decoded or any
+    // rendition failed to write.
+    bool render(const QString &inputPath, const QString &outputDirectory,
+                const QString &baseName, QStringList *writtenFiles = nullptr) const;
+    // Same, decoding from a device, e.g. a QBuffer over bytes still in memory.
+    bool render(QIODevice *input, const QString &outputDirectory,
+                const QString &baseName, QStringList *writtenFiles = nullptr) const;
+
+    // Area-averaging downscale in a single streaming pass over the source rows.
+    static QImage resampleArea(const QImage &source, int targetWidth, int targetHeight);
+
+private:
+    QList<RenditionSpec> specs;
+    QList<EncoderSettings> formats;
+
+    bool render(QImageReader &reader, const QString &inputName, const QByteArray &exif,
+                const QString &outputDirectory, const QString &baseName, QStringList *writtenFiles) const;
+};
+
+#endif // IMAGE_RENDITIONS_H
@@ -0,0 +1,304 @@
+#include "job_scheduler.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QRunnable>
+#include <QThreadPool>
+#include <signal.h>
+
+namespace {
+
+thread_local QStringList currentFiles;
+thread_local bool currentUrgent = false;
+
+} // namespace
+
+JobScope::JobScope(const QStringList &files, bool urgent)
+    : previousFiles(currentFiles), previousUrgent(currentUrgent), urgent(urgent) {
+    currentFiles = files;
+    currentUrgent = urgent || previousUrgent;
+    if (urgent) {
+        JobScheduler::instance()->beginUrgent();
+    }
+}
+
+JobScope::~JobScope() {
+    if (urgent) {
+        JobScheduler::instance()->endUrgent();
+    }
+    currentFiles = previousFiles;
+    currentUrgent = previousUrgent;
+}
+
+JobScheduler *JobScheduler::instance() {
+    static JobScheduler scheduler;
+    return &scheduler;
+}
+
+void JobScheduler::startBatch(const QStringList &files) {
+    QMutexLocker locker(&mutex);
+    pending = files;
+    promoted.clear();
+    promotedFiles.clear();
+    cancelledFiles.clear();
+    tokens.clear();
+    batchRunning = true;
+    batchCancelled = false;
+}
+
+void JobScheduler::finishBatch() {
+    QMutexLocker locker(&mutex);
+    pending.clear();
+    promoted.clear();
+    batchRunning = false;
+}
+
+bool JobScheduler::isBatchRunning() const {
+    QMutexLocker locker(&mutex);
+    return batchRunning;
+}
+
+bool JobScheduler::isBatchCancelled() const {
+    QMutexLocker locker(&mutex);
+    return batchCancelled;
+}
+
+QStringList JobScheduler::takeSlice(int maxFiles, bool *urgent) {
+    QMutexLocker locker(&mutex);
+    *urgent = false;
+    if (batchCancelled) {
+        return QStringList();
+    }
+    while (!promoted.isEmpty()) {
+        const QString file = promoted.takeFirst();
+        if (pending.removeOne(file)) {
+            *urgent = true;
+            return QStringList() << file;
+        }
+    }
+    QStringList slice;
+    while (!pending.isEmpty() && slice.size() < maxFiles) {
+        slice << pending.takeFirst();
+    }
+    return slice;
+}
+
+void JobScheduler::requeue(const QStringList &files) {
+    QMutexLocker locker(&mutex);
+    for (auto it = files.crbegin(); it != files.crend(); ++it) {
+        if (!cancelledFiles.contains(*it) && !batchCancelled) {
+            pending.prepend(*it);
+        }
+    }
+}
+
+void JobScheduler::promote(const QStringList &files) {
+    QMutexLocker locker(&mutex);
+    for (const QString &file : files) {
+        if (promotedFiles.contains(file) || cancelledFiles.contains(file)) {
+            continue;
+        }
+        promotedFiles.insert(file);
+        promoted << file;
+        // A conversion that is already running keeps going while others pause
+        for (TrackedProcess &process : processes) {
+            if (process.files.contains(file)) {
+                process.urgent = true;
+                if (process.suspended) {
+                    stopProcess(process.pid, SIGCONT);
+                    process.suspended = false;
+                }
+            }
+        }
+    }
+}
+
+bool JobScheduler::isPromoted(const QString &file) const {
+    QMutexLocker locker(&mutex);
+    return promotedFiles.contains(file);
+}
+
+void JobScheduler::cancel(const QStringList &files) {
+    QMutexLocker locker(&mutex);
+    for (const QString &file : files) {
+        cancelledFiles.insert(file);
+        tokens[file].cancel();
+        pending.removeAll(file);
+        promoted.removeAll(file);
+
+        auto queued = queuedTasks.find(file);
+        if (queued != queuedTasks.end()) {
+            if (queued->pool->tryTake(queued->runnable)) {
+                delete queued->runnable;
+                queuedTasks.erase(queued);
+            }
+        }
+        for (TrackedProcess &process : processes) {
+            if (process.files.contains(file) && process.pid > 0) {
+                // A stopped process has to run again to die
+                stopProcess(process.pid, SIGKILL);
+                stopProcess(process.pid, SIGCONT);
+            }
+        }
+    }
+}
+
+void JobScheduler::cancelAll() {
+    QStringList files;
+    {
+        QMutexLocker locker(&mutex);
+        batchCancelled = true;
+        files = pending + queuedTasks.keys();
+        for (const TrackedProcess &process : processes) {
+            files << process.files;
+        }
+    }
+    cancel(files);
+}
+
+bool JobScheduler::isCancelled(const QString &file) const {
+    QMutexLocker locker(&mutex);
+    return batchCancelled || cancelledFiles.contains(file);
+}
+
+CancellationToken JobScheduler::token(const QString &file) {
+    QMutexLocker locker(&mutex);
+    return tokens[file];
+}
+
+void JobScheduler::submit(QThreadPool *pool, const QString &file, const std::function<void()> &task) {
+    QMutexLocker locker(&mutex);
+    if (batchCancelled || cancelledFiles.contains(file)) {
+        return;
+    }
+    QRunnable *runnable = QRunnable::create([this, file, task]() {
+        {
+            QMutexLocker locker(&mutex);
+            queuedTasks.remove(file);
+            if (batchCancelled || cancelledFiles.contains(file)) {
+                return;
+            }
+        }
+        JobScope scope(QStringList() << file, false);
+        task();
+    });
+    queuedTasks.insert(file, {pool, runnable, task});
+    pool->start(runnable, promotedFiles.contains(file) ? 1 : 0);
+}
+
+bool JobScheduler::takePromotedTask(QString *file, std::function<void()> *task) {
+    QMutexLocker locker(&mutex);
+    for (auto it = queuedTasks.begin(); it != queuedTasks.end(); ++it) {
+        // tryTake fails once a worker has picked the task up
+        if (promotedFiles.contains(it.key()) && it->pool->tryTake(it->runnable)) {
+            delete it->runnable;
+            *file = it.key();
+            *task = it->task;
+            queuedTasks.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobScheduler::track(QProcess &process) {
+    QProcess *key = &process;
+    {
+        QMutexLocker locker(&mutex);
+        TrackedProcess tracked;
+        tracked.files = currentFiles;
+        tracked.urgent = currentUrgent;
+        processes.insert(key, tracked);
+    }
+    // All direct: the process lives on this thread and is waited on here
+    QObject::connect(&process, &QProcess::started, [this, key]() {
+        QMutexLocker locker(&mutex);
+        auto it = processes.find(key);
+        if (it == processes.end()) {
+            return;
+        }
+        it->pid = key->processId();
+        bool cancelled = batchCancelled;
+        for (const QString &file : it->files) {
+            cancelled = cancelled || cancelledFiles.contains(file);
+        }
+        if (cancelled) {
+            stopProcess(it->pid, SIGKILL);
+        } else if (urgentJobs > 0 && !it->urgent) {
+            stopProcess(it->pid, SIGSTOP);
+            it->suspended = true;
+        }
+    });
+    auto forget = [this, key]() {
+        QMutexLocker locker(&mutex);
+        processes.remove(key);
+    };
+    QObject::connect(&process, &QProcess::finished, forget);
+    QObject::connect(&process, &QObject::destroyed, forget);
+}
+
+bool JobScheduler::isSuspended(qint64 pid) const {
+    QMutexLocker locker(&mutex);
+    for (const TrackedProcess &process : processes) {
+        if (process.pid == pid) {
+            return process.suspended;
+        }
+    }
+    return false;
+}
+
+bool JobScheduler::waitForFinished(QProcess &process, int msecs) {
+    if (!process.waitForStarted()) {
+        return false;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    qint64 suspendedMs = 0;
+    while (process.state() != QProcess::NotRunning) {
+        QElapsedTimer step;
+        step.start();
+        if (process.waitForFinished(500)) {
+            return true;
+        }
+        if (isSuspended(process.processId())) {
+            suspendedMs += step.elapsed();
+        }
+        if (timer.elapsed() - suspendedMs > msecs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void JobScheduler::beginUrgent() {
+    QMutexLocker locker(&mutex);
+    if (urgentJobs++ > 0) {
+        return;
+    }
+    for (TrackedProcess &process : processes) {
+        if (!process.urgent && !process.suspended && process.pid > 0) {
+            stopProcess(process.pid, SIGSTOP);
+            process.suspended = true;
+        }
+    }
+}
+
+void JobScheduler::endUrgent() {
+    QMutexLocker locker(&mutex);
+    if (--urgentJobs > 0) {
+        return;
+    }
+    for (TrackedProcess &process : processes) {
+        if (process.suspended) {
+            stopProcess(process.pid, SIGCONT);
+            process.suspended = false;
+        }
+    }
+}
+
+void JobScheduler::stopProcess(qint64 pid, int signal) {
+    if (pid > 0 && ::kill(pid_t(pid), signal) != 0) {
+        qDebug() << "JobScheduler: Cannot signal process" << pid;
+    }
+}
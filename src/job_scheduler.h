@@ -0,0 +1,116 @@
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+class QProcess;
+class QRunnable;
+class QThreadPool;
+
+// Set once and shared by everything working on one file.
+class CancellationToken {
+public:
+    CancellationToken() : state(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() { state->store(true); }
+    bool isCancelled() const { return state->load(); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> state;
+};
+
+// Marks the calling thread as working on these device files until it goes
+// out of scope. Processes the thread starts belong to them, so cancelling
+// a file kills its processes; an urgent scope suspends every process that
+// belongs to background work until it ends.
+class JobScope {
+public:
+    JobScope(const QStringList &files, bool urgent);
+    ~JobScope();
+
+private:
+    QStringList previousFiles;
+    bool previousUrgent;
+    bool urgent;
+};
+
+// Orders a batch of device files: files the operator selects while the
+// batch runs (promote) jump ahead of it, for transfer and for conversion.
+// Conversions sit on thread pools until they start, so a promoted one can
+// still be taken out and run straight away. Every external tool started
+// through track() can be suspended (SIGSTOP) while urgent work runs, and
+// is killed when its file or the batch is cancelled.
+class JobScheduler {
+public:
+    static JobScheduler *instance();
+
+    void startBatch(const QStringList &files);
+    void finishBatch();
+    bool isBatchRunning() const;
+    bool isBatchCancelled() const;
+
+    // Next files to transfer. A promoted file comes alone, with *urgent set.
+    QStringList takeSlice(int maxFiles, bool *urgent);
+    // Puts files of an interrupted slice back at the front.
+    void requeue(const QStringList &files);
+
+    void promote(const QStringList &files);
+    bool isPromoted(const QString &file) const;
+    void cancel(const QStringList &files);
+    void cancelAll();
+    bool isCancelled(const QString &file) const;
+    CancellationToken token(const QString &file);
+
+    // Queues a conversion of one device file on pool.
+    void submit(QThreadPool *pool, const QString &file, const std::function<void()> &task);
+    // Takes a promoted conversion that hasn't started off its pool.
+    bool takePromotedTask(QString *file, std::function<void()> *task);
+
+    // Follows an external tool started on this thread (call before start()).
+    void track(QProcess &process);
+    bool isSuspended(qint64 pid) const;
+    // waitForFinished() that doesn't count time spent suspended.
+    bool waitForFinished(QProcess &process, int msecs);
+
+private:
+    friend class JobScope;
+
+    struct TrackedProcess {
+        qint64 pid = 0;
+        QStringList files;
+        bool urgent = false;
+        bool suspended = false;
+    };
+    struct QueuedTask {
+        QThreadPool *pool = nullptr;
+        QRunnable *runnable = nullptr;
+        std::function<void()> task;
+    };
+
+    JobScheduler() = default;
+
+    mutable QMutex mutex;
+    QStringList pending;
+    QStringList promoted;
+    QSet<QString> promotedFiles;
+    QSet<QString> cancelledFiles;
+    QHash<QString, CancellationToken> tokens;
+    QHash<QString, QueuedTask> queuedTasks;
+    QHash<QProcess *, TrackedProcess> processes;
+    bool batchRunning = false;
+    bool batchCancelled = false;
+    int urgentJobs = 0;
+
+    void beginUrgent();
+    void endUrgent();
+    void stopProcess(qint64 pid, int signal);
+};
+
+#endif // JOB_SCHEDULER_H
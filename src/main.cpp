@@ -1,10 +1,30 @@
 #include "mainwindow.h"
+#include "command_line_tools.h"
+#include "metrics.h"
+#include "session_recorder.h"
 #include <QApplication>
+#include <QSettings>
 
 int main(int argc, char *argv[])
 {
+    if (CommandLineTools::isToolInvocation(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        if (!CommandLineTools::applyGlobalOptions(app.arguments())) {
+            return 1;
+        }
+        return CommandLineTools::run(app.arguments());
+    }
+
     QApplication app(argc, argv);
+    if (!CommandLineTools::applyGlobalOptions(app.arguments())) {
+        return 1;
+    }
+    MetricsRegistry::instance()->startExport();
+    const QString recordPath = QSettings().value("session/recordPath").toString();
+    if (!recordPath.isEmpty() && !SessionRecorder::instance()->isRecording()) {
+        SessionRecorder::instance()->start(recordPath);
+    }
     MainWindow w;
     w.show();
     return app.exec();
-} 
\ No newline at end of file
+}
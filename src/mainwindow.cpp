@@ -8,10 +8,17 @@
 #include <QSettings>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QDateTime>
 #include <QDebug>
 #include <QCoreApplication>
+#include <QTimer>
+#include "clustering.h"
+#include "fanout_writer.h"
+#include "job_scheduler.h"
+#include "media_types.h"
+#include "metrics.h"
 #include <algorithm>
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
@@ -24,6 +31,16 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     connect(deviceController, &SwiftWrapper::deviceConnected, this, &MainWindow::onDeviceConnected);
     connect(deviceController, &SwiftWrapper::deviceDisconnected, this, &MainWindow::onDeviceDisconnected);
     connect(deviceController, &SwiftWrapper::fileListReady, this, &MainWindow::onFileListReceived);
+    connect(deviceController, &SwiftWrapper::conversionProgress, this, &MainWindow::onConversionProgress);
+    connect(deviceController, &SwiftWrapper::capturePointsChanged, this, [this]() {
+        updateEventGroups();
+        filterFilesByType();
+    });
+    
+    // Progress bars follow the batch gauges in the metrics registry
+    QTimer *progressTimer = new QTimer(this);
+    connect(progressTimer, &QTimer::timeout, this, &MainWindow::updateProgressBars);
+    progressTimer->start(250);
     
     // Start device discovery
     deviceController->startDeviceDiscovery();
@@ -40,11 +57,12 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 }
 
 MainWindow::~MainWindow() {
-    // Clean up temporary directory
-    if (!tempDirectory.isEmpty()) {
-        QDir tempDir(tempDirectory);
-        if (tempDir.exists()) {
-            tempDir.removeRecursively();
+    // A running batch stops at its next file. Device reads wait on the main
+    // run loop, so it keeps spinning until the batch has let go.
+    if (batchThread) {
+        JobScheduler::instance()->cancelAll();
+        while (!batchThread->wait(50)) {
+            QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
         }
     }
 }
@@ -74,6 +92,20 @@ void MainWindow::setupUi() {
     connect(refreshButton, &QPushButton::clicked, this, &MainWindow::onRefreshClicked);
     tableControlsLayout->addWidget(refreshButton);
     
+    // Catalog search
+    searchEdit = new QLineEdit(this);
+    searchEdit->setPlaceholderText("Search (e.g. IMG_15 type:video size>100MB date:2024-07)");
+    searchEdit->setClearButtonEnabled(true);
+    connect(searchEdit, &QLineEdit::textChanged, this, &MainWindow::onSearchTextChanged);
+    tableControlsLayout->addWidget(searchEdit, 1);
+    
+    // Events found by clustering the capture dates
+    groupFilterComboBox = new QComboBox(this);
+    groupFilterComboBox->addItem("All Events");
+    connect(groupFilterComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onFileTypeFilterChanged);
+    tableControlsLayout->addWidget(groupFilterComboBox);
+    
     // Column visibility controls
     columnGroupBox = new QGroupBox("Columns", this);
     QHBoxLayout *columnLayout = new QHBoxLayout(columnGroupBox);
@@ -116,6 +148,7 @@ void MainWindow::setupUi() {
     QHBoxLayout *progressLayout = new QHBoxLayout();
     transferProgress = new QProgressBar(this);
     transferProgress->setVisible(false);
+    transferProgress->setFormat("Transfer %v/%m");
     conversionProgress = new QProgressBar(this);
     conversionProgress->setVisible(false);
     conversionProgress->setValue(0);
@@ -145,8 +178,14 @@ void MainWindow::setupConversionUI() {
     conversionLayout->addWidget(outputDirectoryEdit);
     
     // Connect text changed to update output directory
+    // Several destinations separated by ';' are all written in one pass
     connect(outputDirectoryEdit, &QLineEdit::textChanged, [this](const QString &text) {
-        if (!text.isEmpty() && QDir(text).exists()) {
+        const QStringList destinations = FanoutWriter::splitDestinations(text);
+        bool allExist = !destinations.isEmpty();
+        for (const QString &destination : destinations) {
+            allExist = allExist && QDir(destination).exists();
+        }
+        if (allExist) {
             outputDirectory = text;
             logMessage(QString("Output directory set to: %1").arg(text));
             
@@ -171,6 +210,17 @@ void MainWindow::setupConversionUI() {
             this, &MainWindow::onFileTypeFilterChanged);
     conversionLayout->addWidget(fileTypeFilterComboBox);
     
+    // Import priority: how much CPU and disk the conversion batch may take
+    conversionLayout->addWidget(new QLabel("Mode:", this));
+    priorityComboBox = new QComboBox(this);
+    priorityComboBox->addItem("Background", int(ImportPriority::Background));
+    priorityComboBox->addItem("Foreground", int(ImportPriority::Foreground));
+    priorityComboBox->addItem("Turbo", int(ImportPriority::Turbo));
+    priorityComboBox->setCurrentIndex(priorityComboBox->findData(int(ResourceGovernor::instance()->priority())));
+    connect(priorityComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onPriorityChanged);
+    conversionLayout->addWidget(priorityComboBox);
+    
     convertSelectedButton = new QPushButton("Convert Selected", this);
     convertSelectedButton->setEnabled(false);
     connect(convertSelectedButton, &QPushButton::clicked, this, &MainWindow::onConvertSelectedClicked);
@@ -181,6 +231,24 @@ void MainWindow::setupConversionUI() {
     connect(convertAllButton, &QPushButton::clicked, this, &MainWindow::onConvertAllClicked);
     conversionLayout->addWidget(convertAllButton);
     
+    // While a batch runs, Prioritize (or double-clicking a file) moves the
+    // selected files to the front and the cancel buttons drop them
+    prioritizeButton = new QPushButton("Prioritize", this);
+    prioritizeButton->setEnabled(false);
+    connect(prioritizeButton, &QPushButton::clicked, this, &MainWindow::onPrioritizeClicked);
+    conversionLayout->addWidget(prioritizeButton);
+    
+    cancelSelectedButton = new QPushButton("Cancel Selected", this);
+    cancelSelectedButton->setEnabled(false);
+    connect(cancelSelectedButton, &QPushButton::clicked, this, &MainWindow::onCancelSelectedClicked);
+    conversionLayout->addWidget(cancelSelectedButton);
+    
+    cancelAllButton = new QPushButton("Cancel All", this);
+    cancelAllButton->setEnabled(false);
+    connect(cancelAllButton, &QPushButton::clicked, this, &MainWindow::onCancelAllClicked);
+    conversionLayout->addWidget(cancelAllButton);
+    connect(fileTableWidget, &QTableWidget::itemDoubleClicked, this, &MainWindow::onFileDoubleClicked);
+    
     // Add conversion layout to main layout
     QWidget *central = qobject_cast<QWidget*>(centralWidget());
     if (central) {
@@ -241,8 +309,8 @@ void MainWindow::onFileListReceived(const QStringList &fileList, const QStringLi
         fileTriples.append(qMakePair(fileList[i], qMakePair(sizeList[i], date)));
     }
     
-    // Sort by filename
-    std::sort(fileTriples.begin(), fileTriples.end(), [](const QPair<QString, QPair<QString, QString>> &a, const QPair<QString, QPair<QString, QString>> &b) {
+    // Sort by filename; same-named files keep their listing order
+    std::stable_sort(fileTriples.begin(), fileTriples.end(), [](const QPair<QString, QPair<QString, QString>> &a, const QPair<QString, QPair<QString, QString>> &b) {
         return a.first.toLower() < b.first.toLower();
     });
     
@@ -257,6 +325,9 @@ void MainWindow::onFileListReceived(const QStringList &fileList, const QStringLi
     }
 
     fileTableWidget->setRowCount(0);
+    catalogRows.clear();
+    QSet<QString> listedFiles;
+    QHash<QString, int> nameCounts;
     for (int i = 0; i < sortedList.size(); ++i) {
         const QString &filename = sortedList[i];
         const QString &filesize = sortedSizeList[i];
@@ -279,17 +350,60 @@ void MainWindow::onFileListReceived(const QStringList &fileList, const QStringLi
         fileTableWidget->setItem(row, 2, new QTableWidgetItem(filedate)); // Use date from Swift
         
         // Guess type from extension
-        QString ext = filename.section('.', -1).toLower();
         QString typeStr;
-        if (ext == "mov" || ext == "mp4" || ext == "m4v" || ext == "3gp")
+        switch (mediaKind(mediaTypeForPath(filename))) {
+        case MediaKind::Video:
             typeStr = "Video";
-        else if (ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "heic" || ext == "heif")
+            break;
+        case MediaKind::Image:
             typeStr = "Image";
-        else
+            break;
+        default:
             typeStr = "Other";
+            break;
+        }
         
         fileTableWidget->setItem(row, 3, new QTableWidgetItem(typeStr));
+        
+        // Keep the search index in step with the listing instead of rebuilding it
+        CatalogItem entry;
+        entry.filename = filename;
+        entry.type = typeStr;
+        bool sizeKnown = false;
+        entry.size = filesize.toLongLong(&sizeKnown);
+        if (!sizeKnown) {
+            entry.size = -1;
+        }
+        entry.timestamp = SwiftWrapper::parseListingDate(filedate);
+        entry.metadata = listingMetadata(entry);
+        
+        // Folders on the device can hold files of the same name, so each
+        // one is told apart by how many came before it in the listing
+        const QString key = filename + '\n' + QString::number(nameCounts[filename]++);
+        int id = catalogIds.value(key, -1);
+        if (id < 0) {
+            id = catalogIndex.add(entry);
+            catalogIds.insert(key, id);
+        } else {
+            const CatalogItem &known = catalogIndex.item(id);
+            if (known.size != entry.size || known.timestamp != entry.timestamp || known.type != entry.type) {
+                entry.metadata = withGroup(entry.metadata, groupOf(known.metadata));
+                catalogIndex.update(id, entry);
+            }
+        }
+        catalogRows.insert(id, row);
+        listedFiles.insert(key);
     }
+    
+    for (auto it = catalogIds.begin(); it != catalogIds.end();) {
+        if (!listedFiles.contains(it.key())) {
+            catalogIndex.remove(it.value());
+            it = catalogIds.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    updateEventGroups();
     updateTableColumns();
     filterFilesByType();
     
@@ -340,26 +454,17 @@ void MainWindow::onConvertSelectedClicked() {
         return;
     }
     
-    // Get selected rows
-    QSet<int> selectedRows;
-    for (QTableWidgetItem *item : fileTableWidget->selectedItems()) {
-        selectedRows.insert(item->row());
+    if (batchThread) {
+        logMessage("A conversion batch is already running");
+        return;
     }
     
-    if (selectedRows.isEmpty()) {
+    QStringList selectedFiles = selectedFileNames();
+    if (selectedFiles.isEmpty()) {
         QMessageBox::warning(this, "No Files Selected", "Please select files to convert.");
         return;
     }
     
-    // Get selected filenames
-    QStringList selectedFiles;
-    for (int row : selectedRows) {
-        QTableWidgetItem *filenameItem = fileTableWidget->item(row, 0);
-        if (filenameItem) {
-            selectedFiles.append(filenameItem->text());
-        }
-    }
-    
     qDebug() << "=== SWIFT DOWNLOAD START ===";
     qDebug() << "Output directory:" << outputDirectory;
     qDebug() << "Selected files:" << selectedFiles;
@@ -367,13 +472,11 @@ void MainWindow::onConvertSelectedClicked() {
     logMessage(QString("Starting Swift-based download of %1 selected files to %2...").arg(selectedFiles.size()).arg(outputDirectory));
     
     // Use Swift-based download
-    if (deviceController->downloadSelectedFiles(selectedFiles, outputDirectory, "Feeder")) {
-        logMessage("✓ Swift download initiated successfully");
-        statusLabel->setText("Status: Downloading selected files...");
-    } else {
-        logMessage("✗ Swift download failed to start");
-        statusLabel->setText("Status: Download failed");
-    }
+    statusLabel->setText("Status: Downloading selected files...");
+    const QString directory = outputDirectory;
+    startBatch([this, selectedFiles, directory]() {
+        return deviceController->downloadSelectedFiles(selectedFiles, directory, "Feeder");
+    }, "selected files");
 }
 
 void MainWindow::onConvertAllClicked() {
@@ -381,6 +484,10 @@ void MainWindow::onConvertAllClicked() {
         QMessageBox::warning(this, "No Output Directory", "Please select an output directory first.");
         return;
     }
+    if (batchThread) {
+        logMessage("A conversion batch is already running");
+        return;
+    }
     
     // Get all visible filenames
     QStringList allFiles;
@@ -405,13 +512,95 @@ void MainWindow::onConvertAllClicked() {
     logMessage(QString("Starting Swift-based download of all %1 files to %2...").arg(allFiles.size()).arg(outputDirectory));
     
     // Use Swift-based download for all files
-    if (deviceController->downloadAllFiles(outputDirectory, "Feeder")) {
-        logMessage("✓ Swift download all files initiated successfully");
-        statusLabel->setText("Status: Downloading all files...");
-    } else {
-        logMessage("✗ Swift download all files failed to start");
-        statusLabel->setText("Status: Download failed");
+    statusLabel->setText("Status: Downloading all files...");
+    const QString directory = outputDirectory;
+    startBatch([this, directory]() {
+        return deviceController->downloadAllFiles(directory, "Feeder");
+    }, "all files");
+}
+
+QStringList MainWindow::selectedFileNames() const {
+    QSet<int> selectedRows;
+    for (QTableWidgetItem *item : fileTableWidget->selectedItems()) {
+        selectedRows.insert(item->row());
+    }
+    
+    QStringList selectedFiles;
+    for (int row : selectedRows) {
+        QTableWidgetItem *filenameItem = fileTableWidget->item(row, 0);
+        if (filenameItem) {
+            selectedFiles.append(filenameItem->text());
+        }
+    }
+    return selectedFiles;
+}
+
+void MainWindow::startBatch(const std::function<bool()> &download, const QString &description) {
+    // The batch runs off the UI thread so files can be promoted or
+    // cancelled while it transfers and converts
+    setBatchRunning(true);
+    batchThread = QThread::create([this, download, description]() {
+        const bool success = download();
+        QMetaObject::invokeMethod(this, [this, success, description]() {
+            batchThread->wait();
+            batchThread = nullptr;
+            setBatchRunning(false);
+            if (success) {
+                logMessage(QString("✓ Swift download of %1 finished").arg(description));
+                statusLabel->setText("Status: Conversion complete");
+            } else {
+                logMessage(QString("✗ Swift download of %1 failed or was cancelled").arg(description));
+                statusLabel->setText("Status: Download failed");
+            }
+        }, Qt::QueuedConnection);
+    });
+    connect(batchThread, &QThread::finished, batchThread, &QObject::deleteLater);
+    batchThread->start();
+}
+
+void MainWindow::setBatchRunning(bool running) {
+    refreshButton->setEnabled(!running);
+    convertSelectedButton->setEnabled(!running);
+    convertAllButton->setEnabled(!running);
+    prioritizeButton->setEnabled(running);
+    cancelSelectedButton->setEnabled(running);
+    cancelAllButton->setEnabled(running);
+}
+
+void MainWindow::onCancelSelectedClicked() {
+    const QStringList files = selectedFileNames();
+    if (!batchThread || files.isEmpty()) {
+        return;
+    }
+    JobScheduler::instance()->cancel(files);
+    logMessage(QString("Cancelled %1 files").arg(files.size()));
+}
+
+void MainWindow::onCancelAllClicked() {
+    if (!batchThread) {
+        return;
     }
+    JobScheduler::instance()->cancelAll();
+    logMessage("Cancelling the batch");
+    statusLabel->setText("Status: Cancelling...");
+}
+
+void MainWindow::onPrioritizeClicked() {
+    const QStringList files = selectedFileNames();
+    if (!batchThread || files.isEmpty()) {
+        return;
+    }
+    JobScheduler::instance()->promote(files);
+    logMessage(QString("Prioritized %1 files").arg(files.size()));
+}
+
+void MainWindow::onFileDoubleClicked(QTableWidgetItem *item) {
+    QTableWidgetItem *filenameItem = item ? fileTableWidget->item(item->row(), 0) : nullptr;
+    if (!batchThread || !filenameItem) {
+        return;
+    }
+    JobScheduler::instance()->promote(QStringList() << filenameItem->text());
+    logMessage(QString("Prioritized %1").arg(filenameItem->text()));
 }
 
 void MainWindow::onBrowseOutputClicked() {
@@ -455,34 +644,168 @@ void MainWindow::onFileTypeFilterChanged() {
     filterFilesByType();
 }
 
+void MainWindow::onPriorityChanged() {
+    ImportPriority priority = ImportPriority(priorityComboBox->currentData().toInt());
+    ResourceGovernor::instance()->setPriority(priority);
+    QSettings settings;
+    settings.setValue("importPriority", ResourceGovernor::name(priority));
+    ResourceBudget budget = ResourceGovernor::instance()->budget();
+    logMessage(QString("Import mode: %1 (%2 workers%3)")
+               .arg(priorityComboBox->currentText())
+               .arg(budget.workers)
+               .arg(budget.maxBytesPerSecond > 0
+                    ? QString(", %1 MB/s").arg(budget.maxBytesPerSecond >> 20) : QString()));
+}
+
+void MainWindow::updateProgressBars() {
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    qint64 transferTotal = metrics->gauge("feeder_batch_transfer_files", "Files requested in the current batch.")->value();
+    qint64 transferred = metrics->gauge("feeder_batch_transferred_files", "Files transferred in the current batch.")->value();
+    transferProgress->setVisible(transferTotal > 0 && transferred < transferTotal);
+    transferProgress->setRange(0, int(qMax<qint64>(1, transferTotal)));
+    transferProgress->setValue(int(transferred));
+    
+    // Whole files done plus the share of the video being encoded right now
+    qint64 conversionTotal = metrics->gauge("feeder_batch_conversion_files", "Conversions queued in the current batch.")->value();
+    qint64 converted = metrics->gauge("feeder_batch_converted_files", "Conversions finished in the current batch.")->value();
+    conversionProgress->setVisible(conversionTotal > 0 && converted < conversionTotal);
+    conversionProgress->setRange(0, 1000);
+    conversionProgress->setValue(conversionTotal > 0
+        ? int(1000 * qMin(1.0, (converted + currentJobFraction) / double(conversionTotal))) : 0);
+}
+
+void MainWindow::onConversionProgress(const TranscodeProgress &progress) {
+    currentJobFraction = progress.finished ? 0.0 : progress.fraction();
+    updateProgressBars();
+    
+    QString eta = progress.etaSeconds >= 0
+        ? QString("%1:%2").arg(int(progress.etaSeconds) / 60).arg(int(progress.etaSeconds) % 60, 2, 10, QChar('0'))
+        : QString("--:--");
+    conversionProgress->setFormat(QString("Converting %1 %p%").arg(progress.jobName));
+    statusLabel->setText(QString("Status: Converting %1 - %2 fps, %3x, ETA %4")
+                         .arg(progress.jobName)
+                         .arg(progress.fps, 0, 'f', 1)
+                         .arg(progress.speed, 0, 'f', 2)
+                         .arg(eta));
+    
+    if (progress.finished) {
+        logMessage(QString("Converted %1 (%2 s of video at %3x)")
+                   .arg(progress.jobName)
+                   .arg(progress.encodedSeconds, 0, 'f', 1)
+                   .arg(progress.speed, 0, 'f', 2));
+    }
+}
+
+void MainWindow::onSearchTextChanged() {
+    filterFilesByType();
+}
+
 void MainWindow::filterFilesByType() {
     QString filterText = fileTypeFilterComboBox->currentText();
+    CatalogQuery query = CatalogQuery::parse(searchEdit->text());
     
-    for (int row = 0; row < fileTableWidget->rowCount(); ++row) {
-        QTableWidgetItem *typeItem = fileTableWidget->item(row, 3); // Type column
-        if (!typeItem) continue;
-        
-        QString fileType = typeItem->text().toLower();
-        bool showRow = true;
-        
-        if (filterText == "Videos Only") {
-            showRow = fileType == "video";
-        } else if (filterText == "Images Only") {
-            showRow = fileType == "image";
+    if (filterText == "Videos Only") {
+        query.type = "video";
+    } else if (filterText == "Images Only") {
+        query.type = "image";
+    }
+    // "All Files" keeps whatever the search box asked for
+    if (groupFilterComboBox->currentIndex() > 0) {
+        query.group = groupFilterComboBox->currentText().toLower();
+    }
+    
+    int rowCount = fileTableWidget->rowCount();
+    QVector<bool> visible(rowCount, query.isEmpty());
+    if (!query.isEmpty()) {
+        for (int id : catalogIndex.search(query)) {
+            int row = catalogRows.value(id, -1);
+            if (row >= 0 && row < rowCount) {
+                visible[row] = true;
+            }
         }
-        // "All Files" shows everything
-        
-        fileTableWidget->setRowHidden(row, !showRow);
     }
     
-    // Update button states based on visible files
+    // Only touch rows whose visibility actually changes
     int visibleFiles = 0;
-    for (int row = 0; row < fileTableWidget->rowCount(); ++row) {
-        if (!fileTableWidget->isRowHidden(row)) {
+    fileTableWidget->setUpdatesEnabled(false);
+    for (int row = 0; row < rowCount; ++row) {
+        if (fileTableWidget->isRowHidden(row) == visible[row]) {
+            fileTableWidget->setRowHidden(row, !visible[row]);
+        }
+        if (visible[row]) {
             visibleFiles++;
         }
     }
+    fileTableWidget->setUpdatesEnabled(true);
     
     convertAllButton->setEnabled(visibleFiles > 0);
     convertSelectedButton->setEnabled(visibleFiles > 0);
-} 
\ No newline at end of file
+}
+
+void MainWindow::updateEventGroups() {
+    // Same facts and clustering as the events output layout: listing dates
+    // at first, EXIF dates and GPS for files already downloaded
+    QVector<MediaGroup> groups;
+    const QHash<QString, QString> events = SwiftWrapper::eventNames(deviceController->capturePoints(), &groups);
+    for (int id : catalogIds) {
+        const CatalogItem &known = catalogIndex.item(id);
+        const QString metadata = withGroup(known.metadata, events.value(known.filename));
+        if (known.metadata != metadata) {
+            CatalogItem entry = known;
+            entry.metadata = metadata;
+            catalogIndex.update(id, entry);
+        }
+    }
+    
+    // Newest events first, keeping the current selection when it survives
+    std::sort(groups.begin(), groups.end(), [](const MediaGroup &a, const MediaGroup &b) {
+        return a.start > b.start;
+    });
+    QString selected = groupFilterComboBox->currentIndex() > 0 ? groupFilterComboBox->currentText() : QString();
+    groupFilterComboBox->blockSignals(true);
+    groupFilterComboBox->clear();
+    groupFilterComboBox->addItem("All Events");
+    for (const MediaGroup &group : groups) {
+        groupFilterComboBox->addItem(group.name);
+    }
+    groupFilterComboBox->setCurrentIndex(qMax(0, groupFilterComboBox->findText(selected)));
+    groupFilterComboBox->blockSignals(false);
+}
+
+QString MainWindow::listingMetadata(const CatalogItem &item) {
+    // Free-text facts the search box should find: the extension and the
+    // capture date spelled out, so "august" or "sunday" match
+    QStringList lines;
+    const QString suffix = QFileInfo(item.filename).suffix().toLower();
+    if (!suffix.isEmpty()) {
+        lines << suffix;
+    }
+    if (item.timestamp >= 0) {
+        const QDateTime captured = QDateTime::fromMSecsSinceEpoch(item.timestamp);
+        lines << captured.toString("yyyy-MM-dd MMMM dddd").toLower();
+    }
+    return lines.join('\n');
+}
+
+QString MainWindow::groupOf(const QString &metadata) {
+    for (const QString &line : metadata.split('\n')) {
+        if (line.startsWith("group:")) {
+            return line.mid(6);
+        }
+    }
+    return QString();
+}
+
+QString MainWindow::withGroup(const QString &metadata, const QString &group) {
+    QStringList lines;
+    for (const QString &line : metadata.split('\n', Qt::SkipEmptyParts)) {
+        if (!line.startsWith("group:")) {
+            lines << line;
+        }
+    }
+    if (!group.isEmpty()) {
+        lines << "group:" + group;
+    }
+    return lines.join('\n');
+}
+
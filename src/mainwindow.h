@@ -1,5 +1,7 @@
 #pragma once
 #include "swift_wrapper.h"
+#include "catalog_index.h"
+#include "resource_governor.h"
 #include <QMainWindow>
 #include <QTextEdit>
 #include <QLabel>
@@ -13,6 +15,9 @@
 #include <QProcess>
 #include <QQueue>
 #include <QSettings>
+#include <QHash>
+#include <QThread>
+#include <functional>
 
 class DeviceController;
 
@@ -33,9 +38,15 @@ private:
     QPushButton *refreshButton;
     QPushButton *convertSelectedButton;
     QPushButton *convertAllButton;
+    QPushButton *prioritizeButton;
+    QPushButton *cancelSelectedButton;
+    QPushButton *cancelAllButton;
     QPushButton *browseOutputButton;
     QComboBox *fileTypeFilterComboBox;
+    QComboBox *priorityComboBox;
+    QComboBox *groupFilterComboBox;
     QLineEdit *outputDirectoryEdit;
+    QLineEdit *searchEdit;
     QTableWidget *fileTableWidget;
     QGroupBox *columnGroupBox;
     QCheckBox *filenameCheck;
@@ -44,7 +55,11 @@ private:
     QCheckBox *typeCheck;
                 SwiftWrapper *deviceController;
     QString outputDirectory;
-    QString tempDirectory;
+    QThread *batchThread = nullptr;
+    double currentJobFraction = 0.0;
+    CatalogIndex catalogIndex;
+    QHash<QString, int> catalogIds;   // filename + "\n" + occurrence -> catalog id
+    QHash<int, int> catalogRows;      // catalog id -> table row
     void setupUi();
     void setupTemplatePrompts();
     void saveLogToFile(const QString &msg);
@@ -52,6 +67,13 @@ private:
     void updateTableColumns();
     void setupConversionUI();
     void filterFilesByType();
+    void updateEventGroups();
+    static QString listingMetadata(const CatalogItem &item);
+    static QString groupOf(const QString &metadata);
+    static QString withGroup(const QString &metadata, const QString &group);
+    QStringList selectedFileNames() const;
+    void startBatch(const std::function<bool()> &download, const QString &description);
+    void setBatchRunning(bool running);
 
 private slots:
     void onDeviceConnected(const QString &deviceName);
@@ -61,6 +83,14 @@ private slots:
     void onColumnCheckChanged();
     void onConvertSelectedClicked();
     void onConvertAllClicked();
+    void onCancelSelectedClicked();
+    void onCancelAllClicked();
+    void onPrioritizeClicked();
+    void onFileDoubleClicked(QTableWidgetItem *item);
     void onBrowseOutputClicked();
     void onFileTypeFilterChanged();
+    void onSearchTextChanged();
+    void onPriorityChanged();
+    void updateProgressBars();
+    void onConversionProgress(const TranscodeProgress &progress);
 }; 
\ No newline at end of file
@@ -0,0 +1,287 @@
+#ifndef MEDIA_TYPES_H
+#define MEDIA_TYPES_H
+
+#include <QFile>
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// One registry of every media type Feeder knows about. Extension lookup is
+// a perfect hash whose seed is found at compile time, so classifying a
+// filename costs one hash and one compare, without allocating.
+
+enum class MediaType : std::uint8_t {
+    Unknown,
+    Jpeg,
+    Heic,
+    Png,
+    Tiff,
+    Gif,
+    Dng,
+    Avif,
+    JpegXl,
+    WebP,
+    Mov,
+    Mp4,
+    M4v,
+    ThreeGp,
+    Avi,
+    Count
+};
+
+enum class MediaKind : std::uint8_t {
+    Other,
+    Image,
+    Video
+};
+
+struct MediaTypeInfo {
+    MediaType type;
+    MediaKind kind;
+    std::string_view name;        // canonical extension
+};
+
+constexpr MediaTypeInfo mediaTypeInfos[] = {
+    {MediaType::Unknown, MediaKind::Other, ""},
+    {MediaType::Jpeg, MediaKind::Image, "jpg"},
+    {MediaType::Heic, MediaKind::Image, "heic"},
+    {MediaType::Png, MediaKind::Image, "png"},
+    {MediaType::Tiff, MediaKind::Image, "tif"},
+    {MediaType::Gif, MediaKind::Image, "gif"},
+    {MediaType::Dng, MediaKind::Image, "dng"},
+    {MediaType::Avif, MediaKind::Image, "avif"},
+    {MediaType::JpegXl, MediaKind::Image, "jxl"},
+    {MediaType::WebP, MediaKind::Image, "webp"},
+    {MediaType::Mov, MediaKind::Video, "mov"},
+    {MediaType::Mp4, MediaKind::Video, "mp4"},
+    {MediaType::M4v, MediaKind::Video, "m4v"},
+    {MediaType::ThreeGp, MediaKind::Video, "3gp"},
+    {MediaType::Avi, MediaKind::Video, "avi"},
+};
+static_assert(sizeof(mediaTypeInfos) / sizeof(mediaTypeInfos[0]) == std::size_t(MediaType::Count),
+              "mediaTypeInfos must list every MediaType in order");
+
+constexpr const MediaTypeInfo &mediaTypeInfo(MediaType type) {
+    return mediaTypeInfos[std::size_t(type) < std::size_t(MediaType::Count) ? std::size_t(type) : 0];
+}
+
+constexpr MediaKind mediaKind(MediaType type) {
+    return mediaTypeInfo(type).kind;
+}
+
+namespace media_types_detail {
+
+struct ExtensionEntry {
+    std::string_view extension;
+    MediaType type;
+};
+
+constexpr ExtensionEntry extensions[] = {
+    {"jpg", MediaType::Jpeg}, {"jpeg", MediaType::Jpeg}, {"jpe", MediaType::Jpeg},
+    {"heic", MediaType::Heic}, {"heif", MediaType::Heic}, {"hif", MediaType::Heic},
+    {"png", MediaType::Png},
+    {"tif", MediaType::Tiff}, {"tiff", MediaType::Tiff},
+    {"gif", MediaType::Gif},
+    {"dng", MediaType::Dng},
+    {"avif", MediaType::Avif},
+    {"jxl", MediaType::JpegXl},
+    {"webp", MediaType::WebP},
+    {"mov", MediaType::Mov}, {"qt", MediaType::Mov},
+    {"mp4", MediaType::Mp4},
+    {"m4v", MediaType::M4v},
+    {"3gp", MediaType::ThreeGp},
+    {"avi", MediaType::Avi},
+};
+constexpr std::size_t extensionCount = sizeof(extensions) / sizeof(extensions[0]);
+constexpr std::size_t maxExtensionLength = 4;
+constexpr std::size_t slotCount = 64;
+
+constexpr char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// FNV-1a over the lowercased extension, perturbed by seed
+constexpr std::uint32_t hash(std::string_view extension, std::uint32_t seed) {
+    std::uint32_t h = 2166136261u ^ seed;
+    for (char c : extension) {
+        h = (h ^ std::uint8_t(lower(c))) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+constexpr std::uint32_t findSeed() {
+    for (std::uint32_t seed = 0; seed < 100000; ++seed) {
+        bool used[slotCount] = {};
+        bool collision = false;
+        for (std::size_t i = 0; i < extensionCount && !collision; ++i) {
+            const std::size_t slot = hash(extensions[i].extension, seed) % slotCount;
+            collision = used[slot];
+            used[slot] = true;
+        }
+        if (!collision) {
+            return seed;
+        }
+    }
+    return ~0u;
+}
+
+constexpr std::uint32_t seed = findSeed();
+static_assert(seed != ~0u, "no collision-free seed for the extension table; grow slotCount");
+
+struct SlotTable {
+    std::int8_t slots[slotCount];
+};
+
+constexpr SlotTable buildSlots() {
+    SlotTable table = {};
+    for (std::size_t i = 0; i < slotCount; ++i) {
+        table.slots[i] = -1;
+    }
+    for (std::size_t i = 0; i < extensionCount; ++i) {
+        table.slots[hash(extensions[i].extension, seed) % slotCount] = std::int8_t(i);
+    }
+    return table;
+}
+
+constexpr SlotTable slotTable = buildSlots();
+
+constexpr bool equalsLower(std::string_view candidate, std::string_view extension) {
+    if (candidate.size() != extension.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < candidate.size(); ++i) {
+        if (lower(candidate[i]) != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace media_types_detail
+
+// Extension without the dot, any case.
+constexpr MediaType mediaTypeForExtension(std::string_view extension) {
+    using namespace media_types_detail;
+    if (extension.empty() || extension.size() > maxExtensionLength) {
+        return MediaType::Unknown;
+    }
+    const std::int8_t index = slotTable.slots[hash(extension, seed) % slotCount];
+    if (index < 0 || !equalsLower(extension, extensions[index].extension)) {
+        return MediaType::Unknown;
+    }
+    return extensions[index].type;
+}
+
+constexpr MediaType mediaTypeForFileName(std::string_view fileName) {
+    const std::size_t dot = fileName.rfind('.');
+    return dot == std::string_view::npos ? MediaType::Unknown : mediaTypeForExtension(fileName.substr(dot + 1));
+}
+
+static_assert(mediaTypeForFileName("IMG_0001.HEIC") == MediaType::Heic, "extension lookup");
+static_assert(mediaTypeForFileName("clip.mov") == MediaType::Mov, "extension lookup");
+static_assert(mediaTypeForFileName("notes.txt") == MediaType::Unknown, "extension lookup");
+
+// Identifies a file from its first bytes (32 are enough), independent of
+// its name.
+constexpr MediaType sniffMediaType(const unsigned char *data, std::size_t size) {
+    auto matches = [&](std::size_t offset, std::string_view magic) {
+        if (offset + magic.size() > size) {
+            return false;
+        }
+        for (std::size_t i = 0; i < magic.size(); ++i) {
+            if (data[offset + i] != std::uint8_t(magic[i])) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (matches(0, "\xFF\xD8\xFF")) {
+        return MediaType::Jpeg;
+    }
+    if (matches(0, "\x89PNG")) {
+        return MediaType::Png;
+    }
+    if (matches(0, "GIF8")) {
+        return MediaType::Gif;
+    }
+    if (matches(0, std::string_view("II*\0", 4)) || matches(0, std::string_view("MM\0*", 4))) {
+        return MediaType::Tiff;
+    }
+    if (matches(0, std::string_view("\xFF\x0A", 2)) || matches(4, "JXL ")) {
+        return MediaType::JpegXl;
+    }
+    if (matches(0, "RIFF") && matches(8, "WEBP")) {
+        return MediaType::WebP;
+    }
+    if (matches(0, "RIFF") && matches(8, "AVI ")) {
+        return MediaType::Avi;
+    }
+    // ISO-BMFF: the major brand of the leading ftyp box
+    if (matches(4, "ftyp") && size >= 12) {
+        for (std::string_view brand : {"heic", "heix", "mif1", "msf1", "hevc"}) {
+            if (matches(8, brand)) {
+                return MediaType::Heic;
+            }
+        }
+        if (matches(8, "avif") || matches(8, "avis")) {
+            return MediaType::Avif;
+        }
+        if (matches(8, "qt  ")) {
+            return MediaType::Mov;
+        }
+        if (matches(8, "M4V ") || matches(8, "M4VH")) {
+            return MediaType::M4v;
+        }
+        if (matches(8, "3gp")) {
+            return MediaType::ThreeGp;
+        }
+        return MediaType::Mp4;
+    }
+    // Old QuickTime files open with a moov, wide or mdat atom instead
+    if (matches(4, "moov") || matches(4, "wide") || matches(4, "mdat")) {
+        return MediaType::Mov;
+    }
+    return MediaType::Unknown;
+}
+
+inline MediaType mediaTypeForPath(const QString &fileName) {
+    const int dot = fileName.lastIndexOf('.');
+    if (dot < 0 || fileName.size() - dot - 1 > int(media_types_detail::maxExtensionLength)) {
+        return MediaType::Unknown;
+    }
+    char extension[media_types_detail::maxExtensionLength];
+    std::size_t length = 0;
+    for (int i = dot + 1; i < fileName.size(); ++i) {
+        const QChar c = fileName[i];
+        if (c.unicode() > 127) {
+            return MediaType::Unknown;
+        }
+        extension[length++] = char(c.unicode());
+    }
+    return mediaTypeForExtension(std::string_view(extension, length));
+}
+
+// Sniffs the file's contents and falls back to its extension.
+inline MediaType mediaTypeOfFile(const QString &path) {
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly)) {
+        unsigned char header[32];
+        const qint64 read = file.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (read > 0) {
+            const MediaType sniffed = sniffMediaType(header, std::size_t(read));
+            if (sniffed != MediaType::Unknown) {
+                return sniffed;
+            }
+        }
+    }
+    return mediaTypeForPath(path);
+}
+
+inline QString mediaTypeName(MediaType type) {
+    const std::string_view name = mediaTypeInfo(type).name;
+    return QString::fromLatin1(name.data(), int(name.size()));
+}
+
+#endif // MEDIA_TYPES_H
@@ -0,0 +1,197 @@
+#include "memory_budget.h"
+#include "metrics.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <QSettings>
+#include <utility>
+
+namespace {
+
+const qint64 defaultStageMegabytes[] = {
+    256,    // Transfer
+    512,    // Decode
+    256,    // Encode
+    128,    // Write
+};
+static_assert(sizeof(defaultStageMegabytes) / sizeof(defaultStageMegabytes[0]) == std::size_t(MemoryStage::Count),
+              "defaultStageMegabytes must list every MemoryStage in order");
+
+} // namespace
+
+MemoryBudget *MemoryBudget::instance() {
+    static MemoryBudget budget;
+    return &budget;
+}
+
+MemoryBudget::MemoryBudget() {
+    QSettings settings;
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    for (std::size_t i = 0; i < stageCount; ++i) {
+        const MemoryStage stage = MemoryStage(i);
+        const QString key = QString("memory/%1MB").arg(stageName(stage));
+        limits[i] = qMax<qint64>(1, settings.value(key, defaultStageMegabytes[i]).toLongLong()) << 20;
+        stageGauges[i] = metrics->gauge(QString("feeder_memory_bytes{stage=\"%1\"}").arg(stageName(stage)),
+                                        "Bytes held by each pipeline stage.");
+    }
+    totalLimit = qMax<qint64>(1, settings.value("memory/totalMB", 1024).toLongLong()) << 20;
+    poolLimit = qMax<qint64>(0, settings.value("memory/poolMB", 64).toLongLong()) << 20;
+    totalGauge = metrics->gauge("feeder_memory_total_bytes", "Bytes held by the pipeline.");
+    peakGauge = metrics->gauge("feeder_memory_peak_bytes", "Most bytes the pipeline has held at once.");
+}
+
+const char *MemoryBudget::stageName(MemoryStage stage) {
+    switch (stage) {
+    case MemoryStage::Transfer: return "transfer";
+    case MemoryStage::Decode: return "decode";
+    case MemoryStage::Encode: return "encode";
+    case MemoryStage::Write: return "write";
+    case MemoryStage::Count: break;
+    }
+    return "unknown";
+}
+
+bool MemoryBudget::fits(MemoryStage stage, qint64 bytes) const {
+    // An oversized request goes through once there is nothing else in its
+    // way, so it can't wait forever, but it never pushes the total over
+    // while other stages hold memory
+    const std::size_t i = std::size_t(stage);
+    const bool stageRoom = used[i] == 0 || used[i] + bytes <= limits[i];
+    const bool totalRoom = total == 0 || total + bytes <= totalLimit;
+    return stageRoom && totalRoom;
+}
+
+void MemoryBudget::grant(MemoryStage stage, qint64 bytes) {
+    const std::size_t i = std::size_t(stage);
+    used[i] += bytes;
+    total += bytes;
+    stageGauges[i]->set(used[i]);
+    totalGauge->set(total);
+    if (total > peakBytes) {
+        peakBytes = total;
+        peakGauge->set(peakBytes);
+    }
+}
+
+void MemoryBudget::acquire(MemoryStage stage, qint64 bytes) {
+    if (bytes <= 0) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    while (!fits(stage, bytes)) {
+        released.wait(&mutex);
+    }
+    grant(stage, bytes);
+}
+
+bool MemoryBudget::tryAcquire(MemoryStage stage, qint64 bytes) {
+    if (bytes <= 0) {
+        return true;
+    }
+    QMutexLocker locker(&mutex);
+    if (!fits(stage, bytes)) {
+        return false;
+    }
+    grant(stage, bytes);
+    return true;
+}
+
+void MemoryBudget::release(MemoryStage stage, qint64 bytes) {
+    if (bytes <= 0) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    const std::size_t i = std::size_t(stage);
+    used[i] = qMax<qint64>(0, used[i] - bytes);
+    total = qMax<qint64>(0, total - bytes);
+    stageGauges[i]->set(used[i]);
+    totalGauge->set(total);
+    released.wakeAll();
+}
+
+qint64 MemoryBudget::limit(MemoryStage stage) const {
+    return limits[std::size_t(stage)];
+}
+
+qint64 MemoryBudget::inUse(MemoryStage stage) const {
+    QMutexLocker locker(&mutex);
+    return used[std::size_t(stage)];
+}
+
+qint64 MemoryBudget::totalInUse() const {
+    QMutexLocker locker(&mutex);
+    return total;
+}
+
+qint64 MemoryBudget::peak() const {
+    QMutexLocker locker(&mutex);
+    return peakBytes;
+}
+
+QByteArray MemoryBudget::takeBuffer(qint64 size) {
+    QMutexLocker locker(&poolMutex);
+    // Smallest idle buffer that is large enough
+    int best = -1;
+    for (int i = 0; i < idleBuffers.size(); ++i) {
+        const qint64 capacity = idleBuffers[i].capacity();
+        if (capacity >= size && (best < 0 || capacity < idleBuffers[best].capacity())) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        locker.unlock();
+        return QByteArray(int(size), Qt::Uninitialized);
+    }
+    QByteArray buffer = idleBuffers.takeAt(best);
+    idleBytes -= buffer.capacity();
+    buffer.resize(int(size));
+    return buffer;
+}
+
+void MemoryBudget::returnBuffer(QByteArray buffer) {
+    // A buffer still shared with someone else isn't ours to reuse
+    if (!buffer.isDetached() || buffer.capacity() == 0) {
+        return;
+    }
+    QMutexLocker locker(&poolMutex);
+    if (idleBytes + buffer.capacity() > poolLimit) {
+        return;
+    }
+    idleBytes += buffer.capacity();
+    idleBuffers.append(std::move(buffer));
+}
+
+MemoryReservation::MemoryReservation(MemoryStage stage, qint64 bytes) : stage(stage), held(qMax<qint64>(0, bytes)) {
+    MemoryBudget::instance()->acquire(stage, held);
+}
+
+MemoryReservation::~MemoryReservation() {
+    release();
+}
+
+MemoryReservation::MemoryReservation(MemoryReservation &&other) noexcept
+    : stage(other.stage), held(std::exchange(other.held, 0)) {
+}
+
+MemoryReservation &MemoryReservation::operator=(MemoryReservation &&other) noexcept {
+    if (this != &other) {
+        release();
+        stage = other.stage;
+        held = std::exchange(other.held, 0);
+    }
+    return *this;
+}
+
+void MemoryReservation::release() {
+    if (held > 0) {
+        MemoryBudget::instance()->release(stage, held);
+        held = 0;
+    }
+}
+
+PooledBuffer::PooledBuffer(MemoryStage stage, qint64 size)
+    : reservation(stage, size), buffer(MemoryBudget::instance()->takeBuffer(size)) {
+}
+
+PooledBuffer::~PooledBuffer() {
+    MemoryBudget::instance()->returnBuffer(std::move(buffer));
+}
@@ -0,0 +1,106 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <array>
+#include <cstddef>
+
+class Gauge;
+
+enum class MemoryStage {
+    Transfer,   // chunk buffers and stream rings
+    Decode,     // compressed inputs and decoded images
+    Encode,     // scaled renditions waiting to be written
+    Write,      // output queues
+    Count
+};
+
+// Process-wide byte budget ("memory/totalMB") split into per-stage limits
+// ("memory/transferMB", "memory/decodeMB", ...). acquire() blocks until
+// both the stage and the total have room, so a producer that runs ahead
+// waits for its consumers instead of growing the heap. A request larger
+// than its stage limit still goes through once the stage is otherwise
+// empty, and one larger than the total once nothing else is held.
+class MemoryBudget {
+public:
+    static MemoryBudget *instance();
+
+    void acquire(MemoryStage stage, qint64 bytes);
+    bool tryAcquire(MemoryStage stage, qint64 bytes);
+    void release(MemoryStage stage, qint64 bytes);
+
+    qint64 limit(MemoryStage stage) const;
+    qint64 inUse(MemoryStage stage) const;
+    qint64 totalInUse() const;
+    qint64 peak() const;
+
+    // Reusable buffers, so steady-state chunks don't go back to the allocator.
+    QByteArray takeBuffer(qint64 size);
+    void returnBuffer(QByteArray buffer);
+
+    static const char *stageName(MemoryStage stage);
+
+private:
+    static const std::size_t stageCount = std::size_t(MemoryStage::Count);
+
+    MemoryBudget();
+    bool fits(MemoryStage stage, qint64 bytes) const;
+    void grant(MemoryStage stage, qint64 bytes);
+
+    mutable QMutex mutex;
+    QWaitCondition released;
+    std::array<qint64, stageCount> limits{};
+    std::array<qint64, stageCount> used{};
+    std::array<Gauge *, stageCount> stageGauges{};
+    qint64 totalLimit = 0;
+    qint64 total = 0;
+    qint64 peakBytes = 0;
+    Gauge *totalGauge = nullptr;
+    Gauge *peakGauge = nullptr;
+
+    QMutex poolMutex;
+    QList<QByteArray> idleBuffers;
+    qint64 idleBytes = 0;
+    qint64 poolLimit = 0;
+};
+
+// Bytes held against a stage for as long as the reservation lives.
+class MemoryReservation {
+public:
+    MemoryReservation() = default;
+    MemoryReservation(MemoryStage stage, qint64 bytes);
+    ~MemoryReservation();
+    MemoryReservation(MemoryReservation &&other) noexcept;
+    MemoryReservation &operator=(MemoryReservation &&other) noexcept;
+    MemoryReservation(const MemoryReservation &) = delete;
+    MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+    void release();
+    qint64 bytes() const { return held; }
+
+private:
+    MemoryStage stage = MemoryStage::Transfer;
+    qint64 held = 0;
+};
+
+// A pooled buffer that counts against its stage until it goes out of scope.
+class PooledBuffer {
+public:
+    PooledBuffer(MemoryStage stage, qint64 size);
+    ~PooledBuffer();
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    char *data() { return buffer.data(); }
+    const char *constData() const { return buffer.constData(); }
+    qint64 size() const { return buffer.size(); }
+
+private:
+    MemoryReservation reservation;
+    QByteArray buffer;
+};
+
+#endif // MEMORY_BUDGET_H
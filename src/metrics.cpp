@@ -0,0 +1,262 @@
+#include "metrics.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <cstdio>
+
+#if defined(Q_OS_MACOS)
+#include <mach/mach.h>
+#endif
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+int threadShard() {
+    static std::atomic<int> nextShard{0};
+    thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+}
+
+QString familyName(const QString &series) {
+    return series.section('{', 0, 0);
+}
+
+// "name{a=\"b\"}" plus suffix and extra label -> "name_suffix{a=\"b\",extra}"
+QString seriesWith(const QString &series, const QString &suffix, const QString &extraLabel = QString()) {
+    const int brace = series.indexOf('{');
+    QString name = brace < 0 ? series : series.left(brace);
+    QString labels = brace < 0 ? QString() : series.mid(brace + 1, series.size() - brace - 2);
+    if (!extraLabel.isEmpty()) {
+        labels = labels.isEmpty() ? extraLabel : labels + ',' + extraLabel;
+    }
+    return name + suffix + (labels.isEmpty() ? QString() : '{' + labels + '}');
+}
+
+} // namespace
+
+void Counter::add(qint64 amount) {
+    shards[threadShard() % shardCount].value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+qint64 Counter::value() const {
+    qint64 sum = 0;
+    for (const Shard &shard : shards) {
+        sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+int Histogram::bucketFor(qint64 value) {
+    if (value < subBuckets) {
+        return value < 0 ? 0 : int(value);
+    }
+    const int exponent = 63 - __builtin_clzll(quint64(value));
+    const int sub = int((value >> (exponent - 4)) & (subBuckets - 1));
+    return (exponent - 3) * subBuckets + sub;
+}
+
+qint64 Histogram::bucketUpperBound(int index) {
+    if (index < subBuckets) {
+        return index;
+    }
+    const int exponent = index / subBuckets + 3;
+    const qint64 lower = qint64(subBuckets + index % subBuckets) << (exponent - 4);
+    return lower + (qint64(1) << (exponent - 4)) - 1;
+}
+
+void Histogram::record(qint64 value) {
+    buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    valueSum.fetch_add(value, std::memory_order_relaxed);
+}
+
+qint64 Histogram::quantile(double q) const {
+    const qint64 samples = count();
+    if (samples == 0) {
+        return 0;
+    }
+    const qint64 rank = qMax<qint64>(1, qint64(q * samples + 0.5));
+    qint64 seen = 0;
+    for (int i = 0; i < bucketCount; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return bucketUpperBound(i);
+        }
+    }
+    return bucketUpperBound(bucketCount - 1);
+}
+
+MetricsRegistry *MetricsRegistry::instance() {
+    static MetricsRegistry registry;
+    return &registry;
+}
+
+MetricsRegistry::MetricsRegistry() : QObject(nullptr) {
+}
+
+void MetricsRegistry::addFamily(const QString &series, const QString &help, Kind kind) {
+    const QString name = familyName(series);
+    if (!families.contains(name)) {
+        families.insert(name, Family{help, kind});
+    }
+}
+
+Counter *MetricsRegistry::counter(const QString &series, const QString &help) {
+    QMutexLocker locker(&mutex);
+    std::shared_ptr<Counter> &slot = counters[series];
+    if (!slot) {
+        slot = std::make_shared<Counter>();
+        addFamily(series, help, Kind::Counter);
+    }
+    return slot.get();
+}
+
+Gauge *MetricsRegistry::gauge(const QString &series, const QString &help) {
+    QMutexLocker locker(&mutex);
+    std::shared_ptr<Gauge> &slot = gauges[series];
+    if (!slot) {
+        slot = std::make_shared<Gauge>();
+        addFamily(series, help, Kind::Gauge);
+    }
+    return slot.get();
+}
+
+Histogram *MetricsRegistry::histogram(const QString &series, const QString &help, double unitDivisor) {
+    QMutexLocker locker(&mutex);
+    std::shared_ptr<Histogram> &slot = histograms[series];
+    if (!slot) {
+        slot = std::make_shared<Histogram>(unitDivisor);
+        addFamily(series, help, Kind::Summary);
+    }
+    return slot.get();
+}
+
+QString MetricsRegistry::exposition() const {
+    QMutexLocker locker(&mutex);
+    QString text;
+    QTextStream out(&text);
+
+    for (auto family = families.cbegin(); family != families.cend(); ++family) {
+        const QString &name = family.key();
+        const char *type = family->kind == Kind::Counter ? "counter"
+                         : family->kind == Kind::Gauge ? "gauge" : "summary";
+        out << "# HELP " << name << ' ' << family->help << '\n';
+        out << "# TYPE " << name << ' ' << type << '\n';
+
+        // Series of one family sort next to each other in the maps
+        if (family->kind == Kind::Counter) {
+            for (auto it = counters.lowerBound(name); it != counters.cend() && familyName(it.key()) == name; ++it) {
+                out << it.key() << ' ' << it.value()->value() << '\n';
+            }
+        } else if (family->kind == Kind::Gauge) {
+            for (auto it = gauges.lowerBound(name); it != gauges.cend() && familyName(it.key()) == name; ++it) {
+                out << it.key() << ' ' << it.value()->value() << '\n';
+            }
+        } else {
+            for (auto it = histograms.lowerBound(name); it != histograms.cend() && familyName(it.key()) == name; ++it) {
+                const Histogram &histogram = *it.value();
+                for (double q : {0.5, 0.9, 0.99}) {
+                    out << seriesWith(it.key(), QString(), QString("quantile=\"%1\"").arg(q)) << ' '
+                        << histogram.quantile(q) / histogram.divisor() << '\n';
+                }
+                out << seriesWith(it.key(), "_sum") << ' ' << histogram.sum() / histogram.divisor() << '\n';
+                out << seriesWith(it.key(), "_count") << ' ' << histogram.count() << '\n';
+            }
+        }
+    }
+    out.flush();
+    return text;
+}
+
+bool MetricsRegistry::writeTextFile(const QString &path) const {
+    // The textfile collector must never see a half-written file
+    const QString temporaryPath = path + ".tmp";
+    QFile file(temporaryPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "MetricsRegistry: Cannot write" << temporaryPath;
+        return false;
+    }
+    const QByteArray text = exposition().toUtf8();
+    if (file.write(text) != text.size()) {
+        file.remove();
+        return false;
+    }
+    file.close();
+    return std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(path).constData()) == 0;
+}
+
+void MetricsRegistry::updateProcessGauges() {
+#if defined(Q_OS_MACOS)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+        gauge("feeder_resident_memory_bytes", "Resident set size.")->set(qint64(info.resident_size));
+    }
+#elif defined(Q_OS_LINUX)
+    QFile statm("/proc/self/statm");
+    if (statm.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1) {
+            gauge("feeder_resident_memory_bytes", "Resident set size.")->set(fields[1].toLongLong() * sysconf(_SC_PAGESIZE));
+        }
+    }
+#endif
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(Q_OS_MACOS)
+        const qint64 peak = usage.ru_maxrss;          // bytes
+#else
+        const qint64 peak = qint64(usage.ru_maxrss) * 1024;  // kilobytes
+#endif
+        gauge("feeder_peak_resident_memory_bytes", "Peak resident set size.")->set(peak);
+    }
+#endif
+}
+
+void MetricsRegistry::startExport() {
+    QSettings settings;
+    exportPath = settings.value("metrics/textfilePath").toString();
+    if (exportPath.isEmpty() || exportThread) {
+        return;
+    }
+    const int intervalSeconds = qMax(1, settings.value("metrics/intervalSeconds", 15).toInt());
+
+    // Own thread: the exposition keeps flowing while a batch blocks the UI thread
+    exportThread = new QThread();
+    QTimer *timer = new QTimer();
+    timer->setInterval(intervalSeconds * 1000);
+    timer->moveToThread(exportThread);
+    connect(exportThread, &QThread::started, timer, QOverload<>::of(&QTimer::start));
+    connect(timer, &QTimer::timeout, timer, [this]() {
+        updateProcessGauges();
+        writeTextFile(exportPath);
+    });
+    connect(exportThread, &QThread::finished, timer, &QObject::deleteLater);
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &MetricsRegistry::stopExport);
+    }
+    exportThread->start();
+    qDebug() << "MetricsRegistry: Exporting to" << exportPath << "every" << intervalSeconds << "s";
+}
+
+void MetricsRegistry::stopExport() {
+    if (!exportThread) {
+        return;
+    }
+    exportThread->quit();
+    exportThread->wait();
+    delete exportThread;
+    exportThread = nullptr;
+
+    updateProcessGauges();
+    writeTextFile(exportPath);
+}
@@ -0,0 +1,123 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <atomic>
+#include <memory>
+
+class QThread;
+
+// Monotonic counter split into cache-line sized shards, one picked per
+// thread, so hot paths on many workers never contend on one atomic.
+class Counter {
+public:
+    void add(qint64 amount = 1);
+    qint64 value() const;
+
+private:
+    static const int shardCount = 16;
+    struct alignas(64) Shard {
+        std::atomic<qint64> value{0};
+    };
+    Shard shards[shardCount];
+};
+
+class Gauge {
+public:
+    void set(qint64 value) { current.store(value, std::memory_order_relaxed); }
+    void add(qint64 amount) { current.fetch_add(amount, std::memory_order_relaxed); }
+    qint64 value() const { return current.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> current{0};
+};
+
+// Log-linear (HDR-style) histogram: exact below 16, then 16 buckets per
+// power of two, i.e. within ~6% of any recorded value up to 2^63.
+// Values are recorded as integers and divided by unitDivisor on export,
+// e.g. microseconds with a divisor of 1e6 are exported as seconds.
+class Histogram {
+public:
+    explicit Histogram(double unitDivisor = 1.0) : unitDivisor(unitDivisor) {}
+
+    void record(qint64 value);
+    qint64 count() const { return total.load(std::memory_order_relaxed); }
+    qint64 sum() const { return valueSum.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the q-th quantile, in recorded units.
+    qint64 quantile(double q) const;
+    double divisor() const { return unitDivisor; }
+
+private:
+    static const int subBuckets = 16;
+    static const int bucketCount = 64 * subBuckets;
+
+    std::atomic<qint64> buckets[bucketCount] = {};
+    std::atomic<qint64> total{0};
+    std::atomic<qint64> valueSum{0};
+    double unitDivisor;
+
+    static int bucketFor(qint64 value);
+    static qint64 bucketUpperBound(int index);
+};
+
+// Records the lifetime of the scope, in microseconds, into a histogram.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram *histogram) : histogram(histogram) { timer.start(); }
+    ~ScopedTimer() { histogram->record(timer.nsecsElapsed() / 1000); }
+
+private:
+    Histogram *histogram;
+    QElapsedTimer timer;
+};
+
+// Process-wide registry. Series are named the Prometheus way, labels
+// included ("feeder_conversions_total{codec=\"heic\"}"); the returned
+// pointers stay valid for the life of the process, so callers look a
+// series up once and keep it.
+class MetricsRegistry : public QObject {
+    Q_OBJECT
+
+public:
+    static MetricsRegistry *instance();
+
+    Counter *counter(const QString &series, const QString &help);
+    Gauge *gauge(const QString &series, const QString &help);
+    Histogram *histogram(const QString &series, const QString &help, double unitDivisor = 1e6);
+
+    // Prometheus text exposition format; histograms are exported as summaries.
+    QString exposition() const;
+    bool writeTextFile(const QString &path) const;
+
+    // Dumps to the "metrics/textfilePath" setting every
+    // "metrics/intervalSeconds" (default 15) on a thread of its own.
+    void startExport();
+    void stopExport();
+
+    void updateProcessGauges();
+
+private:
+    MetricsRegistry();
+
+    enum class Kind { Counter, Gauge, Summary };
+    struct Family {
+        QString help;
+        Kind kind;
+    };
+
+    mutable QMutex mutex;
+    QMap<QString, Family> families;
+    QMap<QString, std::shared_ptr<Counter>> counters;
+    QMap<QString, std::shared_ptr<Gauge>> gauges;
+    QMap<QString, std::shared_ptr<Histogram>> histograms;
+    QThread *exportThread = nullptr;
+    QString exportPath;
+
+    void addFamily(const QString &series, const QString &help, Kind kind);
+};
+
+#endif // METRICS_H
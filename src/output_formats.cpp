@@ -0,0 +1,415 @@
+#include "output_formats.h"
+#include "checksum.h"
+#include "job_scheduler.h"
+#include "media_types.h"
+#include "resource_governor.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QProcess>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <algorithm>
+
+namespace {
+
+// Passes a JPEG stream through, slipping an APP1 "Exif" segment in right
+// behind the start-of-image marker
+class ExifInserter : public QIODevice {
+public:
+    ExifInserter(QIODevice *target, const QByteArray &tiff) : target(target) {
+        const qint64 length = 2 + 6 + tiff.size();
+        segment = QByteArray("\xFF\xE1", 2);
+        segment += char(length >> 8);
+        segment += char(length & 0xFF);
+        segment += QByteArray("Exif\0\0", 6);
+        segment += tiff;
+    }
+
+    bool isSequential() const override { return true; }
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+
+    qint64 writeData(const char *data, qint64 size) override {
+        qint64 done = 0;
+        if (passed < 2) {
+            done = qMin<qint64>(size, 2 - passed);
+            if (target->write(data, done) != done) {
+                return -1;
+            }
+            passed += done;
+            if (passed == 2 && target->write(segment) != segment.size()) {
+                return -1;
+            }
+        }
+        if (done < size && target->write(data + done, size - done) != size - done) {
+            return -1;
+        }
+        return size;
+    }
+
+private:
+    QIODevice *target;
+    QByteArray segment;
+    qint64 passed = 0;
+};
+
+int encoderThreads(const EncoderSettings &settings) {
+    if (settings.threads > 0) {
+        return settings.threads;
+    }
+    return ResourceGovernor::instance()->encoderThreads();
+}
+
+EncoderSettings defaultsFor(OutputFormat format) {
+    EncoderSettings settings;
+    settings.format = format;
+    switch (format) {
+    case OutputFormat::Jpeg:
+        settings.quality = 90;
+        break;
+    case OutputFormat::JpegXl:
+        settings.quality = 90;
+        settings.effort = 7;
+        break;
+    case OutputFormat::Avif:
+        settings.quality = 60;
+        settings.effort = 4;
+        break;
+    case OutputFormat::WebP:
+        settings.quality = 80;
+        settings.effort = 7;
+        break;
+    }
+    return settings;
+}
+
+} // namespace
+
+QString FormatEncoder::extension(OutputFormat format) {
+    switch (format) {
+    case OutputFormat::Jpeg: return "jpg";
+    case OutputFormat::JpegXl: return "jxl";
+    case OutputFormat::Avif: return "avif";
+    case OutputFormat::WebP: return "webp";
+    }
+    return QString();
+}
+
+QString FormatEncoder::name(OutputFormat format) {
+    switch (format) {
+    case OutputFormat::Jpeg: return "JPEG";
+    case OutputFormat::JpegXl: return "JPEG XL";
+    case OutputFormat::Avif: return "AVIF";
+    case OutputFormat::WebP: return "WebP";
+    }
+    return QString();
+}
+
+bool FormatEncoder::fromName(const QString &name, OutputFormat *format) {
+    const QString lower = name.trimmed().toLower();
+    if (lower == "jpeg" || lower == "jpg") {
+        *format = OutputFormat::Jpeg;
+    } else if (lower == "jxl" || lower == "jpegxl") {
+        *format = OutputFormat::JpegXl;
+    } else if (lower == "avif") {
+        *format = OutputFormat::Avif;
+    } else if (lower == "webp") {
+        *format = OutputFormat::WebP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+QList<EncoderSettings> FormatEncoder::loadSettings() {
+    QSettings settings;
+    const QStringList entries = settings.value("outputFormats").toStringList();
+
+    QList<EncoderSettings> formats;
+    for (const QString &entry : entries) {
+        const QStringList parts = entry.split(':');
+        OutputFormat format;
+        if (!fromName(parts.value(0), &format)) {
+            qDebug() << "FormatEncoder: Ignoring unknown output format" << entry;
+            continue;
+        }
+        EncoderSettings encoder = defaultsFor(format);
+        if (parts.size() > 1) {
+            encoder.quality = std::clamp(parts[1].toInt(), 1, 100);
+        }
+        if (parts.size() > 2) {
+            encoder.effort = std::clamp(parts[2].toInt(), 1, 10);
+        }
+        encoder.lossless = format == OutputFormat::JpegXl && parts.value(3) == "lossless";
+        formats << encoder;
+    }
+
+    if (formats.isEmpty()) {
+        formats << defaultsFor(OutputFormat::Jpeg);
+    }
+    return formats;
+}
+
+QString FormatEncoder::toolPath(OutputFormat format) {
+    QString tool;
+    switch (format) {
+    case OutputFormat::Jpeg: return QString();
+    case OutputFormat::JpegXl: tool = "cjxl"; break;
+    case OutputFormat::Avif: tool = "avifenc"; break;
+    case OutputFormat::WebP: tool = "cwebp"; break;
+    }
+
+    QString path = QStandardPaths::findExecutable(tool, {"/opt/homebrew/bin", "/usr/local/bin"});
+    if (path.isEmpty()) {
+        path = QStandardPaths::findExecutable(tool);
+    }
+    return path;
+}
+
+bool FormatEncoder::isAvailable(OutputFormat format) {
+    return format == OutputFormat::Jpeg || !toolPath(format).isEmpty();
+}
+
+bool FormatEncoder::runEncoder(const QString &program, const QStringList &arguments, const QString &outputPath) {
+    QProcess process;
+    process.setProgram(program);
+    process.setArguments(arguments);
+    ResourceGovernor::instance()->applyToProcess(process);
+    JobScheduler::instance()->track(process);
+    process.start();
+    if (!JobScheduler::instance()->waitForFinished(process, 300000)) { // 5 minute timeout
+        process.kill();
+        process.waitForFinished();
+        qDebug() << "FormatEncoder:" << program << "timed out";
+        QFile::remove(outputPath);
+        return false;
+    }
+
+    if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        qDebug() << "FormatEncoder:" << program << "failed:" << process.readAllStandardError();
+        QFile::remove(outputPath);
+        return false;
+    }
+
+    // External encoders write the file themselves, so it is checked and
+    // checksummed straight out of the page cache afterwards
+    if (!isCompleteMediaFile(outputPath) || !ChecksumManifest::recordFile(outputPath)) {
+        qDebug() << "FormatEncoder:" << program << "left an incomplete" << outputPath;
+        QFile::remove(outputPath);
+        return false;
+    }
+    return true;
+}
+
+bool FormatEncoder::encode(const QImage &image, const QString &outputPath, const EncoderSettings &settings,
+                           const QByteArray &exif) {
+    if (settings.format == OutputFormat::Jpeg) {
+        // Checksummed in-line as the encoder writes
+        ChecksumWriter output(outputPath);
+        if (!output.open()) {
+            return false;
+        }
+        ExifInserter withExif(&output, exif);
+        withExif.open(QIODevice::WriteOnly);
+        QImageWriter writer(exif.isEmpty() ? static_cast<QIODevice *>(&output) : &withExif, "jpeg");
+        writer.setQuality(settings.quality);
+        if (!writer.write(image)) {
+            output.abort();
+            return false;
+        }
+        return output.commit();
+    }
+
+    const QString tool = toolPath(settings.format);
+    if (tool.isEmpty()) {
+        qDebug() << "FormatEncoder: No encoder installed for" << name(settings.format);
+        return false;
+    }
+
+    // Hand the pixels over as an uncompressed PNG (quality 100 = zlib level 0)
+    QTemporaryFile source(QDir::tempPath() + "/feeder_XXXXXX.png");
+    if (!source.open()) {
+        return false;
+    }
+    QImageWriter pngWriter(&source, "png");
+    pngWriter.setQuality(100);
+    if (!pngWriter.write(image)) {
+        return false;
+    }
+    source.flush();
+
+    const QString threads = QString::number(encoderThreads(settings));
+    const QString quality = QString::number(settings.quality);
+    QStringList args;
+
+    switch (settings.format) {
+    case OutputFormat::JpegXl:
+        args << source.fileName() << outputPath
+             << "-q" << quality
+             << "-e" << QString::number(std::clamp(settings.effort, 1, 9))
+             << "--num_threads" << threads;
+        break;
+    case OutputFormat::Avif:
+        // avifenc speed runs the other way: 0 is slowest, 10 fastest
+        args << "-q" << quality
+             << "-s" << QString::number(std::clamp(10 - settings.effort, 0, 10))
+             << "-j" << threads
+             << source.fileName() << outputPath;
+        break;
+    case OutputFormat::WebP:
+        args << "-q" << quality
+             << "-m" << QString::number(std::clamp(settings.effort * 6 / 10, 0, 6))
+             << "-mt"
+             << source.fileName() << "-o" << outputPath;
+        break;
+    case OutputFormat::Jpeg:
+        break;
+    }
+
+    return runEncoder(tool, args, outputPath);
+}
+
+bool FormatEncoder::recompressJpeg(const QString &jpegPath, const QString &outputPath,
+                                   const EncoderSettings &settings) {
+    const QString tool = toolPath(OutputFormat::JpegXl);
+    if (tool.isEmpty()) {
+        qDebug() << "FormatEncoder: cjxl not installed, cannot recompress" << jpegPath;
+        return false;
+    }
+
+    return runEncoder(tool, QStringList()
+        << jpegPath << outputPath
+        << "--lossless_jpeg=1"
+        << "-e" << QString::number(std::clamp(settings.effort, 1, 9))
+        << "--num_threads" << QString::number(encoderThreads(settings)), outputPath);
+}
+
+int FormatEncoder::runBenchmark(const QString &directory, QTextStream &out) {
+    QDir dir(directory);
+    QStringList files;
+    for (const QString &file : dir.entryList(QDir::Files)) {
+        const MediaType type = mediaTypeForPath(file);
+        if (type == MediaType::Heic || type == MediaType::Jpeg || type == MediaType::Png || type == MediaType::Tiff) {
+            files << file;
+        }
+    }
+    if (files.isEmpty()) {
+        out << "No images found in " << directory << Qt::endl;
+        return 1;
+    }
+
+    // Benchmark the configured formats, or every format when only JPEG is set
+    QList<EncoderSettings> formats = loadSettings();
+    if (formats.size() == 1 && formats.first().format == OutputFormat::Jpeg) {
+        formats << defaultsFor(OutputFormat::JpegXl) << defaultsFor(OutputFormat::Avif)
+                << defaultsFor(OutputFormat::WebP);
+    }
+    const bool hasJpeg = std::any_of(formats.cbegin(), formats.cend(), [](const EncoderSettings &s) {
+        return s.format == OutputFormat::Jpeg;
+    });
+    if (!hasJpeg) {
+        formats.prepend(defaultsFor(OutputFormat::Jpeg));
+    }
+
+    struct Totals {
+        qint64 bytes = 0;
+        qint64 pixels = 0;
+        qint64 nanos = 0;
+        int files = 0;
+        int failures = 0;
+    };
+    QList<Totals> totals(formats.size());
+
+    QTemporaryDir scratch;
+    if (!scratch.isValid()) {
+        out << "Cannot create scratch directory" << Qt::endl;
+        return 1;
+    }
+
+    qint64 sourceBytes = 0;
+    for (const QString &file : files) {
+        const QString inputPath = dir.absoluteFilePath(file);
+        QImageReader reader(inputPath);
+        reader.setAutoTransform(true);
+        const QImage image = reader.read();
+        if (image.isNull()) {
+            out << "Skipping " << file << ": " << reader.errorString() << Qt::endl;
+            continue;
+        }
+        sourceBytes += QFileInfo(inputPath).size();
+        const bool jpegSource = reader.format() == "jpeg";
+
+        for (int i = 0; i < formats.size(); ++i) {
+            const EncoderSettings &settings = formats[i];
+            if (!isAvailable(settings.format)) {
+                continue;
+            }
+            const QString outputPath = QDir(scratch.path()).absoluteFilePath(
+                QString("%1_%2.%3").arg(QFileInfo(file).completeBaseName()).arg(i).arg(extension(settings.format)));
+
+            QElapsedTimer timer;
+            timer.start();
+            const bool ok = (settings.lossless && jpegSource)
+                ? recompressJpeg(inputPath, outputPath, settings)
+                : encode(image, outputPath, settings);
+            const qint64 elapsed = timer.nsecsElapsed();
+
+            if (!ok) {
+                totals[i].failures++;
+                continue;
+            }
+            totals[i].bytes += QFileInfo(outputPath).size();
+            totals[i].pixels += qint64(image.width()) * image.height();
+            totals[i].nanos += elapsed;
+            totals[i].files++;
+            QFile::remove(outputPath);
+        }
+    }
+
+    int baseline = 0;
+    for (int i = 0; i < formats.size(); ++i) {
+        if (formats[i].format == OutputFormat::Jpeg) {
+            baseline = i;
+            break;
+        }
+    }
+    const Totals &jpeg = totals[baseline];
+
+    out << "Source: " << files.size() << " files, " << sourceBytes << " bytes" << Qt::endl;
+    out << QString("%1 %2 %3 %4 %5 %6")
+               .arg(QString("format"), -22).arg(QString("files"), 6).arg(QString("bytes"), 14)
+               .arg(QString("saved vs JPEG"), 22).arg(QString("MPix/s"), 9).arg(QString("files/s"), 9) << Qt::endl;
+    for (int i = 0; i < formats.size(); ++i) {
+        const EncoderSettings &settings = formats[i];
+        const Totals &t = totals[i];
+        QString label = QString("%1 q%2 e%3%4").arg(name(settings.format)).arg(settings.quality)
+                            .arg(settings.effort).arg(settings.lossless ? " lossless" : "");
+        if (!isAvailable(settings.format)) {
+            out << QString("%1 encoder not installed").arg(label, -22) << Qt::endl;
+            continue;
+        }
+
+        const double seconds = t.nanos / 1e9;
+        // Compare against JPEG over the same files only when both covered them all
+        const qint64 saved = (t.files == jpeg.files) ? jpeg.bytes - t.bytes : 0;
+        const double savedPercent = jpeg.bytes > 0 ? 100.0 * saved / jpeg.bytes : 0.0;
+        out << QString("%1 %2 %3 %4 %5 %6")
+                   .arg(label, -22).arg(t.files, 6).arg(t.bytes, 14)
+                   .arg(QString("%1 (%2%)").arg(saved).arg(savedPercent, 0, 'f', 1), 22)
+                   .arg(seconds > 0 ? t.pixels / 1e6 / seconds : 0.0, 9, 'f', 2)
+                   .arg(seconds > 0 ? t.files / seconds : 0.0, 9, 'f', 2);
+        if (t.failures > 0) {
+            out << "  (" << t.failures << " failed)";
+        }
+        out << Qt::endl;
+    }
+
+    return 0;
+}
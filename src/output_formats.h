@@ -0,0 +1,57 @@
+#ifndef OUTPUT_FORMATS_H
+#define OUTPUT_FORMATS_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QTextStream>
+
+enum class OutputFormat {
+    Jpeg,
+    JpegXl,
+    Avif,
+    WebP
+};
+
+struct EncoderSettings {
+    OutputFormat format = OutputFormat::Jpeg;
+    int quality = 90;       // 1-100
+    int effort = 7;         // 1 (fastest) - 10 (smallest output)
+    int threads = 0;        // 0 uses every core
+    bool lossless = false;  // JPEG XL only: bit-exact recompression of JPEG sources
+};
+
+// Image encoders beyond Qt's JPEG writer. JPEG XL, AVIF and WebP go through
+// the reference encoders (cjxl, avifenc, cwebp), all of which are
+// multithreaded; install them with "brew install jpeg-xl libavif webp".
+class FormatEncoder {
+public:
+    static QString extension(OutputFormat format);
+    static QString name(OutputFormat format);
+    static bool fromName(const QString &name, OutputFormat *format);
+
+    // "outputFormats" setting, a list of "format[:quality[:effort[:lossless]]]"
+    // entries such as "avif:60:6" or "jxl:90:7:lossless". Defaults to JPEG.
+    static QList<EncoderSettings> loadSettings();
+    static bool isAvailable(OutputFormat format);
+
+    // exif, a TIFF block as from ExifInfo::forDecodedImage, is written into
+    // JPEG outputs as an APP1 segment; other formats ignore it.
+    static bool encode(const QImage &image, const QString &outputPath, const EncoderSettings &settings,
+                       const QByteArray &exif = QByteArray());
+
+    // Lossless JPEG -> JPEG XL transcode; the original JPEG can be rebuilt
+    // bit for bit from the output.
+    static bool recompressJpeg(const QString &jpegPath, const QString &outputPath,
+                               const EncoderSettings &settings);
+
+    // Encodes every image in directory with each available format and
+    // reports bytes saved against JPEG and encode throughput.
+    static int runBenchmark(const QString &directory, QTextStream &out);
+
+private:
+    static QString toolPath(OutputFormat format);
+    static bool runEncoder(const QString &program, const QStringList &arguments, const QString &outputPath);
+};
+
+#endif // OUTPUT_FORMATS_H
@@ -0,0 +1,412 @@
+#include "pack_writer.h"
+#include "checksum.h"
+#include "metrics.h"
+#include "resource_governor.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#include <cstdio>
+#include <cstring>
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+namespace {
+
+const qint64 blockSize = 512;
+const qint64 copyChunk = 4 << 20;
+
+qint64 paddedSize(qint64 size) {
+    return (size + blockSize - 1) / blockSize * blockSize;
+}
+
+void writeOctal(char *field, int length, qint64 value) {
+    std::snprintf(field, length, "%0*llo", length - 1, static_cast<unsigned long long>(value));
+}
+
+// Sizes of 8 GiB and above use the GNU base-256 encoding
+void writeSize(char *field, qint64 size) {
+    if (size < (qint64(1) << 33)) {
+        writeOctal(field, 12, size);
+        return;
+    }
+    std::memset(field, 0, 12);
+    field[0] = char(0x80);
+    for (int i = 11; i > 0 && size > 0; --i) {
+        field[i] = char(size & 0xFF);
+        size >>= 8;
+    }
+}
+
+qint64 readSize(const char *field) {
+    if (uchar(field[0]) & 0x80) {
+        qint64 value = 0;
+        for (int i = 1; i < 12; ++i) {
+            value = (value << 8) | uchar(field[i]);
+        }
+        return value;
+    }
+    return QByteArray(field, 12).trimmed().toLongLong(nullptr, 8);
+}
+
+bool isSafeEntryName(const QString &name) {
+    if (name.isEmpty() || name.startsWith('/')) {
+        return false;
+    }
+    return !name.split('/').contains("..");
+}
+
+} // namespace
+
+PackWriter::PackWriter(const QString &packPath, qint64 syncInterval)
+    : packPath(packPath), syncInterval(syncInterval) {
+}
+
+PackWriter::~PackWriter() {
+    if (pack.isOpen()) {
+        close();
+    }
+}
+
+QString PackWriter::indexPath(const QString &packPath) {
+    return packPath + ".idx";
+}
+
+bool PackWriter::open() {
+    // Find where the last complete entry ends; that is where appending resumes
+    qint64 end = 0;
+    if (QFileInfo::exists(packPath)) {
+        PackReader reader(packPath);
+        if (!reader.open()) {
+            // Truncating to what we could read would throw the pack away
+            qDebug() << "PackWriter: Cannot read existing pack" << packPath;
+            return false;
+        }
+        if (!reader.entries().isEmpty()) {
+            const PackEntry &last = reader.entries().last();
+            end = last.offset + paddedSize(last.size);
+        }
+        if (!writeIndex(reader.entries())) {
+            qDebug() << "PackWriter: Cannot rewrite index" << indexPath(packPath);
+            return false;
+        }
+    }
+
+    pack.setFileName(packPath);
+    if (!pack.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        qDebug() << "PackWriter: Cannot open" << packPath << pack.errorString();
+        return false;
+    }
+    if (!pack.resize(end) || !pack.seek(end)) {
+        qDebug() << "PackWriter: Cannot position" << packPath << "at" << end;
+        pack.close();
+        return false;
+    }
+
+    index.setFileName(indexPath(packPath));
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        qDebug() << "PackWriter: Cannot open index" << index.fileName();
+        pack.close();
+        return false;
+    }
+    unsyncedBytes = 0;
+    return true;
+}
+
+bool PackWriter::writeIndex(const QList<PackEntry> &entries) {
+    // Replaced in one rename, so a crash leaves the old index or the new one
+    const QString finalPath = indexPath(packPath);
+    const QString temporaryPath = finalPath + ".tmp";
+    QFile rebuilt(temporaryPath);
+    if (!rebuilt.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream stream(&rebuilt);
+    for (const PackEntry &entry : entries) {
+        stream << entry.offset << ' ' << entry.size << ' '
+               << QString("%1").arg(entry.crc, 8, 16, QChar('0')) << ' ' << entry.name << "\n";
+    }
+    stream.flush();
+    bool ok = rebuilt.flush() && stream.status() == QTextStream::Ok;
+#if defined(Q_OS_UNIX)
+    ok = ok && ::fsync(rebuilt.handle()) == 0;
+#endif
+    rebuilt.close();
+    if (!ok) {
+        rebuilt.remove();
+        return false;
+    }
+    return std::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(finalPath).constData()) == 0;
+}
+
+bool PackWriter::writeHeader(const QString &entryName, qint64 size, qint64 mtime) {
+    char header[blockSize];
+    std::memset(header, 0, sizeof(header));
+
+    // ustar splits long names into a 155 byte prefix and a 100 byte name
+    const QByteArray name = entryName.toUtf8();
+    if (name.size() <= 100) {
+        std::memcpy(header, name.constData(), name.size());
+    } else {
+        const int split = name.lastIndexOf('/', 155);
+        if (split <= 0 || name.size() - split - 1 > 100) {
+            qDebug() << "PackWriter: Entry name too long for ustar:" << entryName;
+            return false;
+        }
+        std::memcpy(header + 345, name.constData(), split);
+        std::memcpy(header, name.constData() + split + 1, name.size() - split - 1);
+    }
+
+    writeOctal(header + 100, 8, 0644);  // mode
+    writeOctal(header + 108, 8, 0);     // uid
+    writeOctal(header + 116, 8, 0);     // gid
+    writeSize(header + 124, size);
+    writeOctal(header + 136, 12, mtime);
+    header[156] = '0';                  // regular file
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+
+    std::memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (qint64 i = 0; i < blockSize; ++i) {
+        sum += uchar(header[i]);
+    }
+    std::snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+
+    return pack.write(header, blockSize) == blockSize;
+}
+
+bool PackWriter::append(const QString &sourcePath, const QString &entryName) {
+    if (!pack.isOpen() || !isSafeEntryName(entryName)) {
+        return false;
+    }
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly)) {
+        qDebug() << "PackWriter: Cannot read" << sourcePath;
+        return false;
+    }
+
+    const qint64 headerOffset = pack.pos();
+    const qint64 size = source.size();
+    const qint64 mtime = QFileInfo(sourcePath).lastModified().toSecsSinceEpoch();
+
+    static Counter *written = MetricsRegistry::instance()->counter(
+        "feeder_written_bytes_total", "Bytes written to output files.");
+    bool ok = writeHeader(entryName, size, mtime);
+    quint32 crc = 0;
+    qint64 copied = 0;
+    QByteArray buffer(int(copyChunk), Qt::Uninitialized);
+
+    while (ok && copied < size) {
+        const qint64 read = source.read(buffer.data(), qMin(copyChunk, size - copied));
+        if (read <= 0) {
+            ok = false;
+            break;
+        }
+        crc = crc32c(buffer.constData(), read, crc);
+        ResourceGovernor::instance()->throttle(read);
+        ok = pack.write(buffer.constData(), read) == read;
+        if (ok) {
+            written->add(read);
+        }
+        copied += read;
+        unsyncedBytes += read;
+        if (ok && unsyncedBytes >= syncInterval) {
+            ok = sync();
+        }
+    }
+
+    const qint64 padding = paddedSize(size) - size;
+    if (ok && padding > 0) {
+        const QByteArray zeros(int(padding), '\0');
+        ok = pack.write(zeros) == padding;
+    }
+
+    if (!ok) {
+        // Drop the partial entry so the pack stays a valid prefix
+        qDebug() << "PackWriter: Failed to append" << sourcePath;
+        pack.resize(headerOffset);
+        pack.seek(headerOffset);
+        return false;
+    }
+
+    QTextStream stream(&index);
+    stream << headerOffset + blockSize << ' ' << size << ' '
+           << QString("%1").arg(crc, 8, 16, QChar('0')) << ' ' << entryName << "\n";
+    stream.flush();
+    return true;
+}
+
+bool PackWriter::sync() {
+    index.flush();
+#if defined(Q_OS_UNIX)
+    if (::fsync(pack.handle()) != 0 || ::fsync(index.handle()) != 0) {
+        return false;
+    }
+#endif
+    unsyncedBytes = 0;
+    return true;
+}
+
+bool PackWriter::close() {
+    if (!pack.isOpen()) {
+        return false;
+    }
+    // End-of-archive marker so standard tar tools read the pack as-is
+    const QByteArray trailer(int(blockSize * 2), '\0');
+    bool ok = pack.write(trailer) == trailer.size();
+    ok = sync() && ok;
+    pack.close();
+    index.close();
+    return ok;
+}
+
+PackReader::PackReader(const QString &packPath) : packPath(packPath) {
+}
+
+bool PackReader::open() {
+    packEntries.clear();
+    if (QFileInfo::exists(PackWriter::indexPath(packPath)) && loadIndex() && indexCoversPack()) {
+        return true;
+    }
+    packEntries.clear();
+    return scanHeaders();
+}
+
+bool PackReader::indexCoversPack() const {
+    // A tar header right after the last indexed entry means the index is
+    // missing entries (lost or stale sidecar), and the headers are the truth
+    QFile file(packPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    qint64 end = 0;
+    if (!packEntries.isEmpty()) {
+        end = packEntries.last().offset + paddedSize(packEntries.last().size);
+    }
+    char header[blockSize];
+    if (end + blockSize > file.size() || !file.seek(end) || file.read(header, blockSize) != blockSize) {
+        return true;
+    }
+    return header[0] == '\0';
+}
+
+bool PackReader::loadIndex() {
+    QFile file(PackWriter::indexPath(packPath));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    const qint64 packSize = QFileInfo(packPath).size();
+
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine();
+        const QStringList parts = line.split(' ');
+        if (parts.size() < 4) {
+            continue;
+        }
+        PackEntry entry;
+        entry.offset = parts[0].toLongLong();
+        entry.size = parts[1].toLongLong();
+        entry.crc = parts[2].toUInt(nullptr, 16);
+        entry.name = line.section(' ', 3);
+        // Entries past the end of the pack were never fully written
+        if (entry.offset + entry.size > packSize) {
+            break;
+        }
+        packEntries << entry;
+    }
+    return true;
+}
+
+bool PackReader::scanHeaders() {
+    QFile file(packPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const qint64 packSize = file.size();
+    qint64 pos = 0;
+    char header[blockSize];
+    QByteArray buffer(int(copyChunk), Qt::Uninitialized);
+
+    while (pos + blockSize <= packSize) {
+        file.seek(pos);
+        if (file.read(header, blockSize) != blockSize || header[0] == '\0') {
+            break;
+        }
+        const qint64 size = readSize(header + 124);
+        if (pos + blockSize + size > packSize) {
+            break;
+        }
+
+        const char type = header[156];
+        if (type == '0' || type == '\0') {
+            QString name = QString::fromUtf8(header, int(strnlen(header, 100)));
+            if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+                name = QString::fromUtf8(header + 345, int(strnlen(header + 345, 155))) + '/' + name;
+            }
+
+            PackEntry entry;
+            entry.name = name;
+            entry.offset = pos + blockSize;
+            entry.size = size;
+            qint64 remaining = size;
+            while (remaining > 0) {
+                const qint64 read = file.read(buffer.data(), qMin(copyChunk, remaining));
+                if (read <= 0) {
+                    return !packEntries.isEmpty();
+                }
+                entry.crc = crc32c(buffer.constData(), read, entry.crc);
+                remaining -= read;
+            }
+            packEntries << entry;
+        }
+        pos += blockSize + paddedSize(size);
+    }
+    return true;
+}
+
+bool PackReader::extract(const PackEntry &entry, const QString &destinationDirectory) {
+    if (!isSafeEntryName(entry.name)) {
+        qDebug() << "PackReader: Refusing unsafe entry name" << entry.name;
+        return false;
+    }
+    QFile file(packPath);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(entry.offset)) {
+        return false;
+    }
+
+    ChecksumWriter output(QDir(destinationDirectory).absoluteFilePath(entry.name));
+    if (!output.open()) {
+        return false;
+    }
+    QByteArray buffer(int(copyChunk), Qt::Uninitialized);
+    qint64 remaining = entry.size;
+    while (remaining > 0) {
+        const qint64 read = file.read(buffer.data(), qMin(copyChunk, remaining));
+        if (read <= 0 || output.write(buffer.constData(), read) != read) {
+            output.abort();
+            return false;
+        }
+        remaining -= read;
+    }
+
+    if (output.checksum() != entry.crc) {
+        qDebug() << "PackReader: Checksum mismatch for" << entry.name;
+        output.abort();
+        return false;
+    }
+    return output.commit();
+}
+
+bool PackReader::extractAll(const QString &destinationDirectory) {
+    bool ok = true;
+    for (const PackEntry &entry : packEntries) {
+        ok = extract(entry, destinationDirectory) && ok;
+    }
+    return ok;
+}
@@ -0,0 +1,67 @@
+#ifndef PACK_WRITER_H
+#define PACK_WRITER_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+
+struct PackEntry {
+    QString name;
+    qint64 offset = 0;   // start of the entry's data in the pack
+    qint64 size = 0;
+    quint32 crc = 0;     // CRC32C of the data
+};
+
+// Appends files to an uncompressed POSIX tar ("pack") with one large
+// sequential write per entry, so slow or network output volumes see a
+// single growing file instead of thousands of creates and renames. A
+// "<pack>.idx" sidecar lists every entry's data offset, size and checksum
+// for random access. The tar end-of-archive blocks are written on close and
+// dropped again when the pack is reopened for appending; anything after
+// the last indexed entry (e.g. from a crash) is truncated away.
+class PackWriter {
+public:
+    explicit PackWriter(const QString &packPath, qint64 syncInterval = 64ll << 20);
+    ~PackWriter();
+
+    bool open();
+    bool append(const QString &sourcePath, const QString &entryName);
+    bool close();
+
+    QString path() const { return packPath; }
+    static QString indexPath(const QString &packPath);
+
+private:
+    QString packPath;
+    QFile pack;
+    QFile index;
+    qint64 syncInterval;
+    qint64 unsyncedBytes = 0;
+
+    bool writeIndex(const QList<PackEntry> &entries);
+    bool writeHeader(const QString &entryName, qint64 size, qint64 mtime);
+    bool sync();
+};
+
+class PackReader {
+public:
+    explicit PackReader(const QString &packPath);
+
+    // Loads the index sidecar, or rebuilds it by walking the tar headers
+    // when there is none or the pack holds entries it doesn't list.
+    bool open();
+    const QList<PackEntry> &entries() const { return packEntries; }
+
+    bool extract(const PackEntry &entry, const QString &destinationDirectory);
+    bool extractAll(const QString &destinationDirectory);
+
+private:
+    QString packPath;
+    QList<PackEntry> packEntries;
+
+    bool loadIndex();
+    bool indexCoversPack() const;
+    bool scanHeaders();
+};
+
+#endif // PACK_WRITER_H
@@ -0,0 +1,19 @@
+#ifndef PHOTOS_LIBRARY_H
+#define PHOTOS_LIBRARY_H
+
+#include <QString>
+
+// Downloads every asset's original from the Photos library. At most
+// "photos/inFlight" requests are outstanding, and each holds
+// "photos/bufferMB" of the transfer budget from before it is made until
+// it finishes; data is written through a ChecksumWriter as it arrives
+// instead of being collected per asset. Blocks the calling thread, which
+// must not be the main thread.
+class PhotosLibrary {
+public:
+    // Asks for access the first time. False if access is denied or any
+    // asset failed.
+    static bool download(const QString &outputDirectory);
+};
+
+#endif // PHOTOS_LIBRARY_H
@@ -0,0 +1,128 @@
+#include "photos_library.h"
+#include "checksum.h"
+#include "memory_budget.h"
+#include <QAtomicInt>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+
+#import <Foundation/Foundation.h>
+#import <Photos/Photos.h>
+
+namespace {
+
+// One outstanding resource request, deleted by its completion handler
+struct PhotoRequest {
+    PhotoRequest(const QString &path, qint64 bytes) : reservation(MemoryStage::Transfer, bytes), output(path) {}
+
+    MemoryReservation reservation;
+    ChecksumWriter output;
+};
+
+PHAssetResource *originalResource(PHAsset *asset) {
+    for (PHAssetResource *resource in [PHAssetResource assetResourcesForAsset:asset]) {
+        if (resource.type == PHAssetResourceTypePhoto || resource.type == PHAssetResourceTypeVideo) {
+            return resource;
+        }
+    }
+    return nil;
+}
+
+bool authorized() {
+    __block PHAuthorizationStatus status = [PHPhotoLibrary authorizationStatus];
+    if (status == PHAuthorizationStatusNotDetermined) {
+        dispatch_semaphore_t answered = dispatch_semaphore_create(0);
+        [PHPhotoLibrary requestAuthorization:^(PHAuthorizationStatus result) {
+            status = result;
+            dispatch_semaphore_signal(answered);
+        }];
+        dispatch_semaphore_wait(answered, DISPATCH_TIME_FOREVER);
+        dispatch_release(answered);
+    }
+    return status == PHAuthorizationStatusAuthorized;
+}
+
+} // namespace
+
+bool PhotosLibrary::download(const QString &outputDirectory) {
+    if (!authorized()) {
+        qDebug() << "PhotosLibrary: Photo library access denied or restricted";
+        return false;
+    }
+    if (!QDir().mkpath(outputDirectory)) {
+        qDebug() << "PhotosLibrary: Cannot create" << outputDirectory;
+        return false;
+    }
+
+    QSettings settings;
+    const long inFlight = qMax(1, settings.value("photos/inFlight", 4).toInt());
+    const qint64 bufferBytes = qMax<qint64>(1, settings.value("photos/bufferMB", 8).toLongLong()) << 20;
+    const QDir directory(outputDirectory);
+
+    PHFetchOptions *fetchOptions = [[PHFetchOptions alloc] init];
+    fetchOptions.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"creationDate" ascending:NO]];
+    PHFetchResult<PHAsset *> *assets = [PHAsset fetchAssetsWithOptions:fetchOptions];
+    [fetchOptions release];
+    qDebug() << "PhotosLibrary: Found" << assets.count << "photos/videos";
+
+    PHAssetResourceRequestOptions *options = [[PHAssetResourceRequestOptions alloc] init];
+    options.networkAccessAllowed = YES;
+    dispatch_semaphore_t slots = dispatch_semaphore_create(inFlight);
+    QAtomicInt failures;
+    QAtomicInt *failed = &failures;
+
+    for (NSUInteger i = 0; i < assets.count; ++i) @autoreleasepool {
+        PHAssetResource *resource = originalResource([assets objectAtIndex:i]);
+        if (!resource) {
+            failed->ref();
+            continue;
+        }
+        const QString suffix = QFileInfo(QString::fromNSString(resource.originalFilename)).suffix().toLower();
+        const QString outputPath = directory.absoluteFilePath(
+            QString("IMG_%1.%2").arg(quint64(i + 1), 4, 10, QChar('0')).arg(suffix));
+
+        // The slot and the budget are taken before Photos allocates anything
+        // for the request; chunks are written as they arrive, so the
+        // reservation covers what a request has in flight
+        dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+        PhotoRequest *request = new PhotoRequest(outputPath, bufferBytes);
+        if (!request->output.open()) {
+            qDebug() << "PhotosLibrary: Cannot create" << outputPath;
+            delete request;
+            failed->ref();
+            dispatch_semaphore_signal(slots);
+            continue;
+        }
+        [[PHAssetResourceManager defaultManager] requestDataForAssetResource:resource options:options
+            dataReceivedHandler:^(NSData *data) {
+                request->output.write(static_cast<const char *>(data.bytes), qint64(data.length));
+            }
+            completionHandler:^(NSError *error) {
+                if (error) {
+                    qDebug() << "PhotosLibrary: Failed to download" << request->output.path() << ":"
+                             << QString::fromNSString(error.localizedDescription);
+                    request->output.abort();
+                    failed->ref();
+                } else if (!request->output.commit()) {
+                    failed->ref();
+                }
+                delete request;
+                dispatch_semaphore_signal(slots);
+            }];
+    }
+
+    // Let the last requests finish; libdispatch wants the semaphore back
+    // at its initial count before it is released
+    for (long i = 0; i < inFlight; ++i) {
+        dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+    }
+    for (long i = 0; i < inFlight; ++i) {
+        dispatch_semaphore_signal(slots);
+    }
+    dispatch_release(slots);
+    [options release];
+    qDebug() << "PhotosLibrary: Download finished," << failures.loadRelaxed() << "failed, peak pipeline memory"
+             << MemoryBudget::instance()->peak() / 1048576 << "MB";
+    return failures.loadRelaxed() == 0;
+}
@@ -0,0 +1,227 @@
+#include "resource_governor.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QThread>
+#include <algorithm>
+#include <string>
+
+#if defined(Q_OS_UNIX)
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if defined(Q_OS_MACOS)
+#include <sys/resource.h>
+#endif
+#if defined(Q_OS_LINUX)
+#include <sys/syscall.h>
+#endif
+
+ResourceGovernor *ResourceGovernor::instance() {
+    static ResourceGovernor governor;
+    return &governor;
+}
+
+ResourceGovernor::ResourceGovernor(QObject *parent) : QObject(parent) {
+    QSettings settings;
+    cgroupPath = settings.value("cgroupPath").toString();
+    if (!fromName(settings.value("importPriority", "foreground").toString(), &currentPriority)) {
+        currentPriority = ImportPriority::Foreground;
+    }
+    currentBudget = budgetFor(currentPriority);
+    configureCgroup(currentBudget);
+    clock.start();
+}
+
+ResourceBudget ResourceGovernor::budgetFor(ImportPriority priority) {
+    const int cores = QThread::idealThreadCount();
+    QSettings settings;
+    ResourceBudget budget;
+
+    switch (priority) {
+    case ImportPriority::Background:
+        budget.cores = std::max(1, cores / 4);
+        budget.niceLevel = 15;
+        budget.throttleIo = true;
+        budget.maxBytesPerSecond = qint64(settings.value("backgroundIoLimitMB", 50).toInt()) << 20;
+        break;
+    case ImportPriority::Foreground:
+        budget.cores = std::max(1, cores - 1);
+        break;
+    case ImportPriority::Turbo:
+        budget.cores = cores;
+        break;
+    }
+    // The video lane runs one encode next to the pool, so it takes a slot.
+    // In the background every encoder is held to an equal share of the
+    // cores; otherwise the share follows how many conversions are running.
+    budget.workers = std::max(1, budget.cores - 1);
+    if (priority == ImportPriority::Background) {
+        budget.encoderThreads = std::max(1, budget.cores / (budget.workers + 1));
+    }
+    return budget;
+}
+
+QString ResourceGovernor::name(ImportPriority priority) {
+    switch (priority) {
+    case ImportPriority::Background: return "background";
+    case ImportPriority::Foreground: return "foreground";
+    case ImportPriority::Turbo: return "turbo";
+    }
+    return QString();
+}
+
+bool ResourceGovernor::fromName(const QString &name, ImportPriority *priority) {
+    const QString lower = name.trimmed().toLower();
+    if (lower == "background") {
+        *priority = ImportPriority::Background;
+    } else if (lower == "foreground") {
+        *priority = ImportPriority::Foreground;
+    } else if (lower == "turbo") {
+        *priority = ImportPriority::Turbo;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ImportPriority ResourceGovernor::priority() const {
+    QMutexLocker locker(&mutex);
+    return currentPriority;
+}
+
+ResourceBudget ResourceGovernor::budget() const {
+    QMutexLocker locker(&mutex);
+    return currentBudget;
+}
+
+void ResourceGovernor::conversionStarted() {
+    ++conversions;
+}
+
+void ResourceGovernor::conversionFinished() {
+    --conversions;
+}
+
+int ResourceGovernor::runningConversions() const {
+    return std::max(0, conversions.load());
+}
+
+int ResourceGovernor::encoderThreads(int conversions) const {
+    const ResourceBudget budget = this->budget();
+    if (budget.encoderThreads > 0) {
+        return budget.encoderThreads;
+    }
+    return std::max(1, budget.cores / std::max(1, conversions));
+}
+
+int ResourceGovernor::encoderThreads() const {
+    return encoderThreads(runningConversions());
+}
+
+void ResourceGovernor::setPriority(ImportPriority priority) {
+    ResourceBudget budget = budgetFor(priority);
+    {
+        QMutexLocker locker(&mutex);
+        if (priority == currentPriority) {
+            return;
+        }
+        currentPriority = priority;
+        currentBudget = budget;
+        tokens = 0;
+    }
+    configureCgroup(budget);
+    qDebug() << "ResourceGovernor: Switched to" << name(priority) << "with" << budget.workers << "workers";
+    emit budgetChanged();
+}
+
+void ResourceGovernor::configureCgroup(const ResourceBudget &budget) {
+#if defined(Q_OS_LINUX)
+    if (cgroupPath.isEmpty()) {
+        return;
+    }
+    // cgroup v2 "cpu.max": quota and period in microseconds
+    QFile cpuMax(QDir(cgroupPath).absoluteFilePath("cpu.max"));
+    if (cpuMax.open(QIODevice::WriteOnly)) {
+        const QByteArray value = budget.niceLevel > 0
+            ? QByteArray::number(budget.cores * 100000) + " 100000"
+            : QByteArray("max 100000");
+        cpuMax.write(value);
+    } else {
+        qDebug() << "ResourceGovernor: cgroup" << cgroupPath << "is not writable";
+    }
+#else
+    Q_UNUSED(budget);
+#endif
+}
+
+void ResourceGovernor::applyToProcess(QProcess &process) const {
+#if defined(Q_OS_UNIX)
+    const ResourceBudget budget = this->budget();
+    if (budget.niceLevel == 0 && !budget.throttleIo && cgroupPath.isEmpty()) {
+        return;
+    }
+    const int niceLevel = budget.niceLevel;
+    const bool throttleIo = budget.throttleIo;
+    const std::string procs = cgroupPath.isEmpty()
+        ? std::string() : QDir(cgroupPath).absoluteFilePath("cgroup.procs").toStdString();
+
+    // Runs in the child between fork and exec: system calls only
+    process.setChildProcessModifier([niceLevel, throttleIo, procs]() {
+        if (niceLevel != 0) {
+            setpriority(PRIO_PROCESS, 0, niceLevel);
+        }
+        if (throttleIo) {
+#if defined(Q_OS_MACOS)
+            setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_PROCESS, IOPOL_THROTTLE);
+#elif defined(Q_OS_LINUX)
+            // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+            syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+        }
+#if defined(Q_OS_LINUX)
+        if (!procs.empty()) {
+            const int fd = open(procs.c_str(), O_WRONLY);
+            if (fd >= 0) {
+                char digits[16];
+                int length = 0;
+                for (pid_t pid = getpid(); pid > 0 && length < 16; pid /= 10) {
+                    digits[length++] = char('0' + pid % 10);
+                }
+                std::reverse(digits, digits + length);
+                (void)!write(fd, digits, length);
+                close(fd);
+            }
+        }
+#endif
+    });
+#else
+    Q_UNUSED(process);
+#endif
+}
+
+void ResourceGovernor::throttle(qint64 bytes) {
+    qint64 waitMs = 0;
+    {
+        QMutexLocker locker(&mutex);
+        const qint64 rate = currentBudget.maxBytesPerSecond;
+        if (rate <= 0) {
+            return;
+        }
+        // Token bucket holding at most one second of budget; going negative
+        // is debt that the caller sleeps off
+        const qint64 now = clock.elapsed();
+        tokens = std::min(rate, tokens + (now - lastRefill) * rate / 1000);
+        lastRefill = now;
+        tokens -= bytes;
+        if (tokens < 0) {
+            waitMs = -tokens * 1000 / rate;
+        }
+    }
+    if (waitMs > 0) {
+        QThread::msleep(waitMs);
+    }
+}
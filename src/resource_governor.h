@@ -0,0 +1,81 @@
+#ifndef RESOURCE_GOVERNOR_H
+#define RESOURCE_GOVERNOR_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QProcess>
+#include <QString>
+#include <atomic>
+
+enum class ImportPriority {
+    Background,  // few cores, niced and I/O-throttled children, capped bandwidth
+    Foreground,  // all but one core, normal priority
+    Turbo        // every core, no limits
+};
+
+struct ResourceBudget {
+    int cores = 1;                  // cores the whole batch may keep busy
+    int workers = 1;                // conversion pool threads
+    int encoderThreads = 0;         // fixed threads per encoder process, 0 = split the cores
+    int niceLevel = 0;
+    bool throttleIo = false;        // low I/O priority for child processes
+    qint64 maxBytesPerSecond = 0;   // our own writes, 0 = unlimited
+};
+
+// Process-wide CPU and I/O budget for the conversion and transfer stages.
+// Child processes pick up nice / I/O priority (and, on Linux, a delegated
+// cgroup v2 set with "cgroupPath") when they are started; worker counts and
+// the bandwidth cap follow priority changes immediately.
+class ResourceGovernor : public QObject {
+    Q_OBJECT
+
+public:
+    static ResourceGovernor *instance();
+
+    ImportPriority priority() const;
+    void setPriority(ImportPriority priority);
+    ResourceBudget budget() const;
+
+    // Conversions running right now, so each encoder can size its threads
+    // from the cores the others leave it.
+    void conversionStarted();
+    void conversionFinished();
+    int runningConversions() const;
+    // Threads for one encoder process while conversions (its own included)
+    // run: the budget's fixed share in the background, otherwise its cores
+    // split evenly over them.
+    int encoderThreads(int conversions) const;
+    int encoderThreads() const;
+
+    static QString name(ImportPriority priority);
+    static bool fromName(const QString &name, ImportPriority *priority);
+
+    // Call before QProcess::start().
+    void applyToProcess(QProcess &process) const;
+
+    // Blocks the calling thread long enough to keep our own writes under
+    // the bandwidth cap.
+    void throttle(qint64 bytes);
+
+signals:
+    void budgetChanged();
+
+private:
+    explicit ResourceGovernor(QObject *parent = nullptr);
+
+    mutable QMutex mutex;
+    ImportPriority currentPriority;
+    ResourceBudget currentBudget;
+    QString cgroupPath;
+    std::atomic<int> conversions{0};
+
+    QElapsedTimer clock;
+    qint64 tokens = 0;
+    qint64 lastRefill = 0;
+
+    static ResourceBudget budgetFor(ImportPriority priority);
+    void configureCgroup(const ResourceBudget &budget);
+};
+
+#endif // RESOURCE_GOVERNOR_H
@@ -0,0 +1,481 @@
+#include "session_recorder.h"
+#include "checksum.h"
+#include <QDebug>
+#include <QDir>
+#include <QMutexLocker>
+#include <QSet>
+#include <QThread>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char magic[] = "FEEDSESS";
+const quint64 formatVersion = 1;
+
+void putVarint(QByteArray &out, quint64 value) {
+    while (value >= 0x80) {
+        out.append(char(value | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+void putSigned(QByteArray &out, qint64 value) {
+    putVarint(out, (quint64(value) << 1) ^ quint64(value >> 63));  // zigzag
+}
+
+void putBytes(QByteArray &out, const QByteArray &bytes) {
+    putVarint(out, quint64(bytes.size()));
+    out.append(bytes);
+}
+
+void putString(QByteArray &out, const QString &text) {
+    putBytes(out, text.toUtf8());
+}
+
+class Decoder {
+public:
+    explicit Decoder(const QByteArray &data) : data(data) {}
+
+    bool atEnd() const { return position >= data.size(); }
+    bool failed() const { return error; }
+
+    quint64 varint() {
+        quint64 value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position >= data.size()) {
+                error = true;
+                return 0;
+            }
+            const uchar byte = uchar(data[position++]);
+            value |= quint64(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        error = true;
+        return 0;
+    }
+
+    qint64 signedVarint() {
+        const quint64 value = varint();
+        return qint64(value >> 1) ^ -qint64(value & 1);
+    }
+
+    QByteArray bytes() {
+        const quint64 size = varint();
+        if (error || size > quint64(data.size() - position)) {
+            error = true;
+            return QByteArray();
+        }
+        const QByteArray value = data.mid(position, int(size));
+        position += int(size);
+        return value;
+    }
+
+    QString string() {
+        return QString::fromUtf8(bytes());
+    }
+
+private:
+    const QByteArray &data;
+    int position = 0;
+    bool error = false;
+
+    friend bool readHeader(Decoder &decoder);
+};
+
+bool readHeader(Decoder &decoder) {
+    const int length = int(sizeof(magic) - 1);
+    if (decoder.data.size() < length || std::memcmp(decoder.data.constData(), magic, length) != 0) {
+        return false;
+    }
+    decoder.position = length;
+    return decoder.varint() == formatVersion && !decoder.failed();
+}
+
+// Serves a recorded transfer: the bytes are a deterministic pattern, the
+// timing follows the recorded throughput around each offset, and reads
+// past the point where a failed transfer stopped fail again.
+class ReplaySource : public RangedSource {
+public:
+    ReplaySource(const SessionReplay *replay, const SessionEvent &start, const QList<SessionEvent> &chunks, bool succeeded)
+        : replay(replay), fileName(start.name), fileSize(start.length), transferId(start.transferId),
+          chunks(chunks), succeeded(succeeded) {
+        std::sort(this->chunks.begin(), this->chunks.end(), [](const SessionEvent &a, const SessionEvent &b) {
+            return a.offset < b.offset;
+        });
+    }
+
+    QString name() const override { return fileName; }
+    qint64 size() const override { return fileSize; }
+
+    qint64 readAt(qint64 offset, char *data, qint64 length) override {
+        const SessionEvent *chunk = chunkAt(offset);
+        if (!chunk && !succeeded) {
+            return -1;
+        }
+        if (chunk && chunk->length > 0) {
+            replay->wait(chunk->durationUs * length / chunk->length);
+        }
+
+        // Pattern keyed on absolute position, so any chunking yields the same file
+        for (qint64 i = 0; i < length; ++i) {
+            const quint64 word = mix(quint64(transferId) << 40 ^ quint64((offset + i) >> 3));
+            data[i] = char(word >> (((offset + i) & 7) * 8));
+        }
+        return length;
+    }
+
+private:
+    const SessionReplay *replay;
+    QString fileName;
+    qint64 fileSize;
+    qint64 transferId;
+    QList<SessionEvent> chunks;
+    bool succeeded;
+
+    const SessionEvent *chunkAt(qint64 offset) const {
+        auto it = std::upper_bound(chunks.cbegin(), chunks.cend(), offset, [](qint64 value, const SessionEvent &chunk) {
+            return value < chunk.offset;
+        });
+        if (it == chunks.cbegin()) {
+            return nullptr;
+        }
+        --it;
+        return offset < it->offset + it->length ? &*it : nullptr;
+    }
+
+    static quint64 mix(quint64 x) {
+        // splitmix64 finalizer
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+};
+
+// Staging directories differ between runs, so any absolute path matches another
+bool sameArguments(const QStringList &recorded, const QStringList &arguments) {
+    if (recorded.size() != arguments.size()) {
+        return false;
+    }
+    for (int i = 0; i < recorded.size(); ++i) {
+        if (recorded[i] != arguments[i] && !(QDir::isAbsolutePath(recorded[i]) && QDir::isAbsolutePath(arguments[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+SessionRecorder *SessionRecorder::instance() {
+    static SessionRecorder recorder;
+    return &recorder;
+}
+
+bool SessionRecorder::start(const QString &path) {
+    QMutexLocker locker(&mutex);
+    if (file.isOpen()) {
+        file.close();
+    }
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "SessionRecorder: Cannot write" << path;
+        return false;
+    }
+    QByteArray header(magic, int(sizeof(magic) - 1));
+    putVarint(header, formatVersion);
+    file.write(header);
+    clock.start();
+    lastTimeUs = 0;
+    nextTransferId = 1;
+    qDebug() << "SessionRecorder: Recording to" << path;
+    return true;
+}
+
+void SessionRecorder::stop() {
+    QMutexLocker locker(&mutex);
+    if (file.isOpen()) {
+        file.close();
+    }
+}
+
+bool SessionRecorder::isRecording() const {
+    QMutexLocker locker(&mutex);
+    return file.isOpen();
+}
+
+void SessionRecorder::write(const SessionEvent &event) {
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen()) {
+        return;
+    }
+    // Times are stored as deltas, which stay small
+    const qint64 now = clock.nsecsElapsed() / 1000;
+    QByteArray record;
+    putVarint(record, quint64(event.type));
+    putVarint(record, quint64(std::max<qint64>(0, now - lastTimeUs)));
+    lastTimeUs = now;
+
+    switch (event.type) {
+    case SessionEventType::DeviceConnected:
+    case SessionEventType::DeviceDisconnected:
+        putString(record, event.name);
+        break;
+    case SessionEventType::Listing:
+    case SessionEventType::Command:
+        putVarint(record, quint64(event.values.size()));
+        for (const QString &value : event.values) {
+            putString(record, value);
+        }
+        if (event.type == SessionEventType::Command) {
+            putSigned(record, event.status);
+            putVarint(record, quint64(event.durationUs));
+            putBytes(record, event.output);
+        }
+        break;
+    case SessionEventType::TransferStart:
+        putVarint(record, quint64(event.transferId));
+        putString(record, event.name);
+        putVarint(record, quint64(event.length));
+        break;
+    case SessionEventType::TransferChunk:
+        putVarint(record, quint64(event.transferId));
+        putVarint(record, quint64(event.offset));
+        putVarint(record, quint64(event.length));
+        putVarint(record, event.crc);
+        putVarint(record, quint64(event.durationUs));
+        break;
+    case SessionEventType::TransferEnd:
+        putVarint(record, quint64(event.transferId));
+        putVarint(record, quint64(event.status));
+        break;
+    }
+    file.write(record);
+    if (event.type != SessionEventType::TransferChunk) {
+        file.flush();
+    }
+}
+
+void SessionRecorder::deviceConnected(const QString &name) {
+    SessionEvent event;
+    event.type = SessionEventType::DeviceConnected;
+    event.name = name;
+    write(event);
+}
+
+void SessionRecorder::deviceDisconnected(const QString &name) {
+    SessionEvent event;
+    event.type = SessionEventType::DeviceDisconnected;
+    event.name = name;
+    write(event);
+}
+
+void SessionRecorder::listing(const QStringList &files, const QStringList &sizes, const QStringList &dates) {
+    SessionEvent event;
+    event.type = SessionEventType::Listing;
+    for (int i = 0; i < files.size(); ++i) {
+        event.values << files[i] << sizes.value(i) << dates.value(i);
+    }
+    write(event);
+}
+
+void SessionRecorder::command(const QStringList &arguments, const QByteArray &output, int exitCode, qint64 durationUs) {
+    SessionEvent event;
+    event.type = SessionEventType::Command;
+    event.values = arguments;
+    event.output = output;
+    event.status = exitCode;
+    event.durationUs = durationUs;
+    write(event);
+}
+
+qint64 SessionRecorder::transferStarted(const QString &name, qint64 size) {
+    SessionEvent event;
+    event.type = SessionEventType::TransferStart;
+    {
+        QMutexLocker locker(&mutex);
+        event.transferId = nextTransferId++;
+    }
+    event.name = name;
+    event.length = size;
+    write(event);
+    return event.transferId;
+}
+
+void SessionRecorder::transferChunk(qint64 transferId, qint64 offset, qint64 length, quint32 crc, qint64 durationUs) {
+    SessionEvent event;
+    event.type = SessionEventType::TransferChunk;
+    event.transferId = transferId;
+    event.offset = offset;
+    event.length = length;
+    event.crc = crc;
+    event.durationUs = durationUs;
+    write(event);
+}
+
+void SessionRecorder::transferFinished(qint64 transferId, bool success) {
+    SessionEvent event;
+    event.type = SessionEventType::TransferEnd;
+    event.transferId = transferId;
+    event.status = success ? 1 : 0;
+    write(event);
+}
+
+qint64 RecordingSource::readAt(qint64 offset, char *data, qint64 length) {
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 read = source->readAt(offset, data, length);
+    if (read > 0) {
+        SessionRecorder::instance()->transferChunk(transferId, offset, read, crc32c(data, read),
+                                                   timer.nsecsElapsed() / 1000);
+    }
+    return read;
+}
+
+bool SessionReader::read(const QString &path, QList<SessionEvent> *events) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    Decoder decoder(data);
+    if (!readHeader(decoder)) {
+        qDebug() << "SessionReader: Not a session recording:" << path;
+        return false;
+    }
+
+    qint64 time = 0;
+    while (!decoder.atEnd()) {
+        SessionEvent event;
+        event.type = SessionEventType(decoder.varint());
+        time += qint64(decoder.varint());
+        event.timeUs = time;
+
+        switch (event.type) {
+        case SessionEventType::DeviceConnected:
+        case SessionEventType::DeviceDisconnected:
+            event.name = decoder.string();
+            break;
+        case SessionEventType::Listing:
+        case SessionEventType::Command: {
+            const quint64 count = decoder.varint();
+            for (quint64 i = 0; i < count && !decoder.failed(); ++i) {
+                event.values << decoder.string();
+            }
+            if (event.type == SessionEventType::Command) {
+                event.status = int(decoder.signedVarint());
+                event.durationUs = qint64(decoder.varint());
+                event.output = decoder.bytes();
+            }
+            break;
+        }
+        case SessionEventType::TransferStart:
+            event.transferId = qint64(decoder.varint());
+            event.name = decoder.string();
+            event.length = qint64(decoder.varint());
+            break;
+        case SessionEventType::TransferChunk:
+            event.transferId = qint64(decoder.varint());
+            event.offset = qint64(decoder.varint());
+            event.length = qint64(decoder.varint());
+            event.crc = quint32(decoder.varint());
+            event.durationUs = qint64(decoder.varint());
+            break;
+        case SessionEventType::TransferEnd:
+            event.transferId = qint64(decoder.varint());
+            event.status = int(decoder.varint());
+            break;
+        default:
+            qDebug() << "SessionReader: Unknown record type" << int(event.type) << "in" << path;
+            return !events->isEmpty();
+        }
+
+        // A recording cut short by a crash ends in a partial record
+        if (decoder.failed()) {
+            break;
+        }
+        events->append(event);
+    }
+    return true;
+}
+
+SessionReplay::SessionReplay(double speed) : replaySpeed(speed) {
+}
+
+bool SessionReplay::load(const QString &path) {
+    sessionEvents.clear();
+    commandCursor = 0;
+    transferCursors.clear();
+    return SessionReader::read(path, &sessionEvents);
+}
+
+void SessionReplay::wait(qint64 recordedUs) const {
+    if (replaySpeed <= 0.0 || recordedUs <= 0) {
+        return;
+    }
+    QThread::usleep(quint64(recordedUs / replaySpeed));
+}
+
+bool SessionReplay::replayCommand(const QStringList &arguments, QString *output) {
+    for (int i = commandCursor; i < sessionEvents.size(); ++i) {
+        const SessionEvent &event = sessionEvents[i];
+        if (event.type == SessionEventType::Command && sameArguments(event.values, arguments)) {
+            commandCursor = i + 1;
+            wait(event.durationUs);
+            *output = QString::fromUtf8(event.output);
+            return event.status == 0;
+        }
+    }
+    qDebug() << "SessionReplay: No recorded run of" << arguments;
+    return false;
+}
+
+std::unique_ptr<RangedSource> SessionReplay::transferSource(const QString &name, bool *ranged) {
+    const SessionEvent *start = nullptr;
+    int i = transferCursors.value(name);
+    for (; i < sessionEvents.size() && !start; ++i) {
+        const SessionEvent &event = sessionEvents[i];
+        if (event.type == SessionEventType::TransferStart && event.name == name) {
+            start = &event;
+        }
+    }
+    transferCursors.insert(name, i);
+    if (!start) {
+        return nullptr;
+    }
+
+    QList<SessionEvent> chunks;
+    bool succeeded = false;
+    for (; i < sessionEvents.size(); ++i) {
+        const SessionEvent &event = sessionEvents[i];
+        if (event.transferId != start->transferId) {
+            continue;
+        }
+        if (event.type == SessionEventType::TransferChunk) {
+            chunks << event;
+        } else if (event.type == SessionEventType::TransferEnd) {
+            succeeded = event.status != 0;
+            break;
+        }
+    }
+    if (ranged) {
+        *ranged = !chunks.isEmpty() || !succeeded;
+    }
+    return std::unique_ptr<RangedSource>(new ReplaySource(this, *start, chunks, succeeded));
+}
+
+QStringList SessionReplay::transferredFiles() const {
+    QStringList files;
+    QSet<QString> seen;
+    for (const SessionEvent &event : sessionEvents) {
+        if (event.type == SessionEventType::TransferStart && !seen.contains(event.name)) {
+            seen.insert(event.name);
+            files << event.name;
+        }
+    }
+    return files;
+}
@@ -0,0 +1,124 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include "chunked_transfer.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <memory>
+
+enum class SessionEventType : quint8 {
+    DeviceConnected = 1,
+    DeviceDisconnected,
+    Listing,
+    Command,
+    TransferStart,
+    TransferChunk,
+    TransferEnd
+};
+
+struct SessionEvent {
+    SessionEventType type = SessionEventType::DeviceConnected;
+    qint64 timeUs = 0;          // since the session started
+    QString name;               // device or file name
+    QStringList values;         // command arguments, or name/size/date triples of a listing
+    QByteArray output;          // command stdout
+    qint64 transferId = 0;
+    qint64 offset = 0;
+    qint64 length = 0;          // transfer size, or chunk length
+    qint64 durationUs = 0;      // command or chunk read duration
+    quint32 crc = 0;            // CRC32C of the chunk
+    int status = 0;             // command exit code, transfer success
+};
+
+// Records what the device did and when: connections, listings, Swift
+// command output and every transfer chunk's size, CRC and read time. The
+// file is a stream of varint-encoded records, a few bytes per chunk, so a
+// whole import session fits in kilobytes.
+class SessionRecorder {
+public:
+    static SessionRecorder *instance();
+
+    bool start(const QString &path);
+    void stop();
+    bool isRecording() const;
+
+    void deviceConnected(const QString &name);
+    void deviceDisconnected(const QString &name);
+    void listing(const QStringList &files, const QStringList &sizes, const QStringList &dates);
+    void command(const QStringList &arguments, const QByteArray &output, int exitCode, qint64 durationUs);
+    qint64 transferStarted(const QString &name, qint64 size);
+    void transferChunk(qint64 transferId, qint64 offset, qint64 length, quint32 crc, qint64 durationUs);
+    void transferFinished(qint64 transferId, bool success);
+
+private:
+    SessionRecorder() = default;
+
+    mutable QMutex mutex;
+    QFile file;
+    QElapsedTimer clock;
+    qint64 lastTimeUs = 0;
+    qint64 nextTransferId = 1;
+
+    void write(const SessionEvent &event);
+};
+
+// Wraps a source and records each chunk it serves.
+class RecordingSource : public RangedSource {
+public:
+    RecordingSource(RangedSource *source, qint64 transferId) : source(source), transferId(transferId) {}
+
+    QString name() const override { return source->name(); }
+    qint64 size() const override { return source->size(); }
+    qint64 readAt(qint64 offset, char *data, qint64 length) override;
+
+private:
+    RangedSource *source;
+    qint64 transferId;
+};
+
+class SessionReader {
+public:
+    static bool read(const QString &path, QList<SessionEvent> *events);
+};
+
+// Plays a recorded session back to a SwiftWrapper instead of a device:
+// Swift commands return their recorded output after the recorded delay,
+// and transfers are served by ReplaySource at the recorded per-chunk
+// throughput. speed scales every delay (2 = twice as fast, 0 = no waiting
+// at all).
+class SessionReplay {
+public:
+    explicit SessionReplay(double speed = 1.0);
+    SessionReplay(const SessionReplay &) = delete;
+    SessionReplay &operator=(const SessionReplay &) = delete;
+
+    bool load(const QString &path);
+    const QList<SessionEvent> &events() const { return sessionEvents; }
+    double speed() const { return replaySpeed; }
+
+    // Next recorded run of this command, in session order. Absolute paths
+    // match any other, since staging directories differ between runs.
+    bool replayCommand(const QStringList &arguments, QString *output);
+
+    // Next recorded transfer of this device file, in session order, or
+    // nullptr. ranged is false when it came whole from the Swift helper,
+    // so only its size was recorded.
+    std::unique_ptr<RangedSource> transferSource(const QString &name, bool *ranged = nullptr);
+    // Device files in the order of their first recorded transfer.
+    QStringList transferredFiles() const;
+
+    void wait(qint64 recordedUs) const;
+
+private:
+    double replaySpeed;
+    QList<SessionEvent> sessionEvents;
+    int commandCursor = 0;
+    QHash<QString, int> transferCursors;
+};
+
+#endif // SESSION_RECORDER_H
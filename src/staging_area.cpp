@@ -0,0 +1,137 @@
+#include "staging_area.h"
+#include "checksum.h"
+#include "fanout_writer.h"
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStorageInfo>
+
+StagingArea::StagingArea(const QString &outputDirectory, bool separate)
+    : outputDirectory(outputDirectory) {
+    QSettings settings;
+    budget = qMax<qint64>(0, settings.value("staging/maxMB", 2048).toLongLong()) << 20;
+
+    scratchDirectory = QDir(scratchRoot()).absoluteFilePath("feeder-work");
+    if (!QDir().mkpath(scratchDirectory)) {
+        qDebug() << "StagingArea: Cannot create" << scratchDirectory;
+        scratchDirectory.clear();
+    }
+
+    if (!separate) {
+        fallbackDirectory = outputDirectory;
+    } else {
+        // Packs and fan-out copy their outputs anyway, so keep originals on
+        // local disk rather than on a (possibly slow or shared) destination
+        fallbackDirectory = QDir(QDir::tempPath()).absoluteFilePath("feeder-staging");
+    }
+
+    // Nothing is gained by staging on the volume the outputs end up on anyway
+    if (!separate && !scratchDirectory.isEmpty() && sameFilesystem(scratchDirectory, outputDirectory)) {
+        scratchDirectory.clear();
+    }
+}
+
+QString StagingArea::directoryFor(qint64 bytes) {
+    // An original and its output sit side by side until the original goes
+    const qint64 needed = 2 * qMax<qint64>(0, bytes);
+    QString directory = fallbackDirectory;
+    if (!scratchDirectory.isEmpty()) {
+        QStorageInfo volume(scratchDirectory);
+        const bool roomLeft = volume.bytesAvailable() - needed > volume.bytesTotal() / 10;
+        if (roomLeft && usedBytes() + needed <= budget) {
+            directory = scratchDirectory;
+        }
+    }
+
+    if (directory == fallbackDirectory && !handedOut.contains(directory)) {
+        qDebug() << "StagingArea: Scratch space is full, staging on" << directory;
+    }
+    QDir().mkpath(directory);
+    if (!handedOut.contains(directory)) {
+        handedOut << directory;
+    }
+    return directory;
+}
+
+QStringList StagingArea::directories() const {
+    return handedOut;
+}
+
+QStringList StagingArea::stagedDirectories() const {
+    QStringList staged = handedOut;
+    staged.removeAll(outputDirectory);
+    return staged;
+}
+
+void StagingArea::cleanup() {
+    for (const QString &directory : stagedDirectories()) {
+        // rmdir only succeeds on what publishing emptied
+        QDir().rmdir(directory);
+    }
+}
+
+QString StagingArea::scratchRoot() {
+    QSettings settings;
+    const QString configured = settings.value("staging/path").toString();
+    if (!configured.isEmpty()) {
+        return configured;
+    }
+    QFileInfo shm("/dev/shm");
+    if (shm.isDir() && shm.isWritable()) {
+        return shm.absoluteFilePath();
+    }
+    return QDir::tempPath();
+}
+
+bool StagingArea::sameFilesystem(const QString &path, const QString &otherPath) {
+    QStorageInfo volume(path);
+    QStorageInfo otherVolume(otherPath);
+    return volume.isValid() && otherVolume.isValid() && volume.device() == otherVolume.device()
+           && volume.rootPath() == otherVolume.rootPath();
+}
+
+bool StagingArea::moveFile(const QString &sourcePath, const QString &targetPath) {
+    const QString targetDirectory = QFileInfo(targetPath).absolutePath();
+    if (!QDir().mkpath(targetDirectory)) {
+        qDebug() << "StagingArea: Cannot create" << targetDirectory;
+        return false;
+    }
+
+    // QFile::rename would quietly copy across volumes, so only use it within one
+    if (sameFilesystem(sourcePath, targetDirectory)) {
+        quint32 crc = 0;
+        qint64 size = 0;
+        const bool known = ChecksumManifest::lookup(sourcePath, &crc, &size);
+        QFile::remove(targetPath);
+        if (!QFile::rename(sourcePath, targetPath)) {
+            qDebug() << "StagingArea: Cannot move" << sourcePath << "to" << targetPath;
+            return false;
+        }
+        if (known) {
+            ChecksumManifest::record(targetPath, crc, size);
+        } else {
+            ChecksumManifest::recordFile(targetPath);
+        }
+        return true;
+    }
+
+    if (!FanoutWriter::copyFile(sourcePath, QStringList() << targetPath)) {
+        qDebug() << "StagingArea: Cannot copy" << sourcePath << "to" << targetPath;
+        return false;
+    }
+    QFile::remove(sourcePath);
+    return true;
+}
+
+qint64 StagingArea::usedBytes() const {
+    qint64 used = 0;
+    QDirIterator files(scratchDirectory, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+    while (files.hasNext()) {
+        files.next();
+        used += files.fileInfo().size();
+    }
+    return used;
+}
@@ -0,0 +1,42 @@
+#ifndef STAGING_AREA_H
+#define STAGING_AREA_H
+
+#include <QString>
+#include <QStringList>
+
+// Where downloaded originals wait for their conversion. They go to a
+// scratch directory on fast local storage ("staging/path", otherwise
+// /dev/shm when the system has one, otherwise the temp directory) while it
+// stays under "staging/maxMB" and its volume keeps some room; past that the
+// batch falls back to disk. Only finished outputs reach the destination.
+class StagingArea {
+public:
+    // separate: the output directory can't double as scratch space (packs,
+    // several destinations), so the fallback is a folder in the temp directory
+    StagingArea(const QString &outputDirectory, bool separate);
+
+    // Directory to download about bytes more into.
+    QString directoryFor(qint64 bytes);
+    // Every directory handed out so far, and those that still need publishing.
+    QStringList directories() const;
+    QStringList stagedDirectories() const;
+    // Removes staging directories that publishing left empty.
+    void cleanup();
+
+    static QString scratchRoot();
+    static bool sameFilesystem(const QString &path, const QString &otherPath);
+    // Renames sourcePath into place when both are on one filesystem and
+    // streams it over in one copy otherwise. The manifest entry goes along.
+    static bool moveFile(const QString &sourcePath, const QString &targetPath);
+
+private:
+    QString outputDirectory;
+    QString scratchDirectory;
+    QString fallbackDirectory;
+    qint64 budget;
+    QStringList handedOut;
+
+    qint64 usedBytes() const;
+};
+
+#endif // STAGING_AREA_H
@@ -0,0 +1,373 @@
+#include "stream_converter.h"
+#include "checksum.h"
+#include "transcode_supervisor.h"
+#include <QBuffer>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QThread>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+const qint64 readChunk = 1 << 20;
+
+QString toolPath(const QString &name) {
+    const QString homebrew = "/opt/homebrew/bin/" + name;
+    return QFileInfo::exists(homebrew) ? homebrew : name;
+}
+
+qint64 settingBytes(const char *key, qint64 defaultMegabytes) {
+    QSettings settings;
+    return qMax<qint64>(1, settings.value(key, defaultMegabytes).toLongLong()) << 20;
+}
+
+bool readFully(RangedSource *source, qint64 offset, char *data, qint64 length) {
+    for (qint64 done = 0; done < length; done += readChunk) {
+        const qint64 part = qMin(readChunk, length - done);
+        if (source->readAt(offset + done, data + done, part) != part) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Box header at data: returns its length, or 0 if it is cut off. *size is
+// -1 for a box that runs to the end of its parent.
+int boxHeader(const uchar *data, qint64 available, qint64 *size) {
+    if (available < 8) {
+        return 0;
+    }
+    *size = qFromBigEndian<quint32>(data);
+    if (*size == 1) {
+        if (available < 16) {
+            return 0;
+        }
+        *size = qint64(qFromBigEndian<quint64>(data + 8));
+        return 16;
+    }
+    if (*size == 0) {
+        *size = -1;
+    }
+    return 8;
+}
+
+// Same for a box held in memory, which has to fit in what is left.
+int memoryBox(const uchar *data, qint64 available, qint64 *size) {
+    const int header = boxHeader(data, available, size);
+    if (*size < 0) {
+        *size = available;
+    }
+    return header != 0 && *size >= header && *size <= available ? header : 0;
+}
+
+bool shiftBoxes(uchar *data, qint64 size, qint64 from, qint64 to, qint64 shift) {
+    qint64 pos = 0;
+    while (pos < size) {
+        qint64 boxSize = 0;
+        const int header = memoryBox(data + pos, size - pos, &boxSize);
+        if (header == 0) {
+            return false;
+        }
+        const QByteArray type(reinterpret_cast<const char *>(data + pos + 4), 4);
+        uchar *body = data + pos + header;
+        const qint64 bodySize = boxSize - header;
+
+        if (type == "trak" || type == "mdia" || type == "minf" || type == "stbl") {
+            if (!shiftBoxes(body, bodySize, from, to, shift)) {
+                return false;
+            }
+        } else if (type == "stco" || type == "co64") {
+            // version and flags, entry count, then the offsets
+            const bool wide = type == "co64";
+            const qint64 entrySize = wide ? 8 : 4;
+            if (bodySize < 8) {
+                return false;
+            }
+            const qint64 count = qFromBigEndian<quint32>(body + 4);
+            if (8 + count * entrySize > bodySize) {
+                return false;
+            }
+            for (qint64 i = 0; i < count; ++i) {
+                uchar *entry = body + 8 + i * entrySize;
+                qint64 offset = wide ? qint64(qFromBigEndian<quint64>(entry)) : qFromBigEndian<quint32>(entry);
+                if (offset >= from && offset < to) {
+                    offset += shift;
+                }
+                if (wide) {
+                    qToBigEndian<quint64>(quint64(offset), entry);
+                } else if (offset > 0xffffffffll) {
+                    // Would need the table widened to co64
+                    return false;
+                } else {
+                    qToBigEndian<quint32>(quint32(offset), entry);
+                }
+            }
+        } else if (type == "cmov") {
+            return false;
+        }
+        pos += boxSize;
+    }
+    return true;
+}
+
+} // namespace
+
+ByteRing::ByteRing(qint64 capacity)
+    : reservation(MemoryStage::Transfer, qMax<qint64>(1, capacity)),
+      buffer(int(qMax<qint64>(1, capacity)), Qt::Uninitialized) {
+}
+
+bool ByteRing::write(const char *data, qint64 size) {
+    QMutexLocker locker(&mutex);
+    while (size > 0) {
+        while (used == buffer.size() && !cancelled) {
+            writable.wait(&mutex);
+        }
+        if (cancelled) {
+            return false;
+        }
+        const qint64 tail = (head + used) % buffer.size();
+        const qint64 part = qMin(size, qMin(buffer.size() - used, buffer.size() - tail));
+        std::memcpy(buffer.data() + tail, data, size_t(part));
+        used += part;
+        data += part;
+        size -= part;
+        readable.wakeOne();
+    }
+    return true;
+}
+
+void ByteRing::finish(bool success) {
+    QMutexLocker locker(&mutex);
+    finished = true;
+    failed = !success;
+    readable.wakeAll();
+}
+
+qint64 ByteRing::read(char *data, qint64 maxSize) {
+    QMutexLocker locker(&mutex);
+    while (used == 0 && !finished) {
+        readable.wait(&mutex);
+    }
+    if (used == 0) {
+        return failed ? -1 : 0;
+    }
+    const qint64 part = qMin(maxSize, qMin(used, buffer.size() - head));
+    std::memcpy(data, buffer.constData() + head, size_t(part));
+    head = (head + part) % buffer.size();
+    used -= part;
+    writable.wakeOne();
+    return part;
+}
+
+void ByteRing::cancel() {
+    QMutexLocker locker(&mutex);
+    cancelled = true;
+    writable.wakeAll();
+}
+
+StreamConverter::StreamConverter(RangedSource *source) : source(source) {
+}
+
+bool StreamConverter::convertImage(const ImageRenditioner &renditioner, const QString &outputDirectory,
+                                   const QString &baseName) {
+    const qint64 size = source->size();
+    if (size <= 0 || size > settingBytes("stream/imageMB", 64)) {
+        return false;
+    }
+    // Still transfer bytes: render() takes its own decode reservation
+    MemoryReservation held(MemoryStage::Transfer, size);
+    QByteArray bytes(int(size), Qt::Uninitialized);
+    if (!readFully(source, 0, bytes.data(), size)) {
+        qDebug() << "StreamConverter: Cannot read" << source->name();
+        return false;
+    }
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    return renditioner.render(&buffer, outputDirectory, baseName);
+}
+
+bool StreamConverter::convertVideo(const QString &outputPath, const QStringList &codecArguments) {
+    if (!planVideo()) {
+        return false;
+    }
+
+    ByteRing ring(settingBytes("stream/ringMB", 32));
+    QThread *reader = QThread::create([this, &ring]() { produce(&ring); });
+    reader->start();
+
+    const QString partPath = outputPath + ".part";
+    TranscodeSupervisor supervisor;
+    supervisor.setOutputPath(partPath);
+    supervisor.setInput([&ring](QByteArray *chunk) {
+        chunk->resize(int(readChunk));
+        const qint64 received = ring.read(chunk->data(), chunk->size());
+        chunk->resize(int(qMax<qint64>(0, received)));
+        return received >= 0;
+    });
+    // Only the input is a pipe; the output is an ordinary MP4 with the
+    // index moved to the front, staged under ".part"
+    const QStringList arguments = QStringList()
+        << "-f" << "mov" << "-i" << "pipe:0"
+        << codecArguments
+        << "-f" << "mp4" << "-movflags" << "+faststart"
+        << "-y" << partPath;
+    bool success = supervisor.run(QFileInfo(source->name()).fileName(), toolPath("ffmpeg"), arguments,
+                                  durationSeconds);
+
+    ring.cancel();
+    reader->wait();
+    delete reader;
+    if (!success) {
+        return false;
+    }
+    QFile::remove(outputPath);
+    if (!QFile::rename(partPath, outputPath)) {
+        qDebug() << "StreamConverter: Cannot move" << partPath << "into place";
+        QFile::remove(partPath);
+        return false;
+    }
+    if (!isCompleteMediaFile(outputPath) || !ChecksumManifest::recordFile(outputPath)) {
+        qDebug() << "StreamConverter: Incomplete output" << outputPath;
+        QFile::remove(outputPath);
+        return false;
+    }
+    return true;
+}
+
+bool StreamConverter::readBoxes(RangedSource *source, QList<MediaBox> *boxes) {
+    const qint64 total = source->size();
+    qint64 offset = 0;
+    while (offset < total) {
+        uchar header[16];
+        const qint64 available = qMin<qint64>(sizeof(header), total - offset);
+        if (available < 8 || !readFully(source, offset, reinterpret_cast<char *>(header), available)) {
+            return false;
+        }
+        qint64 size = 0;
+        const int headerSize = boxHeader(header, available, &size);
+        if (size < 0) {
+            size = total - offset;
+        }
+        if (headerSize == 0 || size < headerSize || size > total - offset) {
+            return false;
+        }
+        boxes->append({QByteArray(reinterpret_cast<const char *>(header + 4), 4), offset, size});
+        offset += size;
+    }
+    return true;
+}
+
+bool StreamConverter::shiftChunkOffsets(QByteArray *moov, qint64 from, qint64 to, qint64 shift) {
+    uchar *data = reinterpret_cast<uchar *>(moov->data());
+    qint64 size = 0;
+    const int header = memoryBox(data, moov->size(), &size);
+    return header != 0 && shiftBoxes(data + header, size - header, from, to, shift);
+}
+
+double StreamConverter::movieDuration(const QByteArray &moov) {
+    const uchar *data = reinterpret_cast<const uchar *>(moov.constData());
+    qint64 size = 0;
+    qint64 pos = memoryBox(data, moov.size(), &size);
+    while (pos > 0 && pos < moov.size()) {
+        qint64 boxSize = 0;
+        const int header = memoryBox(data + pos, moov.size() - pos, &boxSize);
+        if (header == 0) {
+            break;
+        }
+        if (std::memcmp(data + pos + 4, "mvhd", 4) == 0 && boxSize >= header + 32) {
+            // Version 1 has 64-bit times and duration
+            const uchar *body = data + pos + header;
+            const bool wide = body[0] == 1;
+            const quint32 timescale = qFromBigEndian<quint32>(body + (wide ? 20 : 12));
+            const quint64 duration = wide ? qFromBigEndian<quint64>(body + 24) : qFromBigEndian<quint32>(body + 16);
+            return timescale > 0 ? double(duration) / timescale : 0.0;
+        }
+        pos += boxSize;
+    }
+    return 0.0;
+}
+
+bool StreamConverter::planVideo() {
+    QList<MediaBox> boxes;
+    if (!readBoxes(source, &boxes)) {
+        qDebug() << "StreamConverter:" << source->name() << "is not an ISO media file";
+        return false;
+    }
+    int moovIndex = -1;
+    int mdatIndex = -1;
+    for (int i = 0; i < boxes.size(); ++i) {
+        if (boxes[i].type == "moov" && moovIndex < 0) {
+            moovIndex = i;
+        } else if (boxes[i].type == "mdat" && mdatIndex < 0) {
+            mdatIndex = i;
+        }
+    }
+    if (moovIndex < 0 || mdatIndex < 0) {
+        return false;
+    }
+
+    const MediaBox moovBox = boxes[moovIndex];
+    const qint64 total = source->size();
+    pieces.clear();
+    durationSeconds = 0.0;
+    if (moovBox.size > settingBytes("stream/indexMB", 16)) {
+        if (moovIndex > mdatIndex) {
+            qDebug() << "StreamConverter: Index of" << source->name() << "is too large to move ahead";
+            return false;
+        }
+        pieces.append({QByteArray(), 0, total});
+        return true;
+    }
+
+    QByteArray moov(int(moovBox.size), Qt::Uninitialized);
+    if (!readFully(source, moovBox.offset, moov.data(), moov.size())) {
+        return false;
+    }
+    durationSeconds = movieDuration(moov);
+    if (moovIndex < mdatIndex) {
+        pieces.append({QByteArray(), 0, total});
+        return true;
+    }
+
+    // The index goes right before the first mdat, and everything from there
+    // up to where it was moves down by its size
+    const qint64 insertAt = boxes[mdatIndex].offset;
+    if (!shiftChunkOffsets(&moov, insertAt, moovBox.offset, moovBox.size)) {
+        qDebug() << "StreamConverter: Cannot move the index of" << source->name();
+        return false;
+    }
+    pieces.append({QByteArray(), 0, insertAt});
+    pieces.append({moov, 0, 0});
+    pieces.append({QByteArray(), insertAt, moovBox.offset - insertAt});
+    pieces.append({QByteArray(), moovBox.offset + moovBox.size, total - moovBox.offset - moovBox.size});
+    return true;
+}
+
+void StreamConverter::produce(ByteRing *ring) const {
+    QByteArray chunk(int(readChunk), Qt::Uninitialized);
+    for (const Piece &piece : pieces) {
+        if (!piece.bytes.isEmpty()) {
+            if (!ring->write(piece.bytes.constData(), piece.bytes.size())) {
+                return;
+            }
+            continue;
+        }
+        for (qint64 done = 0; done < piece.length; done += readChunk) {
+            const qint64 part = qMin(readChunk, piece.length - done);
+            if (source->readAt(piece.offset + done, chunk.data(), part) != part) {
+                qDebug() << "StreamConverter: Read failed in" << source->name() << "at" << piece.offset + done;
+                ring->finish(false);
+                return;
+            }
+            if (!ring->write(chunk.constData(), part)) {
+                return;
+            }
+        }
+    }
+    ring->finish(true);
+}
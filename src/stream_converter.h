@@ -0,0 +1,92 @@
+#ifndef STREAM_CONVERTER_H
+#define STREAM_CONVERTER_H
+
+#include "chunked_transfer.h"
+#include "image_renditions.h"
+#include "memory_budget.h"
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+
+// Fixed-size byte queue between one reader thread and one consumer. The
+// writer blocks while it is full and the reader while it is empty. Its
+// capacity is held against the transfer budget.
+class ByteRing {
+public:
+    explicit ByteRing(qint64 capacity);
+
+    // Returns false once the consumer has cancelled.
+    bool write(const char *data, qint64 size);
+    void finish(bool success);
+
+    // Bytes read, 0 at the end of the stream, -1 if the writer failed.
+    qint64 read(char *data, qint64 maxSize);
+    void cancel();
+
+private:
+    MemoryReservation reservation;
+    QByteArray buffer;
+    qint64 head = 0;
+    qint64 used = 0;
+    QMutex mutex;
+    QWaitCondition readable;
+    QWaitCondition writable;
+    bool finished = false;
+    bool failed = false;
+    bool cancelled = false;
+};
+
+// One top-level ISO BMFF box (ftyp, moov, mdat, ...).
+struct MediaBox {
+    QByteArray type;
+    qint64 offset = 0;
+    qint64 size = 0;
+};
+
+// Converts a file straight off a RangedSource, so only the outputs touch
+// disk. Images are read into memory (up to "stream/imageMB") and decoded
+// from a QBuffer. Videos go through a ring buffer ("stream/ringMB") into
+// ffmpeg's stdin. A pipe can't seek, so the index (moov) has to come
+// before the media data; when it comes last it is read first, in a buffer
+// of at most "stream/indexMB", and moved ahead with its chunk offsets
+// patched. Videos come out as ordinary +faststart MP4s, checked for
+// completeness and checksummed once ffmpeg has written them. Either call
+// returns false when the file can't be streamed, and the caller downloads
+// it as usual.
+class StreamConverter {
+public:
+    explicit StreamConverter(RangedSource *source);
+
+    bool convertImage(const ImageRenditioner &renditioner, const QString &outputDirectory,
+                      const QString &baseName);
+    // codecArguments sit between the input and the output, e.g. "-c copy".
+    // The output is always MP4.
+    bool convertVideo(const QString &outputPath, const QStringList &codecArguments);
+
+    // The source's top-level boxes; false if they don't add up to the file.
+    static bool readBoxes(RangedSource *source, QList<MediaBox> *boxes);
+    // Adds shift to every chunk offset (stco/co64) in [from, to) inside moov.
+    static bool shiftChunkOffsets(QByteArray *moov, qint64 from, qint64 to, qint64 shift);
+    // Movie duration from the mvhd box, 0 if it has none.
+    static double movieDuration(const QByteArray &moov);
+
+private:
+    // In-memory bytes, or else a range of the source
+    struct Piece {
+        QByteArray bytes;
+        qint64 offset = 0;
+        qint64 length = 0;
+    };
+
+    RangedSource *source;
+    QList<Piece> pieces;
+    double durationSeconds = 0.0;
+
+    bool planVideo();
+    void produce(ByteRing *ring) const;
+};
+
+#endif // STREAM_CONVERTER_H
@@ -6,6 +6,7 @@
 //
 
 #include "swift_device_controller.h"
+#include "media_types.h"
 #include <QTimer>
 #include <QDebug>
 
@@ -135,14 +136,16 @@
         selectedIndex++;
         NSString *fileExtension = [file.name pathExtension];
         
-        NSArray *imageExtensions = @[@"jpg", @"jpeg", @"png", @"heic", @"heif", @"tif", @"tiff"];
-        NSArray *videoExtensions = @[@"mov", @"mp4", @"m4v", @"avi"];
-        
         NSString *typePrefix = @"_FILE_";
-        if ([imageExtensions containsObject:[fileExtension lowercaseString]]) {
+        switch (mediaKind(mediaTypeForExtension(fileExtension.UTF8String ?: ""))) {
+        case MediaKind::Image:
             typePrefix = @"_IMG_";
-        } else if ([videoExtensions containsObject:[fileExtension lowercaseString]]) {
+            break;
+        case MediaKind::Video:
             typePrefix = @"_VID_";
+            break;
+        default:
+            break;
         }
         
         NSString *fileNumber = [NSString stringWithFormat:@"%04d", selectedIndex];
@@ -198,14 +201,16 @@
         NSString *originalName = file.name ?: @"file";
         NSString *fileExtension = [originalName pathExtension];
         
-        NSArray *imageExtensions = @[@"jpg", @"jpeg", @"png", @"heic", @"heif", @"tif", @"tiff"];
-        NSArray *videoExtensions = @[@"mov", @"mp4", @"m4v", @"avi"];
-        
         NSString *typePrefix = @"_FILE_";
-        if ([imageExtensions containsObject:[fileExtension lowercaseString]]) {
+        switch (mediaKind(mediaTypeForExtension(fileExtension.UTF8String ?: ""))) {
+        case MediaKind::Image:
             typePrefix = @"_IMG_";
-        } else if ([videoExtensions containsObject:[fileExtension lowercaseString]]) {
+            break;
+        case MediaKind::Video:
             typePrefix = @"_VID_";
+            break;
+        default:
+            break;
         }
         
         NSString *fileNumber = [NSString stringWithFormat:@"%04d", index + 1];
@@ -1,32 +1,110 @@
 #include "swift_wrapper.h"
+#include "checksum.h"
+#include "clustering.h"
+#include "device_files.h"
+#include "encode_planner.h"
+#include "fanout_writer.h"
+#include "job_scheduler.h"
+#include "memory_budget.h"
+#include "media_types.h"
+#include "metrics.h"
+#include "pack_writer.h"
+#include "resource_governor.h"
+#include "session_recorder.h"
+#include "staging_area.h"
+#include "stream_converter.h"
+#include "transcode_supervisor.h"
 #include <QDir>
 #include <QDebug>
 #include <QFileInfo>
 #include <QFile>
 #include <QThread>
+#include <QSettings>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <functional>
+#include <memory>
+
+namespace {
+
+// Times one conversion and books it under its source codec
+bool recordConversion(const QString &codec, const std::function<bool()> &convert) {
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    const QString label = QString("{codec=\"%1\"}").arg(codec);
+    Histogram *seconds = metrics->histogram("feeder_conversion_seconds" + label, "Conversion latency per source codec.");
+    
+    QElapsedTimer timer;
+    timer.start();
+    bool success = convert();
+    seconds->record(timer.nsecsElapsed() / 1000);
+    
+    if (success) {
+        metrics->counter("feeder_conversions_total" + label, "Completed conversions per source codec.")->add();
+    } else {
+        metrics->counter("feeder_conversion_failures_total" + label, "Failed conversions per source codec.")->add();
+    }
+    metrics->gauge("feeder_batch_converted_files", "Conversions finished in the current batch.")->add(1);
+    return success;
+}
+
+} // namespace
 
 SwiftWrapper::SwiftWrapper(QObject *parent) : QObject(parent) {
     // Set path to the Swift app
     swiftAppPath = "/Users/thomaskidane/Documents/Projects/FeederSwiftApp/FeederSwiftApp.swift";
+    
+    // Image renditions are CPU-bound and independent; the import priority
+    // decides how many cores they get, and follows changes mid-batch
+    conversionPool = new QThreadPool(this);
+    ResourceGovernor *governor = ResourceGovernor::instance();
+    conversionPool->setMaxThreadCount(governor->budget().workers);
+    videoPool = new QThreadPool(this);
+    videoPool->setMaxThreadCount(1);
+    connect(governor, &ResourceGovernor::budgetChanged, this, [this, governor]() {
+        conversionPool->setMaxThreadCount(governor->budget().workers);
+    });
+    renditionSpecs = ImageRenditioner::loadSpecs();
+    outputFormats = FormatEncoder::loadSettings();
+    registerDefaultConverters();
+    policy = ConversionPolicy::load();
+    
+    QSettings settings;
+    outputMode = settings.value("outputMode").toString() == "pack" ? OutputMode::Pack : OutputMode::Files;
 }
 
 SwiftWrapper::~SwiftWrapper() {
+    conversionPool->waitForDone();
+    videoPool->waitForDone();
+}
+
+void SwiftWrapper::setReplay(SessionReplay *replay) {
+    this->replay = replay;
 }
 
 bool SwiftWrapper::runSwiftCommand(const QStringList &args, QString &output) {
+    if (replay) {
+        return replay->replayCommand(args, &output);
+    }
+    
     QProcess process;
     process.setProgram("swift");
     process.setArguments(QStringList() << swiftAppPath << args);
     
     qDebug() << "SwiftWrapper: Running command: swift" << swiftAppPath << args;
     
+    JobScheduler::instance()->track(process);
+    QElapsedTimer timer;
+    timer.start();
     process.start();
-    if (!process.waitForFinished(30000)) { // 30 second timeout
+    if (!JobScheduler::instance()->waitForFinished(process, 30000)) { // 30 second timeout
         qDebug() << "SwiftWrapper: Swift command timed out";
         return false;
     }
     
-    output = QString::fromUtf8(process.readAllStandardOutput());
+    const QByteArray standardOutput = process.readAllStandardOutput();
+    SessionRecorder::instance()->command(args, standardOutput, process.exitCode(), timer.nsecsElapsed() / 1000);
+    output = QString::fromUtf8(standardOutput);
     QString error = QString::fromUtf8(process.readAllStandardError());
     
     qDebug() << "SwiftWrapper: Exit code:" << process.exitCode();
@@ -45,9 +123,13 @@ bool SwiftWrapper::runSwiftCommand(const QStringList &args, QString &output) {
 void SwiftWrapper::startDeviceDiscovery() {
     // Run the full workflow in one call
     QString output;
+    QElapsedTimer timer;
+    timer.start();
     if (runSwiftCommand(QStringList() << "full", output)) {
         // Parse the output to extract files and sizes
         parseFileList(output);
+        MetricsRegistry::instance()->histogram("feeder_listing_seconds", "Time to list the device.")
+            ->record(timer.nsecsElapsed() / 1000);
         
         if (!cachedFiles.isEmpty()) {
             emit fileListReady(cachedFiles, cachedSizes, cachedDates);
@@ -164,6 +246,28 @@ void SwiftWrapper::parseFileList(const QString &output) {
         }
     }
     
+    MetricsRegistry::instance()->gauge("feeder_device_files", "Files listed on the device.")->set(cachedFiles.size());
+    
+    // EXIF dates are camera wall-clock time, so the listing's UTC dates are
+    // shifted into this Mac's time zone to be comparable
+    {
+        QMutexLocker locker(&pointsMutex);
+        listedPoints.clear();
+        for (int i = 0; i < cachedFiles.size(); ++i) {
+            MediaPoint point;
+            const qint64 utc = parseListingDate(cachedDates[i]);
+            if (utc >= 0) {
+                const QDateTime local = QDateTime::fromMSecsSinceEpoch(utc).toLocalTime();
+                point.timestamp = utc + local.offsetFromUtc() * 1000ll;
+            }
+            listedPoints.insert(cachedFiles[i], point);
+        }
+        for (auto it = downloadedPoints.begin(); it != downloadedPoints.end();) {
+            it = listedPoints.contains(it.key()) ? std::next(it) : downloadedPoints.erase(it);
+        }
+    }
+    SessionRecorder::instance()->listing(cachedFiles, cachedSizes, cachedDates);
+    
 
 }
 
@@ -179,22 +283,252 @@ bool SwiftWrapper::downloadSelectedFiles(const QStringList &selectedFiles,
         parseFileList(output);
     }
     
-    // Now run the download command
-    QStringList args;
-    args << "download" << outputDirectory << fileNamePrefix;
-    args.append(selectedFiles);
+    // Files the policy skips on listing facts alone are never requested
+    QStringList requestedFiles = selectedFiles;
+    if (!policy.isEmpty()) {
+        QHash<QString, int> listed;
+        for (int i = 0; i < cachedFiles.size(); ++i) {
+            listed.insert(cachedFiles[i], i);
+        }
+        requestedFiles.clear();
+        qint64 skippedBytes = 0;
+        for (const QString &file : selectedFiles) {
+            const int index = listed.value(file, -1);
+            PolicyFacts facts = PolicyFacts::fromListing(file, cachedSizes.value(index), cachedDates.value(index),
+                                                         currentDevice);
+            if (policy.evaluate(facts) == PolicyAction::Skip) {
+                skippedBytes += qMax<qint64>(0, facts.size);
+            } else {
+                requestedFiles << file;
+            }
+        }
+        qDebug() << "SwiftWrapper: Policy skips" << selectedFiles.size() - requestedFiles.size()
+                 << "files," << skippedBytes << "bytes";
+        if (requestedFiles.isEmpty()) {
+            return true;
+        }
+    }
     
-    QString output;
-    if (runSwiftCommand(args, output)) {
-        // Wait a bit for downloads to complete, then convert files
-        QThread::msleep(2000); // Wait 2 seconds for downloads to complete
+    // Originals wait for their conversion in a staging area; only outputs
+    // reach the output directory
+    const QStringList destinations = FanoutWriter::splitDestinations(outputDirectory);
+    StagingArea staging(outputDirectory, outputMode == OutputMode::Pack || destinations.size() > 1);
+    QHash<QString, qint64> listedBytes;
+    for (int i = 0; i < cachedFiles.size(); ++i) {
+        listedBytes.insert(cachedFiles[i], cachedSizes.value(i).toLongLong());
+    }
+    
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    Gauge *batchFiles = metrics->gauge("feeder_batch_transfer_files", "Files requested in the current batch.");
+    Gauge *batchDone = metrics->gauge("feeder_batch_transferred_files", "Files transferred in the current batch.");
+    batchFiles->set(requestedFiles.size());
+    batchDone->set(0);
+    metrics->gauge("feeder_batch_conversion_files", "Conversions queued in the current batch.")->set(0);
+    metrics->gauge("feeder_batch_converted_files", "Conversions finished in the current batch.")->set(0);
+    
+    QSettings settings;
+    const int sliceFiles = qMax(1, settings.value("scheduler/sliceFiles", 20).toInt());
+    const bool eventLayout = settings.value("outputLayout").toString() == "events";
+    QHash<QString, QHash<QString, QString>> eventKeys;
+    
+    JobScheduler *scheduler = JobScheduler::instance();
+    scheduler->startBatch(requestedFiles);
+    EncodePlanner *planner = EncodePlanner::instance();
+    if (planner->isActive()) {
+        planner->beginBatch(QStringList(), 0, conversionPool->maxThreadCount());
+    }
+    
+    // Files ImageCapture can serve are read in ranges; the rest, and all of
+    // them when it doesn't answer, are requested whole from the Swift helper.
+    // A replay serves each file the way the recording got it.
+    const bool ranged = replay || (settings.value("transfer/ranged", true).toBool()
+                                   && DeviceFiles::instance()->waitUntilReady(5000));
+    // Originals that wouldn't be kept are converted straight off the device
+    const bool streaming = ranged && !replay && settings.value("stream/fromDevice", true).toBool();
+    const QByteArray deviceKey = currentDevice.toUtf8();
+    const QString rangedFolder = "Feeder_" + QString("%1").arg(crc32c(deviceKey.constData(), deviceKey.size()) & 0xffff,
+                                                               4, 16, QChar('0')).toUpper();
+    
+    QElapsedTimer timer;
+    timer.start();
+    qint64 files = 0;
+    qint64 bytes = 0;
+    bool downloaded = true;
+    
+    // The device is asked for a slice of files at a time while the pools
+    // convert what has already arrived. A file selected meanwhile gets a
+    // slice of its own and is converted right away, with background
+    // encoders paused.
+    bool urgent = false;
+    for (QStringList slice; !(slice = scheduler->takeSlice(sliceFiles, &urgent)).isEmpty();) {
+        JobScope scope(slice, urgent);
+        qint64 sliceBytes = 0;
+        for (const QString &file : slice) {
+            sliceBytes += listedBytes.value(file);
+        }
+        const QString workDirectory = staging.directoryFor(sliceBytes);
+        const QSet<QString> before = deviceFolderFiles(workDirectory);
         
-        convertDownloadedFiles(outputDirectory);
+        const QDir rangedDirectory(QDir(workDirectory).absoluteFilePath(rangedFolder));
+        QStringList helperFiles = slice;
+        QSet<QString> rangedFiles;
+        QList<PendingConversion> streamed;
+        QHash<QString, std::shared_ptr<RangedSource>> replayedHelperFiles;
+        if (ranged) {
+            QDir().mkpath(rangedDirectory.absolutePath());
+            helperFiles.clear();
+            for (const QString &file : slice) {
+                std::shared_ptr<RangedSource> source;
+                if (replay) {
+                    bool recordedRanged = false;
+                    source = replay->transferSource(file, &recordedRanged);
+                    if (source && !recordedRanged) {
+                        replayedHelperFiles.insert(file, source);
+                        source.reset();
+                    }
+                } else {
+                    source = DeviceFiles::instance()->open(file, listedBytes.value(file, -1));
+                }
+                const QString filePath = rangedDirectory.absoluteFilePath(file);
+                PendingConversion conversion;
+                if (source && streaming && planStreamed(file, filePath, source, &conversion)) {
+                    streamed << conversion;
+                    if (eventLayout) {
+                        eventKeys[rangedDirectory.absolutePath()].insert(QFileInfo(filePath).baseName(), file);
+                    }
+                } else if (source && transferRanged(source.get(), filePath)) {
+                    rangedFiles << file;
+                } else {
+                    helperFiles << file;
+                }
+            }
+        }
         
-        return true;
+        bool sliceDownloaded = true;
+        if (!helperFiles.isEmpty()) {
+            QString output;
+            sliceDownloaded = runSwiftCommand(QStringList() << "download" << workDirectory << fileNamePrefix
+                                                            << helperFiles, output);
+            if (sliceDownloaded && replay) {
+                // The helper's files are written from the recording instead;
+                // ranged attempts that failed when recorded come before them
+                for (const QString &file : helperFiles) {
+                    std::shared_ptr<RangedSource> source = replayedHelperFiles.value(file);
+                    bool recordedRanged = !source;
+                    while (recordedRanged) {
+                        source = replay->transferSource(file, &recordedRanged);
+                        if (!source) {
+                            break;
+                        }
+                    }
+                    if (source) {
+                        ChunkedTransfer transfer(source.get(), rangedDirectory.absoluteFilePath(file));
+                        transfer.run();
+                    }
+                }
+            } else if (sliceDownloaded) {
+                // Wait a bit for downloads to complete, then convert files
+                QThread::msleep(2000); // Wait 2 seconds for downloads to complete
+            }
+        }
+        
+        QStringList arrived;
+        QStringList missing = slice;
+        for (const PendingConversion &conversion : streamed) {
+            missing.removeOne(conversion.file);
+        }
+        for (const QString &filePath : deviceFolderFiles(workDirectory) - before) {
+            const QString file = deviceFileFor(filePath, slice);
+            if (missing.removeOne(file)) {
+                arrived << filePath;
+            }
+        }
+        
+        // Cancelling a file stops its whole slice: cancelled and partial
+        // files go, and the rest that didn't make it queue again
+        bool interrupted = false;
+        for (const QString &file : slice) {
+            interrupted = interrupted || scheduler->isCancelled(file);
+        }
+        for (auto it = arrived.begin(); interrupted && it != arrived.end();) {
+            const QString file = deviceFileFor(*it, slice);
+            if (scheduler->isCancelled(file) || (!sliceDownloaded && !isCompleteMediaFile(*it))) {
+                QFile::remove(*it);
+                missing << file;
+                it = arrived.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!sliceDownloaded) {
+            if (interrupted) {
+                scheduler->requeue(missing);
+            } else {
+                downloaded = false;
+            }
+        }
+        
+        // Ranged transfers and streams count and record their own bytes as
+        // they go; of the helper's files only the size is known
+        files += arrived.size() + streamed.size();
+        SessionRecorder *recorder = SessionRecorder::instance();
+        for (const QString &filePath : arrived) {
+            const QString file = deviceFileFor(filePath, slice);
+            if (!rangedFiles.contains(file)) {
+                const qint64 size = QFileInfo(filePath).size();
+                bytes += size;
+                recorder->transferFinished(recorder->transferStarted(file, size), true);
+            }
+        }
+        batchDone->set(files);
+        
+        const QList<PendingConversion> conversions = planConversions(arrived, slice,
+                                                                     eventLayout ? &eventKeys : nullptr)
+                                                     + streamed;
+        if (planner->isActive()) {
+            QStringList videos;
+            int images = 0;
+            for (const PendingConversion &conversion : conversions) {
+                if (mediaKind(mediaTypeOfFile(conversion.filePath)) == MediaKind::Video) {
+                    videos << conversion.filePath;
+                } else {
+                    ++images;
+                }
+            }
+            planner->addToBatch(videos, images);
+        }
+        for (const PendingConversion &conversion : conversions) {
+            if (urgent) {
+                metrics->gauge("feeder_batch_conversion_files", "Conversions queued in the current batch.")->add(1);
+                conversionTask(conversion)();
+            } else {
+                dispatchConversion(conversion);
+            }
+        }
+        runPromotedConversions();
     }
     
-    return false;
+    metrics->counter("feeder_transferred_files_total", "Files transferred from the device.")->add(files);
+    metrics->counter("feeder_transferred_bytes_total", "Bytes transferred from the device.")->add(bytes);
+    metrics->counter("feeder_transfer_failures_total", "Requested files that did not arrive.")
+        ->add(qMax<qint64>(0, requestedFiles.size() - files));
+    metrics->histogram("feeder_transfer_batch_seconds", "Time to transfer one batch.")->record(timer.nsecsElapsed() / 1000);
+    
+    finishConversions(staging.directories(), eventKeys);
+    const bool cancelled = scheduler->isBatchCancelled();
+    scheduler->finishBatch();
+    
+    // What finished before a cancel is still delivered
+    bool success = downloaded && !cancelled;
+    for (const QString &directory : staging.stagedDirectories()) {
+        if (outputMode == OutputMode::Pack) {
+            success = packOutputs(directory, outputDirectory) && success;
+        } else {
+            success = publishOutputs(directory, destinations) && success;
+        }
+    }
+    staging.cleanup();
+    return success;
 }
 
 bool SwiftWrapper::downloadAllFiles(const QString &outputDirectory,
@@ -213,43 +547,120 @@ QString SwiftWrapper::getSelectedDeviceName() {
 }
 
 bool SwiftWrapper::convertFile(const QString &inputPath, const QString &outputPath) {
-    QFileInfo inputFile(inputPath);
-    QString inputExt = inputFile.suffix().toLower();
-    QString outputExt = QFileInfo(outputPath).suffix().toLower();
-    
-    QProcess process;
-    
-    if (inputExt == "heic" && outputExt == "jpg") {
+    const FileConverter *converter = converters.fileConverter(mediaTypeOfFile(inputPath),
+                                                              mediaTypeForPath(outputPath));
+    if (!converter) {
+        // Nothing registered for this pair; the file stays as it is
+        return true;
+    }
+    return (*converter)(inputPath, outputPath);
+}
+
+void SwiftWrapper::registerDefaultConverters() {
+    converters.addFileConverter(MediaType::Heic, MediaType::Jpeg, [](const QString &inputPath, const QString &outputPath) {
         // Use sips for HEIC to JPG conversion (macOS built-in)
+        QProcess process;
         process.setProgram("/usr/bin/sips");
         process.setArguments(QStringList() 
             << "-s" << "format" << "jpeg"
             << "-s" << "formatOptions" << "high"
             << inputPath
             << "--out" << outputPath);
-    } else if (inputExt == "mov" && outputExt == "mp4") {
-        // Use FFmpeg for MOV to MP4 conversion
-        process.setProgram("/opt/homebrew/bin/ffmpeg");
-        process.setArguments(QStringList()
-            << "-i" << inputPath
-            << "-c:v" << "libx264"
-            << "-c:a" << "aac"
-            << "-preset" << "medium"
-            << "-crf" << "23"
-            << "-y"
-            << outputPath);
-    } else {
-        return true;
-    }
+        ResourceGovernor::instance()->applyToProcess(process);
+        JobScheduler::instance()->track(process);
+        process.start();
+        if (!JobScheduler::instance()->waitForFinished(process, 60000)) { // 60 second timeout
+            process.terminate();
+            return false;
+        }
+        return process.exitCode() == 0;
+    });
     
-    process.start();
-    if (!process.waitForFinished(60000)) { // 60 second timeout
-        process.terminate();
-        return false;
-    }
+    converters.addFileConverter(MediaType::Mov, MediaType::Mp4, [this](const QString &inputPath, const QString &outputPath) {
+        // Use FFmpeg for MOV to MP4 conversion, supervised through its
+        // progress stream rather than a fixed timeout
+        QElapsedTimer timer;
+        timer.start();
+        bool success = runFfmpegToMp4(inputPath, QStringList() << "-i" << inputPath << videoCodecArguments(inputPath),
+                                      outputPath);
+        EncodePlanner::instance()->videoFinished(inputPath, timer.nsecsElapsed() / 1000);
+        return success;
+    });
     
-    bool success = process.exitCode() == 0;
-    return success;
+    // Streams copied into an MP4 container, for videos the policy says not to re-encode
+    remuxRoute.name = "remux";
+    remuxRoute.target = MediaType::Mp4;
+    remuxRoute.convert = [this](const QString &inputPath, const QString &outputPath) {
+        return verifiedConversion(inputPath, outputPath, [this](const QString &input, const QString &output) {
+            return runFfmpegToMp4(input, QStringList() << "-i" << input << "-c" << "copy", output);
+        }, true);
+    };
+    remuxRoute.stream = [](RangedSource *source, const QString &, const QString &outputPath) {
+        StreamConverter converter(source);
+        return converter.convertVideo(outputPath, QStringList() << "-c" << "copy");
+    };
+    
+    // Decode HEIC once and write every rendition on the pool
+    ConversionRoute heic;
+    heic.name = "heic";
+    heic.target = MediaType::Jpeg;
+    heic.pooled = true;
+    heic.convert = [this](const QString &inputPath, const QString &outputPath) {
+        QFileInfo output(outputPath);
+        return convertImageRenditions(inputPath, output.absolutePath(), output.completeBaseName());
+    };
+    heic.stream = [this](RangedSource *source, const QString &, const QString &outputPath) {
+        int effort = 1;
+        const ImageRenditioner renditioner(renditionSpecs, plannedFormats(&effort));
+        QFileInfo output(outputPath);
+        StreamConverter converter(source);
+        QElapsedTimer timer;
+        timer.start();
+        bool rendered = converter.convertImage(renditioner, output.absolutePath(), output.completeBaseName());
+        EncodePlanner::instance()->imageFinished(effort, timer.nsecsElapsed() / 1000);
+        return rendered;
+    };
+    converters.addRoute(MediaType::Heic, heic);
+    
+    // Losslessly recompress camera JPEGs when JPEG XL is configured; the
+    // JPEG can be reconstructed bit for bit from the JXL
+    ConversionRoute jpeg;
+    jpeg.name = "jpeg";
+    jpeg.target = MediaType::JpegXl;
+    jpeg.pooled = true;
+    jpeg.accepts = [this](const QString &, const QString &outputPath) {
+        return losslessJpegXl() && !QFileInfo::exists(outputPath);
+    };
+    jpeg.convert = [this](const QString &inputPath, const QString &outputPath) {
+        EncoderSettings settings = *losslessJpegXl();
+        EncodePlanner *planner = EncodePlanner::instance();
+        settings.effort = planner->imageEffort(settings.effort);
+        QElapsedTimer timer;
+        timer.start();
+        bool success = FormatEncoder::recompressJpeg(inputPath, outputPath, settings);
+        planner->imageFinished(settings.effort, timer.nsecsElapsed() / 1000);
+        return success;
+    };
+    converters.addRoute(MediaType::Jpeg, jpeg);
+    
+    // ffmpeg is multithreaded on its own, so videos run on the calling thread
+    ConversionRoute mov;
+    mov.name = "mov";
+    mov.target = MediaType::Mp4;
+    mov.convert = [this](const QString &inputPath, const QString &outputPath) {
+        return verifiedConversion(inputPath, outputPath, [this](const QString &input, const QString &output) {
+            return convertFile(input, output);
+        }, true);
+    };
+    mov.stream = [this](RangedSource *source, const QString &inputPath, const QString &outputPath) {
+        StreamConverter converter(source);
+        QElapsedTimer timer;
+        timer.start();
+        bool success = converter.convertVideo(outputPath, videoCodecArguments(inputPath));
+        EncodePlanner::instance()->videoFinished(inputPath, timer.nsecsElapsed() / 1000);
+        return success;
+    };
+    converters.addRoute(MediaType::Mov, mov);
 }
 
 void SwiftWrapper::convertDownloadedFiles(const QString &outputDirectory) {
@@ -258,42 +669,611 @@ void SwiftWrapper::convertDownloadedFiles(const QString &outputDirectory) {
         return;
     }
     
-    // Look for subdirectories (like Feeder_A01E)
-    QStringList subdirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    // Capture time and place have to be read before the originals go away
+    QSettings settings;
+    bool eventLayout = settings.value("outputLayout").toString() == "events";
+    QHash<QString, QHash<QString, QString>> eventKeys;
+    
+    // Everything is listed first so the encode planner sees the whole batch
+    const QList<PendingConversion> conversions = planConversions(deviceFolderFiles(outputDirectory).values(),
+                                                                 QStringList(),
+                                                                 eventLayout ? &eventKeys : nullptr);
+    EncodePlanner *planner = EncodePlanner::instance();
+    if (planner->isActive()) {
+        QStringList videos;
+        int images = 0;
+        for (const PendingConversion &conversion : conversions) {
+            if (mediaKind(mediaTypeOfFile(conversion.filePath)) == MediaKind::Video) {
+                videos << conversion.filePath;
+            } else {
+                ++images;
+            }
+        }
+        planner->beginBatch(videos, images, conversionPool->maxThreadCount());
+    }
     
-    for (const QString &subdir : subdirs) {
+    for (const PendingConversion &conversion : conversions) {
+        dispatchConversion(conversion);
+    }
+    finishConversions(QStringList() << outputDirectory, eventKeys);
+}
+
+QSet<QString> SwiftWrapper::deviceFolderFiles(const QString &directory) {
+    // Downloads land in per-device subdirectories (like Feeder_A01E)
+    QSet<QString> files;
+    QDir dir(directory);
+    for (const QString &subdir : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
         if (subdir.startsWith("Feeder_")) {
-            QString subdirPath = dir.absoluteFilePath(subdir);
-            QDir subdirDir(subdirPath);
-            
-            // Get all files in the subdirectory
-            QStringList files = subdirDir.entryList(QDir::Files);
+            QDir subdirDir(dir.absoluteFilePath(subdir));
+            for (const QString &file : subdirDir.entryList(QDir::Files)) {
+                files.insert(subdirDir.absoluteFilePath(file));
+            }
+        }
+    }
+    return files;
+}
+
+QString SwiftWrapper::deviceFileFor(const QString &filePath, const QStringList &deviceFiles) {
+    const QString fileName = QFileInfo(filePath).fileName();
+    for (const QString &deviceFile : deviceFiles) {
+        if (fileName.endsWith(deviceFile, Qt::CaseInsensitive)) {
+            return deviceFile;
+        }
+    }
+    return fileName;
+}
+
+QList<SwiftWrapper::PendingConversion> SwiftWrapper::planConversions(
+    const QStringList &filePaths, const QStringList &deviceFiles,
+    QHash<QString, QHash<QString, QString>> *eventKeys) {
+    QList<PendingConversion> conversions;
+    for (const QString &filePath : filePaths) {
+        QFileInfo input(filePath);
+        // The EXIF has to be read before the original goes away
+        const QString file = deviceFileFor(filePath, deviceFiles);
+        {
+            QMutexLocker locker(&pointsMutex);
+            const MediaPoint listed = listedPoints.value(file);
+            locker.unlock();
+            const MediaPoint point = capturePoint(filePath, listed);
+            locker.relock();
+            downloadedPoints.insert(file, point);
+        }
+        if (eventKeys) {
+            (*eventKeys)[input.absolutePath()].insert(input.baseName(), file);
+        }
+        
+        QString outputPath;
+        const MediaType type = mediaTypeOfFile(filePath);
+        const ConversionRoute *route = converters.route(type, filePath, &outputPath);
+        
+        // Rules on codec, resolution or duration need the file itself
+        PolicyAction action = PolicyAction::Transcode;
+        if (!policy.isEmpty()) {
+            PolicyFacts facts = PolicyFacts::fromFile(filePath, currentDevice);
+            bool decided = false;
+            action = policy.evaluate(facts, &decided);
+            if (!decided) {
+                facts.probe(filePath);
+                action = policy.evaluate(facts);
+            }
+        }
+        if (action == PolicyAction::Skip) {
+            QFile::remove(filePath);
+            continue;
+        }
+        if (action == PolicyAction::Keep) {
+            continue;
+        }
+        if (action == PolicyAction::Remux && mediaKind(type) == MediaKind::Video) {
+            outputPath = input.dir().absoluteFilePath(input.baseName() + '.' + mediaTypeName(remuxRoute.target));
+            route = outputPath.compare(filePath, Qt::CaseInsensitive) != 0 ? &remuxRoute : nullptr;
+        }
+        if (!route) {
+            continue;
+        }
+        conversions.append({file, filePath, outputPath, *route});
+    }
+    return conversions;
+}
+
+bool SwiftWrapper::planStreamed(const QString &file, const QString &filePath,
+                                const std::shared_ptr<RangedSource> &source, PendingConversion *conversion) {
+    QString outputPath;
+    const MediaType type = mediaTypeForPath(file);
+    const ConversionRoute *route = converters.route(type, filePath, &outputPath);
+    
+    // Rules that need the file itself can't be settled before it is read
+    if (!policy.isEmpty()) {
+        const int index = cachedFiles.indexOf(file);
+        const PolicyFacts facts = PolicyFacts::fromListing(file, cachedSizes.value(index), cachedDates.value(index),
+                                                           currentDevice);
+        bool decided = false;
+        const PolicyAction action = policy.evaluate(facts, &decided);
+        if (!decided || action == PolicyAction::Skip || action == PolicyAction::Keep) {
+            return false;
+        }
+        if (action == PolicyAction::Remux && mediaKind(type) == MediaKind::Video) {
+            QFileInfo input(filePath);
+            outputPath = input.dir().absoluteFilePath(input.baseName() + '.' + mediaTypeName(remuxRoute.target));
+            route = outputPath.compare(filePath, Qt::CaseInsensitive) != 0 ? &remuxRoute : nullptr;
+        }
+    }
+    // Streaming only pays when the original wouldn't be kept anyway
+    if (!route || !route->stream || !route->removeSource) {
+        return false;
+    }
+    
+    const ConversionRoute streamed = *route;
+    *conversion = {file, filePath, outputPath, streamed};
+    conversion->route.convert = [this, streamed, source, file](const QString &inputPath, const QString &outputPath) {
+        SessionRecorder *recorder = SessionRecorder::instance();
+        const qint64 transferId = recorder->transferStarted(source->name(), source->size());
+        RecordingSource recorded(source.get(), transferId);
+        const bool success = streamed.stream(&recorded, inputPath, outputPath);
+        recorder->transferFinished(transferId, success);
+        if (success) {
+            MetricsRegistry::instance()->counter("feeder_transferred_bytes_total", "Bytes transferred from the device.")
+                ->add(source->size());
+        } else {
+            QFile::remove(outputPath);
+            if (!transferRanged(source.get(), inputPath)) {
+                return false;
+            }
+        }
+        
+        // Renditions carry the original's EXIF; the original has it otherwise
+        {
+            QMutexLocker locker(&pointsMutex);
+            const MediaPoint listed = listedPoints.value(file);
+            locker.unlock();
+            const MediaPoint point = capturePoint(success ? outputPath : inputPath, listed);
+            locker.relock();
+            downloadedPoints.insert(file, point);
+        }
+        return success || streamed.convert(inputPath, outputPath);
+    };
+    return true;
+}
+
+std::function<void()> SwiftWrapper::conversionTask(const PendingConversion &conversion) const {
+    const ConversionRoute job = conversion.route;
+    const QString filePath = conversion.filePath;
+    const QString outputPath = conversion.outputPath;
+    const CancellationToken token = JobScheduler::instance()->token(conversion.file);
+    return [job, filePath, outputPath, token]() {
+        if (token.isCancelled()) {
+            return;
+        }
+        ResourceGovernor *governor = ResourceGovernor::instance();
+        governor->conversionStarted();
+        const bool converted = recordConversion(job.name, [&]() { return job.convert(filePath, outputPath); });
+        governor->conversionFinished();
+        if (!converted) {
+            // Whatever a failed or killed encoder left is unusable
+            QFile::remove(outputPath);
+            QFile::remove(outputPath + ".part");
+            return;
+        }
+        if (!token.isCancelled() && job.removeSource) {
+            QFile::remove(filePath);
+        }
+    };
+}
+
+void SwiftWrapper::dispatchConversion(const PendingConversion &conversion) {
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    Gauge *queueDepth = metrics->gauge("feeder_conversion_queue_depth", "Conversions waiting for a worker.");
+    metrics->gauge("feeder_batch_conversion_files", "Conversions queued in the current batch.")->add(1);
+    queueDepth->add(1);
+    
+    // ffmpeg is multithreaded on its own, so videos go one at a time
+    const std::function<void()> task = conversionTask(conversion);
+    JobScheduler::instance()->submit(conversion.route.pooled ? conversionPool : videoPool, conversion.file,
+                                     [task, queueDepth]() {
+        queueDepth->add(-1);
+        task();
+    });
+}
+
+void SwiftWrapper::runPromotedConversions() {
+    QString file;
+    std::function<void()> task;
+    while (JobScheduler::instance()->takePromotedTask(&file, &task)) {
+        JobScope scope(QStringList() << file, true);
+        task();
+    }
+}
+
+void SwiftWrapper::finishConversions(const QStringList &directories,
+                                     const QHash<QString, QHash<QString, QString>> &eventKeys) {
+    // Keep serving files selected while the pools drain
+    while (!(conversionPool->waitForDone(200) && videoPool->waitForDone(200))) {
+        runPromotedConversions();
+    }
+    // Cancelled tasks never ran to take themselves off the gauge
+    MetricsRegistry::instance()->gauge("feeder_conversion_queue_depth", "Conversions waiting for a worker.")->set(0);
+    qDebug() << "SwiftWrapper: Peak pipeline memory" << MemoryBudget::instance()->peak() / 1048576 << "MB";
+    
+    // Events come from every known file, not just this batch, so folders
+    // get the same names as the file table's event filter
+    emit capturePointsChanged();
+    if (!eventKeys.isEmpty()) {
+        const QHash<QString, QString> events = eventNames(capturePoints());
+        for (auto it = eventKeys.cbegin(); it != eventKeys.cend(); ++it) {
+            QHash<QString, QString> eventOfBaseName;
+            for (auto key = it.value().cbegin(); key != it.value().cend(); ++key) {
+                eventOfBaseName.insert(key.key(), events.value(key.value()));
+            }
+            organizeByEvents(it.key(), eventOfBaseName);
+        }
+    }
+    
+    QSettings settings;
+    if (settings.value("verifyOutputs", false).toBool()) {
+        for (const QString &directory : directories) {
+            QStringList bad = verifyOutputs(directory);
+            if (!bad.isEmpty()) {
+                qDebug() << "SwiftWrapper: Outputs failing verification:" << bad;
+            }
+        }
+    }
+}
+
+MediaPoint SwiftWrapper::capturePoint(const QString &filePath, const MediaPoint &fallback) {
+    MediaPoint point = fallback;
+    ExifInfo exif;
+    if (ExifInfo::read(filePath, &exif)) {
+        if (exif.timestamp >= 0) {
+            point.timestamp = exif.timestamp;
+        }
+        if (exif.hasLocation) {
+            point.hasLocation = true;
+            point.latitude = exif.latitude;
+            point.longitude = exif.longitude;
+        }
+    }
+    if (point.timestamp < 0) {
+        // Videos and screenshots without EXIF keep the capture date as mtime
+        QDateTime modified = QFileInfo(filePath).lastModified();
+        point.timestamp = modified.toMSecsSinceEpoch() + modified.offsetFromUtc() * 1000ll;
+    }
+    return point;
+}
+
+void SwiftWrapper::organizeByEvents(const QString &directory, const QHash<QString, QString> &eventOfBaseName) {
+    // Outputs share their source's base name, possibly with a rendition
+    // suffix: IMG_0001.jpg, IMG_0001_web.jpg -> IMG_0001
+    QHash<QString, QString> targets;
+    for (const QString &file : QDir(directory).entryList(QDir::Files)) {
+        QString baseName = QFileInfo(file).baseName();
+        while (!eventOfBaseName.contains(baseName) && baseName.contains('_')) {
+            baseName = baseName.left(baseName.lastIndexOf('_'));
+        }
+        const QString event = eventOfBaseName.value(baseName);
+        if (!event.isEmpty()) {
+            targets.insert(file, event);
+        }
+    }
+    
+    const QSet<QString> events(targets.cbegin(), targets.cend());
+    int moved = ChecksumManifest::moveFiles(directory, targets);
+    qDebug() << "SwiftWrapper: Sorted" << moved << "files into" << events.size() << "events in" << directory;
+}
+
+QHash<QString, MediaPoint> SwiftWrapper::capturePoints() const {
+    QMutexLocker locker(&pointsMutex);
+    QHash<QString, MediaPoint> points = listedPoints;
+    for (auto it = downloadedPoints.cbegin(); it != downloadedPoints.cend(); ++it) {
+        points.insert(it.key(), it.value());
+    }
+    return points;
+}
+
+QHash<QString, QString> SwiftWrapper::eventNames(const QHash<QString, MediaPoint> &points,
+                                                 QVector<MediaGroup> *groups) {
+    const QStringList keys = points.keys();
+    QVector<MediaPoint> values;
+    values.reserve(keys.size());
+    for (const QString &key : keys) {
+        values << points.value(key);
+    }
+    
+    QVector<int> assignment;
+    const QVector<MediaGroup> clustered = EventClusterer().cluster(values, &assignment);
+    QHash<QString, QString> names;
+    for (int i = 0; i < keys.size(); ++i) {
+        names.insert(keys[i], clustered[assignment[i]].name);
+    }
+    if (groups) {
+        *groups = clustered;
+    }
+    return names;
+}
+
+qint64 SwiftWrapper::parseListingDate(const QString &date) {
+    QDateTime parsed = QDateTime::fromString(date.left(19), "yyyy-MM-dd HH:mm:ss");
+    if (parsed.isValid()) {
+        parsed.setTimeSpec(Qt::UTC);
+    } else {
+        parsed = QDateTime::fromString(date, Qt::ISODate);
+    }
+    return parsed.isValid() ? parsed.toMSecsSinceEpoch() : -1;
+}
+
+bool SwiftWrapper::convertFileVerified(const QString &inputPath, const QString &outputPath) {
+    return verifiedConversion(inputPath, outputPath, [this](const QString &input, const QString &output) {
+        return convertFile(input, output);
+    });
+}
+
+bool SwiftWrapper::verifiedConversion(const QString &inputPath, const QString &outputPath,
+                                      const std::function<bool(const QString &, const QString &)> &convert,
+                                      bool checksummed) {
+    // A killed or crashed converter leaves a truncated file behind; catch
+    // that from the container framing and try once more. Tools that write
+    // their own files (sips) are checksummed by reading the output back.
+    for (int attempt = 1; attempt <= 2; ++attempt) {
+        if (convert(inputPath, outputPath) && isCompleteMediaFile(outputPath)
+            && (checksummed || ChecksumManifest::recordFile(outputPath))) {
+            return true;
+        }
+        QFile::remove(outputPath);
+        qDebug() << "SwiftWrapper: Conversion attempt" << attempt << "failed for" << inputPath;
+    }
+    return false;
+}
+
+bool SwiftWrapper::transferRanged(RangedSource *source, const QString &outputPath) {
+    SessionRecorder *recorder = SessionRecorder::instance();
+    bool success = false;
+    for (int attempt = 1; attempt <= 2 && !success; ++attempt) {
+        const qint64 transferId = recorder->transferStarted(source->name(), source->size());
+        RecordingSource recorded(source, transferId);
+        ChunkedTransfer transfer(&recorded, outputPath);
+        success = transfer.run();
+        recorder->transferFinished(transferId, success);
+    }
+    if (!success) {
+        // The Swift helper fetches it whole instead
+        QFile::remove(ChunkedTransfer::partPath(outputPath));
+        QFile::remove(ChunkedTransfer::partMapPath(outputPath));
+    }
+    return success;
+}
+
+bool SwiftWrapper::runFfmpegToMp4(const QString &inputPath, const QStringList &arguments,
+                                  const QString &outputPath) {
+    // An ordinary MP4 with the index moved to the front, staged under
+    // ".part" and checksummed once ffmpeg has finished with it
+    const QString partPath = outputPath + ".part";
+    TranscodeSupervisor supervisor;
+    supervisor.setOutputPath(partPath);
+    connect(&supervisor, &TranscodeSupervisor::progress, this, &SwiftWrapper::conversionProgress);
+    const QStringList fileArguments = QStringList()
+        << arguments
+        << "-f" << "mp4"
+        << "-movflags" << "+faststart"
+        << "-y" << partPath;
+    if (!supervisor.run(QFileInfo(inputPath).fileName(), "/opt/homebrew/bin/ffmpeg", fileArguments,
+                        TranscodeSupervisor::probeDuration(inputPath))) {
+        return false;
+    }
+    QFile::remove(outputPath);
+    if (!QFile::rename(partPath, outputPath)) {
+        qDebug() << "SwiftWrapper: Cannot move" << partPath << "into place";
+        QFile::remove(partPath);
+        return false;
+    }
+    return ChecksumManifest::recordFile(outputPath);
+}
+
+QStringList SwiftWrapper::videoCodecArguments(const QString &inputPath) const {
+    QStringList arguments = QStringList()
+        << "-c:v" << "libx264"
+        << "-c:a" << "aac"
+        << EncodePlanner::instance()->planVideo(inputPath).ffmpegArguments();
+    arguments << "-threads" << QString::number(ResourceGovernor::instance()->encoderThreads());
+    return arguments;
+}
+
+void SwiftWrapper::setOutputMode(OutputMode mode) {
+    outputMode = mode;
+}
+
+bool SwiftWrapper::packOutputs(const QString &workDirectory, const QString &outputDirectory) {
+    QDir work(workDirectory);
+    const QStringList destinations = FanoutWriter::splitDestinations(outputDirectory);
+    bool success = true;
+    
+    for (const QString &subdir : work.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (!subdir.startsWith("Feeder_")) {
+            continue;
+        }
+        // One pack per destination, each appended from the same local file
+        QList<std::shared_ptr<PackWriter>> packs;
+        for (const QString &destination : destinations) {
+            QDir().mkpath(destination);
+            auto pack = std::make_shared<PackWriter>(QDir(destination).absoluteFilePath(subdir + ".tar"));
+            if (pack->open()) {
+                packs << pack;
+            } else {
+                success = false;
+            }
+        }
+        if (packs.isEmpty()) {
+            continue;
+        }
+        
+        // Event folders become path prefixes inside the pack
+        QDir subdirDir(work.absoluteFilePath(subdir));
+        QDirIterator files(subdirDir.absolutePath(), QDir::Files, QDirIterator::Subdirectories);
+        QStringList folders;
+        bool subdirPacked = packs.size() == destinations.size();
+        while (files.hasNext()) {
+            QString filePath = files.next();
+            bool appended = true;
+            for (const std::shared_ptr<PackWriter> &pack : packs) {
+                appended = pack->append(filePath, subdir + "/" + subdirDir.relativeFilePath(filePath)) && appended;
+            }
+            if (appended && subdirPacked) {
+                QFile::remove(filePath);
+            } else {
+                success = false;
+                subdirPacked = false;
+            }
+        }
+        for (const std::shared_ptr<PackWriter> &pack : packs) {
+            success = pack->close() && success;
+        }
+        if (!subdirPacked) {
+            // Keep the originals and their manifest for the next attempt
+            continue;
+        }
+        
+        // The pack index carries the checksums from here on
+        QDirIterator dirs(subdirDir.absolutePath(), QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (dirs.hasNext()) {
+            folders.prepend(dirs.next());
+        }
+        folders << subdirDir.absolutePath();
+        for (const QString &folder : folders) {
+            QFile::remove(ChecksumManifest::manifestPath(folder));
+            QDir().rmdir(folder);
+        }
+    }
+    
+    return success;
+}
+
+bool SwiftWrapper::publishOutputs(const QString &workDirectory, const QStringList &destinations) {
+    QDir work(workDirectory);
+    bool success = true;
+    
+    for (const QString &subdir : work.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (!subdir.startsWith("Feeder_")) {
+            continue;
+        }
+        QDir subdirDir(work.absoluteFilePath(subdir));
+        QDirIterator files(subdirDir.absolutePath(), QDir::Files, QDirIterator::Subdirectories);
+        bool subdirPublished = true;
+        while (files.hasNext()) {
+            QString filePath = files.next();
+            QStringList targets;
+            for (const QString &destination : destinations) {
+                targets << QDir(destination).absoluteFilePath(work.relativeFilePath(filePath));
+            }
             
-            for (const QString &file : files) {
-                QString filePath = subdirDir.absoluteFilePath(file);
-                QFileInfo fileInfo(filePath);
-                QString ext = fileInfo.suffix().toLower();
-                QString baseName = fileInfo.baseName();
-                
-                // Convert HEIC to JPG
-                if (ext == "heic") {
-                    QString outputPath = subdirDir.absoluteFilePath(baseName + ".jpg");
-                    
-                    if (convertFile(filePath, outputPath)) {
-                        // Delete the original HEIC file
-                        QFile::remove(filePath);
-                    }
+            // A single destination takes a rename when it can
+            if (targets.size() == 1) {
+                if (StagingArea::moveFile(filePath, targets.first())) {
+                    continue;
                 }
-                // Convert MOV to MP4
-                else if (ext == "mov") {
-                    QString outputPath = subdirDir.absoluteFilePath(baseName + ".mp4");
-                    
-                    if (convertFile(filePath, outputPath)) {
-                        // Delete the original MOV file
-                        QFile::remove(filePath);
-                    }
+                success = false;
+                subdirPublished = false;
+                continue;
+            }
+            
+            // Read once, written to every destination with its own manifest entry
+            QList<FanoutResult> results;
+            if (FanoutWriter::copyFile(filePath, targets, &results)) {
+                QFile::remove(filePath);
+                continue;
+            }
+            for (const FanoutResult &result : results) {
+                if (!result.success) {
+                    qDebug() << "SwiftWrapper: Could not publish" << filePath << "to" << result.path;
                 }
             }
+            success = false;
+            subdirPublished = false;
+        }
+        if (!subdirPublished) {
+            continue;
+        }
+        
+        QStringList folders;
+        QDirIterator dirs(subdirDir.absolutePath(), QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (dirs.hasNext()) {
+            folders.prepend(dirs.next());
+        }
+        folders << subdirDir.absolutePath();
+        for (const QString &folder : folders) {
+            QFile::remove(ChecksumManifest::manifestPath(folder));
+            QDir().rmdir(folder);
         }
     }
-} 
\ No newline at end of file
+    
+    return success;
+}
+
+QStringList SwiftWrapper::verifyOutputs(const QString &outputDirectory, bool fast) {
+    QStringList bad;
+    const QStringList destinations = FanoutWriter::splitDestinations(outputDirectory);
+    if (destinations.size() > 1) {
+        for (const QString &destination : destinations) {
+            bad << verifyOutputs(destination, fast);
+        }
+        return bad;
+    }
+    QDir dir(outputDirectory);
+    for (const QString &subdir : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (subdir.startsWith("Feeder_")) {
+            bad << ChecksumManifest::verify(dir.absoluteFilePath(subdir), fast);
+            // Event folders keep manifests of their own
+            QDirIterator events(dir.absoluteFilePath(subdir), QDir::Dirs | QDir::NoDotAndDotDot,
+                                QDirIterator::Subdirectories);
+            while (events.hasNext()) {
+                bad << ChecksumManifest::verify(events.next(), fast);
+            }
+        }
+    }
+    return bad;
+}
+
+bool SwiftWrapper::convertImageRenditions(const QString &inputPath, const QString &outputDirectory,
+                                          const QString &baseName) {
+    int effort = 1;
+    ImageRenditioner renditioner(renditionSpecs, plannedFormats(&effort));
+    QElapsedTimer timer;
+    timer.start();
+    bool rendered = renditioner.render(inputPath, outputDirectory, baseName);
+    EncodePlanner::instance()->imageFinished(effort, timer.nsecsElapsed() / 1000);
+    if (rendered) {
+        return true;
+    }
+    
+    // Fall back to sips for the full-size JPG when Qt has no decoder for the input
+    qDebug() << "SwiftWrapper: Rendition decode failed, falling back to sips for" << inputPath;
+    return convertFileVerified(inputPath, QDir(outputDirectory).absoluteFilePath(baseName + ".jpg"));
+}
+
+QList<EncoderSettings> SwiftWrapper::plannedFormats(int *effort) const {
+    // Effort comes down when the batch falls behind its deadline
+    EncodePlanner *planner = EncodePlanner::instance();
+    QList<EncoderSettings> formats = outputFormats;
+    for (EncoderSettings &settings : formats) {
+        settings.effort = planner->imageEffort(settings.effort);
+        *effort = qMax(*effort, settings.effort);
+    }
+    return formats;
+}
+
+void SwiftWrapper::setRenditionSpecs(const QList<RenditionSpec> &specs) {
+    conversionPool->waitForDone();
+    renditionSpecs = specs.isEmpty() ? ImageRenditioner::defaultSpecs() : specs;
+}
+
+void SwiftWrapper::setOutputFormats(const QList<EncoderSettings> &formats) {
+    conversionPool->waitForDone();
+    outputFormats = formats.isEmpty() ? QList<EncoderSettings>{EncoderSettings()} : formats;
+}
+
+const EncoderSettings *SwiftWrapper::losslessJpegXl() const {
+    for (const EncoderSettings &settings : outputFormats) {
+        if (settings.format == OutputFormat::JpegXl && settings.lossless) {
+            return &settings;
+        }
+    }
+    return nullptr;
+}
@@ -5,6 +5,25 @@
 #include <QString>
 #include <QStringList>
 #include <QProcess>
+#include <QHash>
+#include <QThreadPool>
+#include <QSet>
+#include <QMutex>
+#include <functional>
+#include <memory>
+#include "clustering.h"
+#include "conversion_policy.h"
+#include "converter_registry.h"
+#include "session_recorder.h"
+#include "image_renditions.h"
+#include "transcode_supervisor.h"
+
+// Files writes every output individually; Pack streams them into one
+// append-only tar per device folder (see PackWriter).
+enum class OutputMode {
+    Files,
+    Pack
+};
 
 class SwiftWrapper : public QObject {
     Q_OBJECT
@@ -30,7 +49,31 @@ public:
     
     // Conversion
     bool convertFile(const QString &inputPath, const QString &outputPath);
+    bool convertFileVerified(const QString &inputPath, const QString &outputPath);
+    bool convertImageRenditions(const QString &inputPath, const QString &outputDirectory,
+                                const QString &baseName);
     void convertDownloadedFiles(const QString &outputDirectory);
+    void setRenditionSpecs(const QList<RenditionSpec> &specs);
+    void setOutputFormats(const QList<EncoderSettings> &formats);
+    QStringList verifyOutputs(const QString &outputDirectory, bool fast = true);
+    void setOutputMode(OutputMode mode);
+    bool packOutputs(const QString &workDirectory, const QString &outputDirectory);
+    bool publishOutputs(const QString &workDirectory, const QStringList &destinations);
+    
+    // Capture time and place of every listed file, by device file name: the
+    // listing's date in local wall-clock time until the file has been
+    // downloaded, then its EXIF date and GPS position. The file table's
+    // event filter and the events output layout both cluster these.
+    QHash<QString, MediaPoint> capturePoints() const;
+    // Event name per key of points, and the events themselves if asked.
+    static QHash<QString, QString> eventNames(const QHash<QString, MediaPoint> &points,
+                                              QVector<MediaGroup> *groups = nullptr);
+    // Swift prints dates in UTC as "2025-08-06 09:01:10 +0000"; ms since
+    // epoch, -1 if unparseable.
+    static qint64 parseListingDate(const QString &date);
+    
+    // Answer Swift commands from a recorded session instead of the device
+    void setReplay(SessionReplay *replay);
     
     // Status
     bool isDeviceConnected();
@@ -42,6 +85,8 @@ signals:
     void fileListReady(const QStringList &fileList, const QStringList &sizeList, const QStringList &dateList);
     void downloadProgress(const QString &filename, int progress);
     void downloadComplete(const QString &filename, bool success);
+    void conversionProgress(const TranscodeProgress &progress);
+    void capturePointsChanged();
     
 private:
     QString swiftAppPath;
@@ -49,8 +94,66 @@ private:
     QStringList cachedFiles;
     QStringList cachedSizes;
     QStringList cachedDates;
+    QThreadPool *conversionPool;
+    QThreadPool *videoPool;
+    QList<RenditionSpec> renditionSpecs;
+    QList<EncoderSettings> outputFormats;
+    OutputMode outputMode;
+    ConverterRegistry converters;
+    ConversionRoute remuxRoute;
+    ConversionPolicy policy;
+    SessionReplay *replay = nullptr;
+    mutable QMutex pointsMutex;
+    QHash<QString, MediaPoint> listedPoints;
+    QHash<QString, MediaPoint> downloadedPoints;
+    
+    const EncoderSettings *losslessJpegXl() const;
+    void registerDefaultConverters();
+    // Runs convert, then checks the output is complete and, unless convert
+    // already recorded it, records its checksum; a failed attempt is
+    // deleted and tried once more
+    static bool verifiedConversion(const QString &inputPath, const QString &outputPath,
+                                   const std::function<bool(const QString &, const QString &)> &convert,
+                                   bool checksummed = false);
+    // Runs ffmpeg into "<outputPath>.part" as a +faststart MP4, then moves
+    // it into place and records its checksum
+    bool runFfmpegToMp4(const QString &inputPath, const QStringList &arguments, const QString &outputPath);
+    // H.264/AAC codec arguments as the encode planner sees fit for inputPath
+    QStringList videoCodecArguments(const QString &inputPath) const;
+    // Output formats at the effort the planner allows; effort gets the highest
+    QList<EncoderSettings> plannedFormats(int *effort) const;
+    static MediaPoint capturePoint(const QString &filePath, const MediaPoint &fallback);
+    void organizeByEvents(const QString &directory, const QHash<QString, QString> &eventOfBaseName);
+    
+    // One downloaded file and the route chosen for it
+    struct PendingConversion {
+        QString file;           // name on the device, for the job scheduler
+        QString filePath;
+        QString outputPath;
+        ConversionRoute route;
+    };
+    static QSet<QString> deviceFolderFiles(const QString &directory);
+    static QString deviceFileFor(const QString &filePath, const QStringList &deviceFiles);
+    // eventKeys, if given, receives directory -> base name -> device file
+    // for sorting the outputs into events afterwards
+    QList<PendingConversion> planConversions(const QStringList &filePaths, const QStringList &deviceFiles,
+                                             QHash<QString, QHash<QString, QString>> *eventKeys);
+    // A conversion that reads the device file through source instead of
+    // from filePath, when its route can stream and the policy is settled on
+    // listing facts; if streaming fails it transfers filePath and converts
+    // that as usual
+    bool planStreamed(const QString &file, const QString &filePath, const std::shared_ptr<RangedSource> &source,
+                      PendingConversion *conversion);
+    std::function<void()> conversionTask(const PendingConversion &conversion) const;
+    void dispatchConversion(const PendingConversion &conversion);
+    void runPromotedConversions();
+    void finishConversions(const QStringList &directories,
+                           const QHash<QString, QHash<QString, QString>> &eventKeys);
     
     bool runSwiftCommand(const QStringList &args, QString &output);
+    // Reads a device file in ranges into outputPath, recording its chunks;
+    // a transfer that stops is resumed once from its checkpoint
+    static bool transferRanged(RangedSource *source, const QString &outputPath);
     void parseFileList(const QString &output);
 };
 
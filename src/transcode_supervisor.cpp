@@ -0,0 +1,213 @@
+#include "transcode_supervisor.h"
+#include "job_scheduler.h"
+#include "metrics.h"
+#include "resource_governor.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QSettings>
+
+TranscodeSupervisor::TranscodeSupervisor(QObject *parent) : QObject(parent) {
+    QSettings settings;
+    stallTimeout = settings.value("transcodeStallTimeout", 60).toInt() * 1000;
+}
+
+void TranscodeSupervisor::setStallTimeout(int msecs) {
+    stallTimeout = msecs;
+}
+
+void TranscodeSupervisor::setInput(const InputReader &reader) {
+    input = reader;
+}
+
+void TranscodeSupervisor::setOutputPath(const QString &path) {
+    outputPath = path;
+}
+
+double TranscodeSupervisor::probeDuration(const QString &inputPath) {
+    QString ffprobe = "/opt/homebrew/bin/ffprobe";
+    if (!QFileInfo::exists(ffprobe)) {
+        ffprobe = "ffprobe";
+    }
+
+    QProcess process;
+    process.setProgram(ffprobe);
+    process.setArguments(QStringList()
+        << "-v" << "error"
+        << "-show_entries" << "format=duration"
+        << "-of" << "default=noprint_wrappers=1:nokey=1"
+        << inputPath);
+    process.start();
+    if (!process.waitForFinished(10000) || process.exitCode() != 0) {
+        process.kill();
+        return 0.0;
+    }
+
+    bool ok = false;
+    double duration = QString::fromUtf8(process.readAllStandardOutput()).trimmed().toDouble(&ok);
+    return ok ? duration : 0.0;
+}
+
+void TranscodeSupervisor::applyProgressLine(const QByteArray &line, TranscodeProgress &state) {
+    const int equals = line.indexOf('=');
+    if (equals <= 0) {
+        return;
+    }
+    const QByteArray key = line.left(equals).trimmed();
+    const QByteArray value = line.mid(equals + 1).trimmed();
+
+    // out_time_ms is microseconds as well, a long-standing ffmpeg quirk
+    if (key == "out_time_us" || key == "out_time_ms") {
+        bool ok = false;
+        const qint64 micros = value.toLongLong(&ok);
+        if (ok && micros >= 0) {
+            state.encodedSeconds = micros / 1e6;
+        }
+    } else if (key == "fps") {
+        state.fps = value.toDouble();
+    } else if (key == "speed") {
+        QByteArray speed = value;
+        if (speed.endsWith('x')) {
+            speed.chop(1);
+        }
+        state.speed = speed.toDouble();
+    }
+}
+
+bool TranscodeSupervisor::run(const QString &jobName, const QString &program, const QStringList &arguments,
+                              double durationSeconds) {
+    QProcess process;
+    process.setProgram(program);
+    process.setArguments(QStringList() << "-nostats" << "-progress" << "pipe:1" << arguments);
+    ResourceGovernor::instance()->applyToProcess(process);
+    JobScheduler *scheduler = JobScheduler::instance();
+    scheduler->track(process);
+    process.start();
+    if (!process.waitForStarted()) {
+        qDebug() << "TranscodeSupervisor: Cannot start" << program;
+        return false;
+    }
+
+    TranscodeProgress state;
+    state.jobName = jobName;
+    state.durationSeconds = durationSeconds;
+
+    // Unlabelled, so a long import does not leave a series behind per file;
+    // the job name is in the log
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    fpsGauge = metrics->gauge("feeder_transcode_fps", "Frames per second of the current transcode.");
+    speedGauge = metrics->gauge("feeder_transcode_speed_percent",
+                                "Encode speed of the current transcode, in percent of realtime.");
+    etaGauge = metrics->gauge("feeder_transcode_eta_seconds",
+                              "Estimated seconds left for the current transcode, -1 if unknown.");
+    etaGauge->set(-1);
+
+    QElapsedTimer wall;
+    wall.start();
+    QElapsedTimer sinceProgress;
+    sinceProgress.start();
+    double lastEncoded = -1.0;
+    QByteArray pending;
+    QByteArray errorTail;
+    bool inputOpen = bool(input);
+
+    while (true) {
+        const bool running = process.state() != QProcess::NotRunning;
+        // A few chunks stay queued on stdin; QProcess writes them as ffmpeg reads
+        while (running && inputOpen && process.bytesToWrite() < (4 << 20)) {
+            QByteArray chunk;
+            if (!input(&chunk)) {
+                qDebug() << "TranscodeSupervisor:" << jobName << "input failed";
+                process.kill();
+                process.waitForFinished();
+                return finish(false, state, 0.0);
+            }
+            if (chunk.isEmpty()) {
+                process.closeWriteChannel();
+                inputOpen = false;
+            } else {
+                process.write(chunk);
+            }
+        }
+        if (running && inputOpen) {
+            process.waitForBytesWritten(100);
+        } else if (running) {
+            process.waitForReadyRead(500);
+        }
+
+        pending += process.readAllStandardOutput();
+        // Keep only the end of ffmpeg's log for the failure message
+        errorTail = (errorTail + process.readAllStandardError()).right(4096);
+
+        int newline;
+        while ((newline = pending.indexOf('\n')) >= 0) {
+            const QByteArray line = pending.left(newline);
+            pending.remove(0, newline + 1);
+
+            if (!line.startsWith("progress=")) {
+                applyProgressLine(line, state);
+                continue;
+            }
+
+            // One progress block is complete
+            if (state.encodedSeconds > lastEncoded) {
+                lastEncoded = state.encodedSeconds;
+                sinceProgress.restart();
+            }
+            state.finished = line.endsWith("end");
+            if (state.speed > 0.0 && state.durationSeconds > 0.0) {
+                state.etaSeconds = qMax(0.0, (state.durationSeconds - state.encodedSeconds) / state.speed);
+            }
+            fpsGauge->set(qRound64(state.fps));
+            speedGauge->set(qRound64(state.speed * 100));
+            etaGauge->set(qRound64(state.etaSeconds));
+            emit progress(state);
+        }
+
+        if (!running) {
+            break;
+        }
+        // A job paused for urgent work isn't stalled
+        if (scheduler->isSuspended(process.processId())) {
+            sinceProgress.restart();
+        }
+        if (sinceProgress.elapsed() > stallTimeout) {
+            qDebug() << "TranscodeSupervisor:" << jobName << "stalled at" << state.encodedSeconds
+                     << "s, no progress for" << stallTimeout / 1000 << "s";
+            process.kill();
+            process.waitForFinished();
+            return finish(false, state, 0.0);
+        }
+    }
+
+    const bool success = process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0;
+    const double seconds = wall.elapsed() / 1000.0;
+    if (success) {
+        qDebug() << "TranscodeSupervisor:" << jobName << "encoded" << state.encodedSeconds << "s of media in"
+                 << seconds << "s (" << (seconds > 0 ? state.encodedSeconds / seconds : 0.0) << "x realtime)";
+    } else {
+        qDebug() << "TranscodeSupervisor:" << jobName << "failed:" << errorTail;
+    }
+    return finish(success, state, seconds);
+}
+
+bool TranscodeSupervisor::finish(bool success, const TranscodeProgress &state, double seconds) {
+    // The gauges only describe a running job
+    fpsGauge->set(0);
+    speedGauge->set(0);
+    etaGauge->set(-1);
+
+    if (success && seconds > 0.0) {
+        // Hundredths of realtime, exported as plain multiples of it
+        static Histogram *speed = MetricsRegistry::instance()->histogram(
+            "feeder_transcode_speed", "Media seconds encoded per wall second.", 100.0);
+        speed->record(qRound64(state.encodedSeconds / seconds * 100));
+    }
+    if (!success && !outputPath.isEmpty()) {
+        // A killed or failed ffmpeg leaves a truncated file behind
+        QFile::remove(outputPath);
+    }
+    return success;
+}
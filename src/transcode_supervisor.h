@@ -0,0 +1,73 @@
+#ifndef TRANSCODE_SUPERVISOR_H
+#define TRANSCODE_SUPERVISOR_H
+
+#include <QMetaType>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <functional>
+
+class Gauge;
+
+struct TranscodeProgress {
+    QString jobName;
+    double encodedSeconds = 0.0;
+    double durationSeconds = 0.0;  // 0 when the input duration is unknown
+    double fps = 0.0;
+    double speed = 0.0;            // media seconds encoded per wall second
+    double etaSeconds = -1.0;      // -1 when it cannot be estimated
+    bool finished = false;
+
+    double fraction() const {
+        return durationSeconds > 0.0 ? qBound(0.0, encodedSeconds / durationSeconds, 1.0) : 0.0;
+    }
+};
+Q_DECLARE_METATYPE(TranscodeProgress)
+
+// Runs ffmpeg with "-progress pipe:1" and follows the progress stream
+// instead of a wall-clock limit. A job is only killed when no new progress
+// arrives for the stall timeout, so long 4K encodes run to completion.
+// The running job exports feeder_transcode_fps, _speed_percent and
+// _eta_seconds gauges; finished ones record their speed in
+// feeder_transcode_speed.
+class TranscodeSupervisor : public QObject {
+    Q_OBJECT
+
+public:
+    explicit TranscodeSupervisor(QObject *parent = nullptr);
+
+    // Defaults to the "transcodeStallTimeout" setting (seconds), else 60 s.
+    void setStallTimeout(int msecs);
+
+    // Feeds ffmpeg's stdin for "-i pipe:0". The reader is called whenever
+    // the pipe has room; it leaves *chunk empty at the end of the input and
+    // returns false when the input failed, which ends the job.
+    using InputReader = std::function<bool(QByteArray *chunk)>;
+    void setInput(const InputReader &reader);
+
+    // Output file to delete when the job fails, stalls or is killed.
+    void setOutputPath(const QString &path);
+
+    // Blocks until the job exits or stalls; returns true on a clean exit.
+    bool run(const QString &jobName, const QString &program, const QStringList &arguments,
+             double durationSeconds = 0.0);
+
+    // Container duration from ffprobe, 0 if it cannot be determined.
+    static double probeDuration(const QString &inputPath);
+
+signals:
+    void progress(const TranscodeProgress &progress);
+
+private:
+    int stallTimeout;
+    InputReader input;
+    QString outputPath;
+    Gauge *fpsGauge = nullptr;
+    Gauge *speedGauge = nullptr;
+    Gauge *etaGauge = nullptr;
+
+    bool finish(bool success, const TranscodeProgress &state, double seconds);
+    static void applyProgressLine(const QByteArray &line, TranscodeProgress &state);
+};
+
+#endif // TRANSCODE_SUPERVISOR_H